@@ -42,12 +42,55 @@
 #include <linux/ctype.h>
 #include <linux/mutex.h>
 #include <linux/gpio.h>
+#include <linux/fs.h>
+#include <linux/cdev.h>
+#include <linux/idr.h>
+#include <linux/uaccess.h>
+#include <linux/compat.h>
+#include <linux/workqueue.h>
+#include <linux/ktime.h>
+#include <linux/list.h>
+#include <linux/kref.h>
+#include <linux/slab.h>
+#include <linux/thermal.h>
+#include <linux/of.h>
+#include <net/genetlink.h>
+
+#define RGBW_MAX_DEVICES 256
 
 static const char *const rgbw_types[] = {
     [RGBW_PWM] = "hard_pwm",
     [RGBW_GPIO] = "soft_pwm",
 };
 
+static void rgbw_genl_notify(struct rgbw_device *rgbw_dev, u32 seq);
+
+static const char *rgbw_type_name(enum rgbw_type type)
+{
+    if (type != RGBW_PWM && type != RGBW_GPIO)
+        return "none";
+    return rgbw_types[type];
+}
+
+/**
+ * rgbw_notify_state - signal a change of the rgbw device state
+ * @rgbw_dev: the rgbw device that changed
+ *
+ * Bumps the state sequence number, wakes poll() on the "state"
+ * attribute and multicasts the new state to netlink subscribers. Safe
+ * to call from timer context, so drivers call it from their effect
+ * callbacks as well.
+ */
+void rgbw_notify_state(struct rgbw_device *rgbw_dev)
+{
+    u32 seq = atomic_inc_return(&rgbw_dev->seq);
+
+    if (rgbw_dev->state_kn)
+        sysfs_notify_dirent(rgbw_dev->state_kn);
+    rgbw_genl_notify(rgbw_dev, seq);
+}
+EXPORT_SYMBOL(rgbw_notify_state);
+
 static void rgbw_generate_event(struct rgbw_device *rgbw_dev)
 {
     char *envp[2];
@@ -55,7 +98,8 @@ static void rgbw_generate_event(struct rgbw_device *rgbw_dev)
     envp[0] = "SOURCE=sysfs";
     envp[1] = NULL;
     kobject_uevent_env(&rgbw_dev->dev.kobj, KOBJ_CHANGE, envp);
-    sysfs_notify(&rgbw_dev->dev.kobj, NULL, "rgbw_values");
+    sysfs_notify(&rgbw_dev->dev.kobj, NULL, "RGBW_values");
+    rgbw_notify_state(rgbw_dev);
 }
 
 static ssize_t rgbw_set_rainbow(struct device *dev,
@@ -98,7 +142,7 @@ static ssize_t rgbw_set_rainbow(struct device *dev,
     }
        
     mutex_lock(&rgbw_dev->ops_lock);
-    if (rgbw_dev->ops) { 
+    if (rgbw_get_ops(rgbw_dev)) { 
         if (!cmd) {
             if (rgbw_dev->acts.bstate < INVALID_COLOR) {
                 /*  restore our previous state before starting pulse */
@@ -177,7 +221,7 @@ static ssize_t rgbw_set_heartbeat(struct device *dev,
     }
     
     mutex_lock(&rgbw_dev->ops_lock);
-    if (rgbw_dev->ops) { 
+    if (rgbw_get_ops(rgbw_dev)) { 
         if (!cmd) {
             if (rgbw_dev->acts.bstate <= MAX_COLORS) {                
                 /*  restore our previous state before starting pulse */
@@ -254,7 +298,7 @@ static ssize_t rgbw_set_blink(struct device *dev,
     }
     
     mutex_lock(&rgbw_dev->ops_lock);
-    if (rgbw_dev->ops) { 
+    if (rgbw_get_ops(rgbw_dev)) { 
         if (!cmd) {
             if (rgbw_dev->acts.bstate <= MAX_COLORS) {
                 /*  restore our previous state before starting pulse */
@@ -324,7 +368,7 @@ static ssize_t rgbw_set_pulse(struct device *dev,
     }
     
     mutex_lock(&rgbw_dev->ops_lock);
-    if (rgbw_dev->ops) { 
+    if (rgbw_get_ops(rgbw_dev)) { 
         if (strncmp(buf, "stop", strlen("stop")) == 0) {
             if (rgbw_dev->acts.pcolor < MAX_COLORS) {
                 /*  restore our previous state before starting pulse */
@@ -386,21 +430,12 @@ static ssize_t rgbw_show_values(struct device *dev,
         struct device_attribute *attr, char *buf)
 {
     struct rgbw_device *rgbw_dev = to_rgbw_device(dev);
-    char html_value[strlen("#RRGGBBWW")];
-    char tmp[3] = "";
-    int cntr;
-    
-    html_value[0] = '#';
-    html_value[1] = '\0';
-    
-    for (cntr = COLOR_RED; cntr < MAX_COLORS; cntr++) {
-        bin2hex(tmp, &rgbw_dev->props[cntr].brightness, 1); 
-        tmp[2] = '\0';
-        strncat(html_value, tmp, strlen(tmp)); 
-    }
     
-    return sprintf(buf, "HTML Code (#RRGGBBWW) = %s\nRed = %d\nGreen = %d\nBlue = %d\nWhite = %d\n",
-            html_value,
+    return sprintf(buf, "HTML Code (#RRGGBBWW) = #%02x%02x%02x%02x\nRed = %d\nGreen = %d\nBlue = %d\nWhite = %d\n",
+            rgbw_dev->props[COLOR_RED].brightness & 0xff,
+            rgbw_dev->props[COLOR_GREEN].brightness & 0xff,
+            rgbw_dev->props[COLOR_BLUE].brightness & 0xff,
+            rgbw_dev->props[COLOR_WHITE].brightness & 0xff,
             rgbw_dev->props[COLOR_RED].brightness,
             rgbw_dev->props[COLOR_GREEN].brightness,
             rgbw_dev->props[COLOR_BLUE].brightness,
@@ -434,6 +469,19 @@ static ssize_t rgbw_show_single_color(struct device *dev,
     return sprintf(buf, "%d\n", rgbw_dev->props[color].brightness);
 }
 
+/* Tell the user which effect keeps the colors from being set */
+static void rgbw_effect_busy(struct rgbw_device *rgbw_dev)
+{
+    if (rgbw_dev->acts.state & RGBW_PULSE_ON)
+        pr_info("pulse is currently active, stop it first...\n");
+    else if (rgbw_dev->acts.state & RGBW_BLINK_ON)
+        pr_info("blink is currently active, stop it first...\n");
+    else if (rgbw_dev->acts.state & RGBW_HB_ON)
+        pr_info("heartbeat is currently active, stop it first...\n");
+    else if (rgbw_dev->acts.state & RGBW_RB_ON)
+        pr_info("rainbow is currently active, stop it first...\n");
+}
+
 static ssize_t rgbw_store_single_color(struct device *dev,
         struct device_attribute *attr, const char *buf, size_t count)
 {
@@ -442,23 +490,6 @@ static ssize_t rgbw_store_single_color(struct device *dev,
     unsigned long brightness;
     int color = COLOR_RED;
     
-    if (rgbw_dev->acts.state & RGBW_PULSE_ON) {
-        pr_info("pulse is currently active, stop it first...\n");
-        return count;
-    }
-    if (rgbw_dev->acts.state & RGBW_BLINK_ON) {
-        pr_info("blink is currently active, stop it first...\n");
-        return count;
-    }
-    if (rgbw_dev->acts.state & RGBW_HB_ON) {
-        pr_info("heartbeat is currently active, stop it first...\n");
-        return count;
-    }
-    if (rgbw_dev->acts.state & RGBW_RB_ON) {
-        pr_info("rainbow is currently active, stop it first...\n");
-        return count;
-    }
-    
     rc = kstrtoul(buf, 0, &brightness);
         if (rc)
             return rc;
@@ -477,11 +508,17 @@ static ssize_t rgbw_store_single_color(struct device *dev,
     }
     else {
         pr_info("this is not a valid function, it is %s\n", attr->attr.name);
-        rc = -ENXIO;
+        return -ENXIO;
     }
     
+    /* an effect is only started under ops_lock, so it can not start under us */
     mutex_lock(&rgbw_dev->ops_lock);
-    if (rgbw_dev->ops) {
+    if (rgbw_dev->acts.state & RGBW_EFFECTS_MASK) {
+        rgbw_effect_busy(rgbw_dev);
+        mutex_unlock(&rgbw_dev->ops_lock);
+        return count;
+    }
+    if (rgbw_get_ops(rgbw_dev)) {
         if (brightness > rgbw_dev->props[color].max_brightness)
             rc = -EINVAL;
         else {
@@ -504,114 +541,26 @@ static ssize_t rgbw_store_single_color(struct device *dev,
 static ssize_t rgbw_store_values(struct device *dev,
         struct device_attribute *attr, const char *buf, size_t count)
 {
-    int rc = 0, cntr, hi, lo;
+    int rc = 0, cntr;
     struct rgbw_device *rgbw_dev = to_rgbw_device(dev);
-    unsigned char brightness[MAX_COLORS];
-    char red_hex[3] = ""; 
-    char grn_hex[3] = ""; 
-    char blu_hex[3] = "";
-    char wht_hex[3] = "";
+    unsigned int brightness[MAX_COLORS];
     
-    if (rgbw_dev->acts.state & RGBW_PULSE_ON) {
-        pr_info("pulse is currently active, stop it first...\n");
-        return count;
-    }
-    if (rgbw_dev->acts.state & RGBW_BLINK_ON) {
-        pr_info("blink is currently active, stop it first...\n");
-        return count;
-    }
-    if (rgbw_dev->acts.state & RGBW_HB_ON) {
-        pr_info("heartbeat is currently active, stop it first...\n");
-        return count;
-    }
-    if (rgbw_dev->acts.state & RGBW_RB_ON) {
-        pr_info("rainbow is currently active, stop it first...\n");
-        return count;
-    }
-
     /* Change the buf string into a valid RGB[W] value
      * and recursively change the brightness of each color to match
      */
-    if (strncmp(buf, "#", 1) != 0) {
-        dev_err(dev, "your HTML RGB[W] value must begin with the \"#\" symbol\n");
-        return -EINVAL;
-    }
-
-    if ((strlen(buf) - 1) < 7) {
-        dev_err(dev, "your HTML RGB[W] value is too short with %d characters. Use \"#RRGGBB[WW]\" format\n", strlen(buf) - 1);
-        return -EINVAL;
-    }
-    
-    if ((strlen(buf) - 1) > 9) {
-        dev_err(dev, "your HTML RGB[W] value is too long with %d characters. Use \"#RRGGBB[WW]\" format\n", strlen(buf) - 1);
-        return -EINVAL;
-    }
-    
-    if ((strlen(buf) - 1) == 8) {
-        dev_err(dev, "your HTML [W] value is incomplete. Use \"#RRGGBB[WW]\" format\n");
-        return -EINVAL;
-    }
-    
-    
-    
-    strncpy(red_hex, buf+1, 2);
-    red_hex[2] = '\0'; 
-    strncpy(grn_hex, buf+3, 2);
-    grn_hex[2] = '\0'; 
-    strncpy(blu_hex, buf+5, 2);
-    blu_hex[2] = '\0'; 
-    if ((strlen(buf) - 1) == 9) {
-        strncpy(wht_hex, buf+7, 2);
-        wht_hex[2] = '\0'; 
-    }
-          
-    hi = hex_to_bin(red_hex[0]);
-    lo = hex_to_bin(red_hex[1]);
-
-    if ((hi < 0) || (lo < 0)) {
-        dev_err(dev, "your HTML red value is not in hex format, %u is not a valid conversion\n", (hi << 4) | lo);
-        return -EINVAL;
-    }
-    
-    brightness[COLOR_RED] = (hi << 4) | lo;
-    
-    hi = hex_to_bin(grn_hex[0]);
-    lo = hex_to_bin(grn_hex[1]);
-
-    if ((hi < 0) || (lo < 0)) {
-        dev_err(dev, "your HTML green value is not in hex format, %u is not a valid conversion\n", (hi << 4) | lo);
-        return -EINVAL;
-    }
-    
-    brightness[COLOR_GREEN] = (hi << 4) | lo;
-    
-    hi = hex_to_bin(blu_hex[0]);
-    lo = hex_to_bin(blu_hex[1]);
-
-    if ((hi < 0) || (lo < 0)) {
-        dev_err(dev, "your HTML blue value is not in hex format, %u is not a valid conversion\n", (hi << 4) | lo);
+    brightness[COLOR_WHITE] = rgbw_dev->props[COLOR_WHITE].brightness;
+    if (rgbw_parse_html(buf, count, brightness) < 0) {
+        dev_err(dev, "invalid HTML RGB[W] value, use \"#RRGGBB[WW]\" format in hex\n");
         return -EINVAL;
     }
     
-    brightness[COLOR_BLUE] = (hi << 4) | lo;
-   
-   
-    if (strlen(wht_hex) > 1) {
-        hi = hex_to_bin(wht_hex[0]);
-        lo = hex_to_bin(wht_hex[1]);
-
-        if ((hi < 0) || (lo < 0)) {
-            dev_err(dev, "your HTML white value is not in hex format, %u is not a valid conversion\n", (hi << 4) | lo);
-            return -EINVAL;
-        }
-    
-        brightness[COLOR_WHITE] = (hi << 4) | lo;
-    }
-    else
-        brightness[COLOR_WHITE] = rgbw_dev->props[COLOR_WHITE].brightness;
-    
     mutex_lock(&rgbw_dev->ops_lock);
-    if (rgbw_dev->ops) {
+    if (rgbw_dev->acts.state & RGBW_EFFECTS_MASK) {
+        rgbw_effect_busy(rgbw_dev);
+        mutex_unlock(&rgbw_dev->ops_lock);
+        return count;
+    }
+    if (rgbw_get_ops(rgbw_dev)) {
         for (cntr = COLOR_RED; cntr < MAX_COLORS; cntr++) {
             pr_debug("set %s brightness to %d\n", color_names[cntr], brightness[cntr]);
             rgbw_dev->props[cntr].brightness = brightness[cntr];
@@ -630,228 +579,2570 @@ static ssize_t rgbw_show_types(struct device *dev,
         struct device_attribute *attr, char *buf)
 {
     struct rgbw_device *rgbw_dev = to_rgbw_device(dev);
-    char *all_types = "";
     
-    sprintf(all_types, "Red = %s\nGreen = %s\nBlue = %s\nWhite = %s", 
-            rgbw_types[rgbw_dev->props[COLOR_RED].type], 
-            rgbw_types[rgbw_dev->props[COLOR_GREEN].type], 
-            rgbw_types[rgbw_dev->props[COLOR_BLUE].type], 
-            rgbw_types[rgbw_dev->props[COLOR_WHITE].type]);
-    
-    return sprintf(buf, "%s\n", all_types);
+    return sprintf(buf, "Red = %s\nGreen = %s\nBlue = %s\nWhite = %s\n", 
+            rgbw_type_name(rgbw_dev->props[COLOR_RED].type), 
+            rgbw_type_name(rgbw_dev->props[COLOR_GREEN].type), 
+            rgbw_type_name(rgbw_dev->props[COLOR_BLUE].type), 
+            rgbw_type_name(rgbw_dev->props[COLOR_WHITE].type));
 }
 
 static ssize_t rgbw_show_max_brightness(struct device *dev,
         struct device_attribute *attr, char *buf)
 {
     struct rgbw_device *rgbw_dev = to_rgbw_device(dev);
-    char *all_max = "";
     
-    sprintf(all_max, "Red = %d\nGreen = %d\nBlue = %d\nWhite = %d", 
+    return sprintf(buf, "Red = %d\nGreen = %d\nBlue = %d\nWhite = %d\n", 
             rgbw_dev->props[COLOR_RED].max_brightness,
             rgbw_dev->props[COLOR_GREEN].max_brightness,
             rgbw_dev->props[COLOR_BLUE].max_brightness,
             rgbw_dev->props[COLOR_WHITE].max_brightness);
-    
-    return sprintf(buf, "%s\n", all_max);
 }
 
-static struct class *rgbw_class;
+/* 
+ * Shared supplies: the budget of each group and the draw its devices
+ * last asked for. Every frame only moves its own device's share of the
+ * total, so the cost does not grow with the number of strips.
+ */
+static unsigned int rgbw_supply_budget[RGBW_SUPPLY_GROUPS];
+static atomic_long_t rgbw_supply_draw[RGBW_SUPPLY_GROUPS];
+/* 
+ * Group scale last seen. The other devices of a group follow every cut
+ * so the budget is never exceeded, but only big moves back up.
+ */
+static u32 rgbw_supply_scale[RGBW_SUPPLY_GROUPS] = {
+    [0 ... RGBW_SUPPLY_GROUPS - 1] = RGBW_POWER_ONE,
+};
+static unsigned long rgbw_supply_kick;
+/* a group scale rise bigger than this re-runs the rest of the group */
+#define RGBW_SUPPLY_KICK        (RGBW_POWER_ONE / 64)
 
-static int rgbw_suspend(struct device *dev, pm_message_t state)
+static void rgbw_supply_work_fn(struct work_struct *work);
+static DECLARE_WORK(rgbw_supply_work, rgbw_supply_work_fn);
+
+static void rgbw_kick_supply(unsigned int group)
 {
-    struct rgbw_device *rgbw_dev = to_rgbw_device(dev);
-    int cntr;
-    
-    mutex_lock(&rgbw_dev->ops_lock);
-    if (rgbw_dev->ops && rgbw_dev->ops->options & RGBW_CORE_SUSPENDRESUME) {
-        for (cntr = COLOR_RED; cntr < MAX_COLORS; cntr++) {
-            rgbw_dev->props[cntr].state |= RGBW_CORE_SUSPENDED;
+    set_bit(group, &rgbw_supply_kick);
+    schedule_work(&rgbw_supply_work);
+}
+
+/* 
+ * Scale that keeps out[] within the device and group budgets, the same
+ * for every color so the hue is kept. Called with corr->lock held.
+ */
+static u32 rgbw_limit_power(struct rgbw_device *rgbw_dev, const int max[MAX_COLORS],
+        const u32 out[MAX_COLORS])
+{
+    struct rgbw_power *pw = &rgbw_dev->power;
+    unsigned int group = pw->group;
+    unsigned long draw, total;
+    u32 scale, group_scale, applied;
+
+    draw = rgbw_power_draw(out, max, pw->current_ua, READ_ONCE(rgbw_dev->dim_level));
+    scale = rgbw_power_scale(draw, pw->budget_ua);
+    if (group) {
+        total = atomic_long_add_return(draw - pw->draw_ua, &rgbw_supply_draw[group]);
+        group_scale = rgbw_power_scale(total, READ_ONCE(rgbw_supply_budget[group]));
+        applied = READ_ONCE(rgbw_supply_scale[group]);
+        if (group_scale < applied || group_scale > applied + RGBW_SUPPLY_KICK) {
+            WRITE_ONCE(rgbw_supply_scale[group], group_scale);
+            rgbw_kick_supply(group);
         }
-        rgbw_update_status(rgbw_dev);
+        scale = min(scale, group_scale);
     }
-    mutex_unlock(&rgbw_dev->ops_lock);
+    pw->draw_ua = draw;
+    pw->scale = scale;
 
-    return 0;
+    return scale;
 }
 
-static int rgbw_resume(struct device *dev)
+/* Called with corr->lock held */
+static void __rgbw_update_output(struct rgbw_device *rgbw_dev)
 {
-    struct rgbw_device *rgbw_dev = to_rgbw_device(dev);
+    u32 in[MAX_COLORS], out[MAX_COLORS];
+    int max[MAX_COLORS];
+    u32 scale = rgbw_dev->thermal.cur_scale;
     int cntr;
-    
-    mutex_lock(&rgbw_dev->ops_lock);
-    if (rgbw_dev->ops && rgbw_dev->ops->options & RGBW_CORE_SUSPENDRESUME) {
+
+    for (cntr = COLOR_RED; cntr < MAX_COLORS; cntr++) {
+        in[cntr] = rgbw_get_fine(&rgbw_dev->props[cntr]);
+        max[cntr] = rgbw_dev->props[cntr].max_brightness;
+    }
+    if (rgbw_dev->comp.active)
+        rgbw_compose(rgbw_dev->comp.layers, RGBW_LAYERS, jiffies, max, in);
+    rgbw_correct(&rgbw_dev->corr, in, max, out);
+
+    /* both limits are ceilings on the requested output, the lower wins */
+    if (rgbw_dev->power.enabled)
+        scale = min(scale, rgbw_limit_power(rgbw_dev, max, out));
+    if (scale < RGBW_POWER_ONE) {
         for (cntr = COLOR_RED; cntr < MAX_COLORS; cntr++) {
-            rgbw_dev->props[cntr].state &= ~RGBW_CORE_SUSPENDED;
+            out[cntr] = ((u64)out[cntr] * scale) >> 16;
         }
-        rgbw_update_status(rgbw_dev);
     }
-    mutex_unlock(&rgbw_dev->ops_lock);
-
-    return 0;
+    for (cntr = COLOR_RED; cntr < MAX_COLORS; cntr++) {
+        WRITE_ONCE(rgbw_dev->out[cntr], out[cntr]);
+    }
 }
 
-static void rgbw_device_release(struct device *dev)
+/* The output stage only runs when one of its steps does something */
+static inline bool rgbw_output_needed(struct rgbw_device *rgbw_dev)
 {
-    struct rgbw_device *rgbw_dev = to_rgbw_device(dev);
-    kfree(rgbw_dev);
+    return !rgbw_dev->corr.identity || rgbw_dev->corr.white_extract ||
+           rgbw_dev->power.enabled || rgbw_dev->thermal.cur_scale < RGBW_POWER_ONE ||
+           rgbw_dev->comp.active;
 }
 
-static DEVICE_ATTR(RGBW_values, 00644, rgbw_show_values, rgbw_store_values);
-static DEVICE_ATTR(red_value, 00644, rgbw_show_single_color, rgbw_store_single_color);
-static DEVICE_ATTR(green_value, 00644, rgbw_show_single_color, rgbw_store_single_color);
-static DEVICE_ATTR(blue_value, 00644, rgbw_show_single_color, rgbw_store_single_color);
-static DEVICE_ATTR(white_value, 00644, rgbw_show_single_color, rgbw_store_single_color);
-static DEVICE_ATTR(per_color_max_value, 00444, rgbw_show_max_brightness, NULL);
-static DEVICE_ATTR(RGBW_types, 00444, rgbw_show_types, NULL);
-static DEVICE_ATTR(pulse, 00200, NULL, rgbw_set_pulse);
-static DEVICE_ATTR(blink, 00200, NULL, rgbw_set_blink);
-static DEVICE_ATTR(heartbeat, 00200, NULL, rgbw_set_heartbeat);
-static DEVICE_ATTR(rainbow, 00200, NULL, rgbw_set_rainbow);
-
-static struct attribute *rgbw_attrs[] = {
-    &dev_attr_RGBW_values.attr,
-    &dev_attr_red_value.attr,
-    &dev_attr_green_value.attr,
-    &dev_attr_blue_value.attr,
-    &dev_attr_white_value.attr,
-    &dev_attr_per_color_max_value.attr,
-    &dev_attr_RGBW_types.attr,
-    &dev_attr_pulse.attr,
-    &dev_attr_blink.attr,
-    &dev_attr_heartbeat.attr,
-    &dev_attr_rainbow.attr,
-    NULL,
-};
-ATTRIBUTE_GROUPS(rgbw);
-
 /**
- * rgbw_device_register - create and register a new object of
- *   rgbw_device class.
- * @name: the name of the new object(must be the same as the name of the
- *   respective framebuffer device).
- * @parent: a pointer to the parent device
- * @devdata: an optional pointer to be stored for private driver use. The
- *   methods may retrieve it by using rgbw_get_data(rgbw_dev).
- * @ops: the color operations structure.
+ * rgbw_update_output - run the output stage for one frame
+ * @rgbw_dev: the rgbw device
  *
- * Creates and registers new rgbw device. Returns either an
- * ERR_PTR() or a pointer to the newly allocated device.
+ * Drivers call this once at the start of every update, before reading
+ * the levels to drive with rgbw_get_output(). Returns right away while
+ * the stage is the identity.
  */
-struct rgbw_device *rgbw_device_register(const char *name,
-    struct device *parent, void *devdata, const struct rgbw_ops *ops,
-    struct rgbw_properties props[MAX_COLORS], struct rgbw_actions *acts)
+void rgbw_update_output(struct rgbw_device *rgbw_dev)
 {
-    
-    struct rgbw_device *new_rgbw_dev;
-    int rc;
-    int cntr;
-    
-    pr_debug("rgbw_device_register: name=%s\n", name);
-
-    new_rgbw_dev = kzalloc(sizeof(struct rgbw_device), GFP_KERNEL);
-    if (!new_rgbw_dev)
-        return ERR_PTR(-ENOMEM);
-
-    mutex_init(&new_rgbw_dev->update_lock);
-    mutex_init(&new_rgbw_dev->ops_lock);
-
-    new_rgbw_dev->dev.class = rgbw_class;
-    new_rgbw_dev->dev.parent = parent;
-    new_rgbw_dev->dev.release = rgbw_device_release;
-    dev_set_name(&new_rgbw_dev->dev, name);
-    dev_set_drvdata(&new_rgbw_dev->dev, devdata);
-
-    /* Set default properties */
-    if (props) {
-        memcpy(&new_rgbw_dev->props, props,
-               sizeof(struct rgbw_properties) * MAX_COLORS);
-        for (cntr = COLOR_RED; cntr < MAX_COLORS; cntr++) {
-            if (props[cntr].type <= 0 || props[cntr].type >= RGBW_TYPE_MAX) {
-                WARN(1, "%s: invalid rgbw type", name);
-            }
-        }  
-    } 
-
-    rc = device_register(&new_rgbw_dev->dev);
-    if (rc) {
-        kfree(new_rgbw_dev);
-        return ERR_PTR(rc);
-    }
+    unsigned long flags;
 
-    new_rgbw_dev->ops = ops;
-    new_rgbw_dev->acts = *acts;
+    if (!READ_ONCE(rgbw_dev->corr.active))
+        return;
 
-    return new_rgbw_dev;
+    spin_lock_irqsave(&rgbw_dev->corr.lock, flags);
+    __rgbw_update_output(rgbw_dev);
+    spin_unlock_irqrestore(&rgbw_dev->corr.lock, flags);
 }
-EXPORT_SYMBOL(rgbw_device_register);
+EXPORT_SYMBOL(rgbw_update_output);
 
 /**
- * rgbw_device_unregister - unregisters a rgbw device object.
- * @rgbw_dev: the rgbw device object to be unregistered and freed.
+ * rgbw_set_correction - set up the output stage of a device
+ * @rgbw_dev: the rgbw device
+ * @matrix: Q16 fixed point 4x4 color correction, NULL for the identity
+ * @white_extract: move min(R,G,B) into the white channel first
  *
- * Unregisters a previously registered via rgbw_device_register object.
+ * The output is recomputed before the new stage becomes active, so the
+ * driver never sees a half applied correction. The caller still has to
+ * run an update to drive it.
+ *
+ * Returns -EINVAL if a coefficient is above RGBW_MATRIX_MAX and
+ * -EOPNOTSUPP if white extraction, or a matrix mixing anything into or
+ * out of white, is asked of a device without a white channel.
  */
-void rgbw_device_unregister(struct rgbw_device *rgbw_dev)
+int rgbw_set_correction(struct rgbw_device *rgbw_dev,
+        const s32 matrix[MAX_COLORS][MAX_COLORS], bool white_extract)
 {
-    if (!rgbw_dev)
-        return;
+    struct rgbw_correction *corr = &rgbw_dev->corr;
+    enum rgbw_type wtype = rgbw_dev->props[COLOR_WHITE].type;
+    bool has_white = (wtype == RGBW_PWM || wtype == RGBW_GPIO);
+    unsigned long flags;
+    bool identity = true;
+    int i, j;
 
-    mutex_lock(&rgbw_dev->ops_lock);
-    rgbw_dev->ops = NULL;
-    mutex_unlock(&rgbw_dev->ops_lock);
+    if (white_extract && !has_white)
+        return -EOPNOTSUPP;
 
-    device_unregister(&rgbw_dev->dev);
+    for (i = COLOR_RED; i < MAX_COLORS && matrix; i++) {
+        for (j = COLOR_RED; j < MAX_COLORS; j++) {
+            if (abs(matrix[i][j]) > RGBW_MATRIX_MAX)
+                return -EINVAL;
+            if (matrix[i][j] == ((i == j) ? RGBW_MATRIX_ONE : 0))
+                continue;
+            if (!has_white && (i == COLOR_WHITE || j == COLOR_WHITE))
+                return -EOPNOTSUPP;
+            identity = false;
+        }
+    }
+
+    spin_lock_irqsave(&corr->lock, flags);
+    for (i = COLOR_RED; i < MAX_COLORS; i++) {
+        for (j = COLOR_RED; j < MAX_COLORS; j++) {
+            corr->matrix[i][j] = (matrix) ? matrix[i][j] : ((i == j) ? RGBW_MATRIX_ONE : 0);
+        }
+    }
+    corr->identity = identity;
+    corr->white_extract = white_extract;
+    __rgbw_update_output(rgbw_dev);
+    WRITE_ONCE(corr->active, rgbw_output_needed(rgbw_dev));
+    spin_unlock_irqrestore(&corr->lock, flags);
+
+    return 0;
 }
-EXPORT_SYMBOL(rgbw_device_unregister);
+EXPORT_SYMBOL(rgbw_set_correction);
 
-static int of_parent_match(struct device *dev, const void *data)
+/* Runs the output every frame while some layer moves */
+static void rgbw_compose_work(struct work_struct *work)
 {
-    return dev->parent && dev->parent->of_node == data;
+    struct rgbw_compositor *comp = container_of(to_delayed_work(work),
+                                                struct rgbw_compositor, work);
+    struct rgbw_device *rgbw_dev = container_of(comp, struct rgbw_device, comp);
+    int idx;
+
+    idx = rgbw_ops_read_lock(rgbw_dev);
+    /* resume restarts us, a suspended device has nothing to show */
+    if (rgbw_get_ops(rgbw_dev) && !(rgbw_dev->props[COLOR_RED].state & RGBW_CORE_SUSPENDED)) {
+        rgbw_update_status(rgbw_dev);
+        if (READ_ONCE(comp->animated))
+            schedule_delayed_work(&comp->work, msecs_to_jiffies(COMPOSE_FRAME_PER_MS));
+    }
+    rgbw_ops_read_unlock(rgbw_dev, idx);
 }
 
 /**
- * of_find_rgbw_by_node() - find rgbw device by device-tree node
- * @node: device-tree node of the rgbw device
+ * rgbw_set_layer - set up one layer of the effect compositor
+ * @rgbw_dev: the rgbw device
+ * @index: the layer, 0 is the bottom one
+ * @layer: the new layer, NULL or RGBW_LAYER_OFF to remove it
  *
- * Returns a pointer to the rgbw device corresponding to the given DT
- * node or NULL if no such rgbw device exists or if the device hasn't
- * been probed yet.
+ * Layers are blended over the requested levels by the output stage, so
+ * they run alongside color writes and the single effects. The waveform
+ * restarts from the time of the call and the first frame is driven
+ * right away.
  *
- * This function obtains a reference on the rgbw device and it is the
- * caller's responsibility to drop the reference by calling put_device() on
- * the rgbw device's .dev field.  
+ * Returns -EINVAL for an unknown effect or blend or a moving layer
+ * shorter than two frames.
  */
-struct rgbw_device *of_find_rgbw_by_node(struct device_node *node)
+int rgbw_set_layer(struct rgbw_device *rgbw_dev, unsigned int index,
+        const struct rgbw_layer *layer)
 {
-    struct device *dev;
+    struct rgbw_compositor *comp = &rgbw_dev->comp;
+    unsigned long flags;
+    bool active = false, animated = false;
+    unsigned int cntr;
 
-    dev = class_find_device(rgbw_class, NULL, node, of_parent_match);
+    if (index >= RGBW_LAYERS)
+        return -EINVAL;
+    if (layer && (layer->effect >= RGBW_LAYER_MAX || layer->blend >= RGBW_BLEND_INVALID ||
+                  (layer->mask & ~RGBW_CH_ALL)))
+        return -EINVAL;
+    if (layer && layer->effect > RGBW_LAYER_SOLID && layer->period < 2 * COMPOSE_FRAME_PER_MS)
+        return -EINVAL;
 
-    return dev ? to_rgbw_device(dev) : NULL;
-}
-EXPORT_SYMBOL(of_find_rgbw_by_node);
+    spin_lock_irqsave(&rgbw_dev->corr.lock, flags);
+    if (layer) {
+        comp->layers[index] = *layer;
+        comp->layers[index].start = jiffies;
+    }
+    else {
+        comp->layers[index].effect = RGBW_LAYER_OFF;
+    }
+    for (cntr = 0; cntr < RGBW_LAYERS; cntr++) {
+        if (comp->layers[cntr].effect == RGBW_LAYER_OFF)
+            continue;
+        active = true;
+        if (comp->layers[cntr].effect != RGBW_LAYER_SOLID)
+            animated = true;
+    }
+    comp->active = active;
+    WRITE_ONCE(comp->animated, animated);
+    __rgbw_update_output(rgbw_dev);
+    WRITE_ONCE(rgbw_dev->corr.active, rgbw_output_needed(rgbw_dev));
+    spin_unlock_irqrestore(&rgbw_dev->corr.lock, flags);
+
+    mod_delayed_work(system_wq, &comp->work, 0);
+
+    return 0;
+}
+EXPORT_SYMBOL(rgbw_set_layer);
+
+/**
+ * rgbw_set_power_limit - set up the power limiter of a device
+ * @rgbw_dev: the rgbw device
+ * @current_ua: draw of each color fully on in uA, 0 where unknown
+ * @budget_ua: budget of the device alone, 0 for none
+ * @group: supply group sharing a budget, 0 for none
+ *
+ * The limiter runs in the output stage after the color correction and
+ * scales all colors by the same factor when the device or its supply
+ * would go over budget. The caller still has to run an update.
+ *
+ * Returns -EINVAL for an unknown group or a current above
+ * RGBW_MAX_CURRENT_UA.
+ */
+int rgbw_set_power_limit(struct rgbw_device *rgbw_dev,
+        const unsigned int current_ua[MAX_COLORS], unsigned int budget_ua, unsigned int group)
+{
+    struct rgbw_power *pw = &rgbw_dev->power;
+    unsigned long flags;
+    unsigned int old_group;
+    bool draws = false;
+    int cntr;
+
+    if (group >= RGBW_SUPPLY_GROUPS)
+        return -EINVAL;
+    for (cntr = COLOR_RED; cntr < MAX_COLORS; cntr++) {
+        if (current_ua[cntr] > RGBW_MAX_CURRENT_UA)
+            return -EINVAL;
+        if (current_ua[cntr])
+            draws = true;
+    }
+
+    spin_lock_irqsave(&rgbw_dev->corr.lock, flags);
+    /* take our share out of the old group, the new one gets it back below */
+    old_group = pw->group;
+    if (old_group)
+        atomic_long_sub(pw->draw_ua, &rgbw_supply_draw[old_group]);
+    pw->draw_ua = 0;
+    pw->scale = RGBW_POWER_ONE;
+    for (cntr = COLOR_RED; cntr < MAX_COLORS; cntr++) {
+        pw->current_ua[cntr] = current_ua[cntr];
+    }
+    pw->budget_ua = budget_ua;
+    pw->group = group;
+    pw->enabled = draws && (budget_ua || group);
+    __rgbw_update_output(rgbw_dev);
+    WRITE_ONCE(rgbw_dev->corr.active, rgbw_output_needed(rgbw_dev));
+    spin_unlock_irqrestore(&rgbw_dev->corr.lock, flags);
+
+    if (old_group && old_group != group)
+        rgbw_kick_supply(old_group);
+
+    return 0;
+}
+EXPORT_SYMBOL(rgbw_set_power_limit);
+
+#if IS_REACHABLE(CONFIG_THERMAL)
+static int rgbw_cooling_get_max_state(struct thermal_cooling_device *cdev,
+        unsigned long *state)
+{
+    struct rgbw_device *rgbw_dev = cdev->devdata;
+
+    *state = rgbw_dev->thermal.nstates - 1;
+    return 0;
+}
+
+static int rgbw_cooling_get_cur_state(struct thermal_cooling_device *cdev,
+        unsigned long *state)
+{
+    struct rgbw_device *rgbw_dev = cdev->devdata;
+
+    *state = rgbw_dev->thermal.state;
+    return 0;
+}
+
+/* 
+ * Derate from the output stage, effects keep running underneath and
+ * come back to full output when the zone cools down.
+ */
+static int rgbw_cooling_set_cur_state(struct thermal_cooling_device *cdev,
+        unsigned long state)
+{
+    struct rgbw_device *rgbw_dev = cdev->devdata;
+    struct rgbw_thermal *thermal = &rgbw_dev->thermal;
+    unsigned long flags;
+
+    if (state >= thermal->nstates)
+        return -EINVAL;
+    if (state == thermal->state)
+        return 0;
+
+    spin_lock_irqsave(&rgbw_dev->corr.lock, flags);
+    thermal->state = state;
+    thermal->cur_scale = thermal->scale[state];
+    __rgbw_update_output(rgbw_dev);
+    WRITE_ONCE(rgbw_dev->corr.active, rgbw_output_needed(rgbw_dev));
+    spin_unlock_irqrestore(&rgbw_dev->corr.lock, flags);
+    rgbw_update_status(rgbw_dev);
+
+    return 0;
+}
+
+static const struct thermal_cooling_device_ops rgbw_cooling_ops = {
+    .get_max_state  = rgbw_cooling_get_max_state,
+    .get_cur_state  = rgbw_cooling_get_cur_state,
+    .set_cur_state  = rgbw_cooling_set_cur_state,
+};
+
+/**
+ * rgbw_register_cooling - make a device a thermal cooling device
+ * @rgbw_dev: the rgbw device
+ * @np: DT node thermal zones refer to in their cooling-maps
+ * @levels: output ceiling of each cooling state in percent, state 0 first
+ * @nlevels: number of states, 2 to RGBW_MAX_COOLING_STATES
+ *
+ * Each state caps the output at its percentage of what effects and
+ * userspace ask for, in the output stage alongside the power limiter.
+ * The cooling device goes away with the rgbw device.
+ *
+ * Returns -EINVAL for a bad table, -ENODEV when built without the
+ * thermal framework or the framework's error.
+ */
+int rgbw_register_cooling(struct rgbw_device *rgbw_dev, struct device_node *np,
+        const u32 *levels, unsigned int nlevels)
+{
+    struct rgbw_thermal *thermal = &rgbw_dev->thermal;
+    struct thermal_cooling_device *cdev;
+    unsigned int cntr;
+
+    if (nlevels < 2 || nlevels > RGBW_MAX_COOLING_STATES)
+        return -EINVAL;
+    for (cntr = 0; cntr < nlevels; cntr++) {
+        if (levels[cntr] > 100)
+            return -EINVAL;
+        thermal->scale[cntr] = DIV_ROUND_CLOSEST(levels[cntr] * RGBW_POWER_ONE, 100);
+    }
+    thermal->nstates = nlevels;
+
+    cdev = thermal_of_cooling_device_register(np, dev_name(&rgbw_dev->dev),
+                                              rgbw_dev, &rgbw_cooling_ops);
+    if (IS_ERR(cdev))
+        return PTR_ERR(cdev);
+    thermal->cdev = cdev;
+
+    return 0;
+}
+#else
+int rgbw_register_cooling(struct rgbw_device *rgbw_dev, struct device_node *np,
+        const u32 *levels, unsigned int nlevels)
+{
+    /* the DT asked for derating the kernel can not do, say so */
+    return -ENODEV;
+}
+#endif
+EXPORT_SYMBOL(rgbw_register_cooling);
+
+static ssize_t rgbw_show_matrix(struct device *dev,
+        struct device_attribute *attr, char *buf)
+{
+    struct rgbw_device *rgbw_dev = to_rgbw_device(dev);
+    s32 (*m)[MAX_COLORS] = rgbw_dev->corr.matrix;
+    ssize_t len = 0;
+    int i;
+
+    for (i = COLOR_RED; i < MAX_COLORS; i++) {
+        len += sprintf(buf + len, "%d %d %d %d\n", m[i][0], m[i][1], m[i][2], m[i][3]);
+    }
+    return len;
+}
+
+/* 16 Q16 coefficients, row by row: output color, then input color */
+static ssize_t rgbw_store_matrix(struct device *dev,
+        struct device_attribute *attr, const char *buf, size_t count)
+{
+    struct rgbw_device *rgbw_dev = to_rgbw_device(dev);
+    s32 m[MAX_COLORS][MAX_COLORS];
+    int rc;
+
+    if (sscanf(buf, "%d %d %d %d %d %d %d %d %d %d %d %d %d %d %d %d",
+               &m[0][0], &m[0][1], &m[0][2], &m[0][3], &m[1][0], &m[1][1], &m[1][2], &m[1][3],
+               &m[2][0], &m[2][1], &m[2][2], &m[2][3], &m[3][0], &m[3][1], &m[3][2], &m[3][3]) != 16)
+        return -EINVAL;
+
+    mutex_lock(&rgbw_dev->ops_lock);
+    rc = rgbw_set_correction(rgbw_dev, (const s32 (*)[MAX_COLORS])m, rgbw_dev->corr.white_extract);
+    if (!rc)
+        rgbw_update_status(rgbw_dev);
+    mutex_unlock(&rgbw_dev->ops_lock);
+
+    return rc ? rc : count;
+}
+
+static ssize_t rgbw_show_white_extract(struct device *dev,
+        struct device_attribute *attr, char *buf)
+{
+    struct rgbw_device *rgbw_dev = to_rgbw_device(dev);
+
+    return sprintf(buf, "%d\n", rgbw_dev->corr.white_extract);
+}
+
+static ssize_t rgbw_store_white_extract(struct device *dev,
+        struct device_attribute *attr, const char *buf, size_t count)
+{
+    struct rgbw_device *rgbw_dev = to_rgbw_device(dev);
+    unsigned long cmd;
+    int rc;
+
+    rc = kstrtoul(buf, 0, &cmd);
+    if (rc)
+        return rc;
+    if (cmd > 1)
+        return -EINVAL;
+
+    mutex_lock(&rgbw_dev->ops_lock);
+    rc = rgbw_set_correction(rgbw_dev, (const s32 (*)[MAX_COLORS])rgbw_dev->corr.matrix, cmd);
+    if (!rc)
+        rgbw_update_status(rgbw_dev);
+    mutex_unlock(&rgbw_dev->ops_lock);
+
+    return rc ? rc : count;
+}
+
+/* 
+ * "hsv" and "hsl" take "<hue> <sat> <val|light>", each 0..65535 with the
+ * hue going once round the wheel. Red, green and blue are set to full
+ * 16 bit precision, white is left alone.
+ */
+static ssize_t rgbw_store_hsx(struct device *dev,
+        struct device_attribute *attr, const char *buf, size_t count)
+{
+    struct rgbw_device *rgbw_dev = to_rgbw_device(dev);
+    unsigned int hue, sat, val;
+    u16 hsv_sat, hsv_val;
+    u16 rgb[3];
+    int cntr;
+    int rc;
+
+    if (sscanf(buf, "%u %u %u", &hue, &sat, &val) != 3)
+        return -EINVAL;
+    if (hue > 0xffff || sat > 0xffff || val > 0xffff)
+        return -EINVAL;
+
+    if (strcmp(attr->attr.name, "hsl") == 0) {
+        rgbw_hsl_to_hsv(sat, val, &hsv_sat, &hsv_val);
+    }
+    else {
+        hsv_sat = sat;
+        hsv_val = val;
+    }
+    rgbw_hsv_to_rgb(hue, hsv_sat, hsv_val, rgb);
+
+    mutex_lock(&rgbw_dev->ops_lock);
+    if (rgbw_dev->acts.state & RGBW_EFFECTS_MASK) {
+        mutex_unlock(&rgbw_dev->ops_lock);
+        return -EBUSY;
+    }
+    if (rgbw_get_ops(rgbw_dev)) {
+        for (cntr = COLOR_RED; cntr < COLOR_WHITE; cntr++) {
+            rgbw_set_fine(&rgbw_dev->props[cntr], rgbw_level16_to_fine(rgb[cntr],
+                          rgbw_dev->props[cntr].max_brightness));
+        }
+        rgbw_update_status(rgbw_dev);
+        rc = count;
+    }
+    else {
+        rc = -ENXIO;
+    }
+    mutex_unlock(&rgbw_dev->ops_lock);
+
+    rgbw_generate_event(rgbw_dev);
+
+    return rc;
+}
+
+static ssize_t rgbw_show_rainbow_config(struct device *dev,
+        struct device_attribute *attr, char *buf)
+{
+    struct rgbw_device *rgbw_dev = to_rgbw_device(dev);
+
+    return sprintf(buf, "%u %u %u\n", rgbw_dev->acts.rb_period,
+            rgbw_dev->acts.rb_sat, rgbw_dev->acts.rb_val);
+}
+
+/* "<period_ms> <sat> <val>", takes effect on the next rainbow frame */
+static ssize_t rgbw_store_rainbow_config(struct device *dev,
+        struct device_attribute *attr, const char *buf, size_t count)
+{
+    struct rgbw_device *rgbw_dev = to_rgbw_device(dev);
+    unsigned int period, sat, val;
+
+    if (sscanf(buf, "%u %u %u", &period, &sat, &val) != 3)
+        return -EINVAL;
+    if (period < RAINBOW_FRAME_PER_MS || sat > 0xffff || val > 0xffff)
+        return -EINVAL;
+
+    mutex_lock(&rgbw_dev->ops_lock);
+    rgbw_dev->acts.rb_period = period;
+    rgbw_dev->acts.rb_sat = sat;
+    rgbw_dev->acts.rb_val = val;
+    mutex_unlock(&rgbw_dev->ops_lock);
+
+    return count;
+}
+
+static const char *const rgbw_layer_effects[RGBW_LAYER_MAX] = {
+    [RGBW_LAYER_OFF]        = "off",
+    [RGBW_LAYER_SOLID]      = "solid",
+    [RGBW_LAYER_PULSE]      = "pulse",
+    [RGBW_LAYER_BLINK]      = "blink",
+    [RGBW_LAYER_HEARTBEAT]  = "heartbeat",
+    [RGBW_LAYER_RAINBOW]    = "rainbow",
+};
+
+static const char *const rgbw_blends[RGBW_BLEND_INVALID] = {
+    [RGBW_BLEND_REPLACE]    = "replace",
+    [RGBW_BLEND_ADD]        = "add",
+    [RGBW_BLEND_MULTIPLY]   = "multiply",
+    [RGBW_BLEND_MAX]        = "max",
+};
+
+/* channel letters of a layer mask, in [R,G,B,W] order */
+static const char rgbw_channels[MAX_COLORS] = { 'r', 'g', 'b', 'w' };
+
+static ssize_t rgbw_show_layers(struct device *dev,
+        struct device_attribute *attr, char *buf)
+{
+    struct rgbw_device *rgbw_dev = to_rgbw_device(dev);
+    struct rgbw_layer layers[RGBW_LAYERS];
+    char channels[MAX_COLORS + 1];
+    unsigned long flags;
+    ssize_t len = 0;
+    int idx, cntr, nch;
+
+    spin_lock_irqsave(&rgbw_dev->corr.lock, flags);
+    memcpy(layers, rgbw_dev->comp.layers, sizeof(layers));
+    spin_unlock_irqrestore(&rgbw_dev->corr.lock, flags);
+
+    for (idx = 0; idx < RGBW_LAYERS; idx++) {
+        if (layers[idx].effect == RGBW_LAYER_OFF)
+            continue;
+        for (cntr = COLOR_RED, nch = 0; cntr < MAX_COLORS; cntr++) {
+            if (layers[idx].mask & (1 << cntr))
+                channels[nch++] = rgbw_channels[cntr];
+        }
+        channels[nch] = '\0';
+        len += sprintf(buf + len, "%d %s %s %s %u %u %u %u %u\n", idx,
+                       rgbw_layer_effects[layers[idx].effect], rgbw_blends[layers[idx].blend],
+                       nch ? channels : "-", layers[idx].levels[COLOR_RED],
+                       layers[idx].levels[COLOR_GREEN], layers[idx].levels[COLOR_BLUE],
+                       layers[idx].levels[COLOR_WHITE], layers[idx].period);
+    }
+
+    return len;
+}
+
+/* 
+ * "<layer> <effect> <blend> <channels> <r> <g> <b> <w> [period_ms]" with
+ * channels as letters out of "rgbw" and the levels 0..65535, or
+ * "<layer> off". The period defaults to one second.
+ */
+static ssize_t rgbw_store_layers(struct device *dev,
+        struct device_attribute *attr, const char *buf, size_t count)
+{
+    struct rgbw_device *rgbw_dev = to_rgbw_device(dev);
+    struct rgbw_layer layer = { .period = 1000 };
+    char effect[16], blend[16], channels[8];
+    unsigned int idx, level[MAX_COLORS];
+    int cntr, n, rc;
+    char *ch;
+
+    n = sscanf(buf, "%u %15s %15s %7s %u %u %u %u %u", &idx, effect, blend, channels,
+               &level[COLOR_RED], &level[COLOR_GREEN], &level[COLOR_BLUE],
+               &level[COLOR_WHITE], &layer.period);
+    if (n < 2)
+        return -EINVAL;
+
+    if (strcmp(effect, "off") == 0) {
+        rc = rgbw_set_layer(rgbw_dev, idx, NULL);
+        return rc ? rc : count;
+    }
+    if (n < 8)
+        return -EINVAL;
+
+    for (layer.effect = RGBW_LAYER_SOLID; layer.effect < RGBW_LAYER_MAX; layer.effect++) {
+        if (strcmp(effect, rgbw_layer_effects[layer.effect]) == 0)
+            break;
+    }
+    for (layer.blend = RGBW_BLEND_REPLACE; layer.blend < RGBW_BLEND_INVALID; layer.blend++) {
+        if (strcmp(blend, rgbw_blends[layer.blend]) == 0)
+            break;
+    }
+    for (ch = channels; *ch; ch++) {
+        for (cntr = COLOR_RED; cntr < MAX_COLORS; cntr++) {
+            if (*ch == rgbw_channels[cntr])
+                break;
+        }
+        if (cntr == MAX_COLORS)
+            return -EINVAL;
+        layer.mask |= 1 << cntr;
+    }
+    for (cntr = COLOR_RED; cntr < MAX_COLORS; cntr++) {
+        if (level[cntr] > 0xffff)
+            return -EINVAL;
+        layer.levels[cntr] = level[cntr];
+    }
+
+    rc = rgbw_set_layer(rgbw_dev, idx, &layer);
+    return rc ? rc : count;
+}
+
+/* Master intensity of each dim group, group 0 is none and stays full */
+static unsigned int rgbw_group_dimmer[RGBW_DIM_GROUPS] = {
+    [0 ... RGBW_DIM_GROUPS - 1] = RGBW_DIM_FULL,
+};
+/* Serialises dimmer changes, taken before any ops_lock */
+static DEFINE_MUTEX(rgbw_dim_lock);
+
+/* Hand the device's effective dimmer to the driver, rgbw_dim_lock held */
+static int rgbw_apply_dimmer(struct rgbw_device *rgbw_dev)
+{
+    unsigned int level = DIV_ROUND_CLOSEST(rgbw_dev->dimmer *
+                            rgbw_group_dimmer[rgbw_dev->dim_group], RGBW_DIM_FULL);
+    const struct rgbw_ops *ops;
+    int rc;
+
+    mutex_lock(&rgbw_dev->ops_lock);
+    ops = rgbw_get_ops(rgbw_dev);
+    if (!ops) {
+        rc = -ENXIO;
+    }
+    else if (!ops->set_dimmer) {
+        rc = -EOPNOTSUPP;
+    }
+    else {
+        rc = ops->set_dimmer(rgbw_dev, level);
+        if (!rc) {
+            WRITE_ONCE(rgbw_dev->dim_level, level);
+            rgbw_update_status(rgbw_dev);
+        }
+    }
+    mutex_unlock(&rgbw_dev->ops_lock);
+
+    return rc;
+}
+
+static ssize_t rgbw_show_dimmer(struct device *dev,
+        struct device_attribute *attr, char *buf)
+{
+    struct rgbw_device *rgbw_dev = to_rgbw_device(dev);
+
+    if (strcmp(attr->attr.name, "dim_group") == 0)
+        return sprintf(buf, "%u\n", rgbw_dev->dim_group);
+    return sprintf(buf, "%u\n", rgbw_dev->dimmer);
+}
+
+/* 
+ * "dimmer" takes 0..65535 and "dim_group" 0..RGBW_DIM_GROUPS - 1. Both
+ * work while an effect runs, the dimmer scales whatever it drives.
+ */
+static ssize_t rgbw_store_dimmer(struct device *dev,
+        struct device_attribute *attr, const char *buf, size_t count)
+{
+    struct rgbw_device *rgbw_dev = to_rgbw_device(dev);
+    unsigned int *field = &rgbw_dev->dimmer;
+    unsigned int limit = RGBW_DIM_FULL;
+    unsigned int old;
+    unsigned long value;
+    int rc;
+
+    rc = kstrtoul(buf, 0, &value);
+    if (rc)
+        return rc;
+
+    if (strcmp(attr->attr.name, "dim_group") == 0) {
+        field = &rgbw_dev->dim_group;
+        limit = RGBW_DIM_GROUPS - 1;
+    }
+    if (value > limit)
+        return -EINVAL;
+
+    mutex_lock(&rgbw_dim_lock);
+    old = *field;
+    *field = value;
+    rc = rgbw_apply_dimmer(rgbw_dev);
+    if (rc)
+        *field = old;
+    mutex_unlock(&rgbw_dim_lock);
+
+    return rc ? rc : count;
+}
+
+static ssize_t rgbw_show_power(struct device *dev,
+        struct device_attribute *attr, char *buf)
+{
+    struct rgbw_device *rgbw_dev = to_rgbw_device(dev);
+    struct rgbw_power *pw = &rgbw_dev->power;
+
+    if (strcmp(attr->attr.name, "power_budget") == 0)
+        return sprintf(buf, "%u\n", pw->budget_ua);
+    if (strcmp(attr->attr.name, "supply_group") == 0)
+        return sprintf(buf, "%u\n", pw->group);
+    return sprintf(buf, "draw_ua %lu\nscale %u\nthermal_state %lu\nthermal_scale %u\n",
+                   READ_ONCE(pw->draw_ua), READ_ONCE(pw->scale),
+                   READ_ONCE(rgbw_dev->thermal.state), READ_ONCE(rgbw_dev->thermal.cur_scale));
+}
+
+/* "power_budget" takes uA, 0 for none, "supply_group" 0..RGBW_SUPPLY_GROUPS - 1 */
+static ssize_t rgbw_store_power(struct device *dev,
+        struct device_attribute *attr, const char *buf, size_t count)
+{
+    struct rgbw_device *rgbw_dev = to_rgbw_device(dev);
+    struct rgbw_power *pw = &rgbw_dev->power;
+    unsigned int budget = pw->budget_ua;
+    unsigned int group = pw->group;
+    unsigned int value;
+    int rc;
+
+    rc = kstrtouint(buf, 0, &value);
+    if (rc)
+        return rc;
+
+    if (strcmp(attr->attr.name, "supply_group") == 0)
+        group = value;
+    else
+        budget = value;
+
+    mutex_lock(&rgbw_dev->ops_lock);
+    rc = rgbw_set_power_limit(rgbw_dev, pw->current_ua, budget, group);
+    if (!rc)
+        rgbw_update_status(rgbw_dev);
+    mutex_unlock(&rgbw_dev->ops_lock);
+
+    return rc ? rc : count;
+}
+
+static ssize_t rgbw_show_period(struct device *dev,
+        struct device_attribute *attr, char *buf)
+{
+    struct rgbw_device *rgbw_dev = to_rgbw_device(dev);
+
+    return sprintf(buf, "Red = %u\nGreen = %u\nBlue = %u\nWhite = %u\n",
+            rgbw_dev->props[COLOR_RED].period,
+            rgbw_dev->props[COLOR_GREEN].period,
+            rgbw_dev->props[COLOR_BLUE].period,
+            rgbw_dev->props[COLOR_WHITE].period);
+}
+
+/* 
+ * "<ns>" sets every color, "hard <ns>" or "soft <ns>" every color of
+ * that type and "<color> <ns>" a single one. All of them take the new
+ * period or, when one of them can not, none does.
+ */
+static ssize_t rgbw_store_period(struct device *dev,
+        struct device_attribute *attr, const char *buf, size_t count)
+{
+    struct rgbw_device *rgbw_dev = to_rgbw_device(dev);
+    const struct rgbw_ops *ops;
+    char which[8];
+    unsigned int period;
+    unsigned int old[MAX_COLORS];
+    unsigned int mask = 0;
+    unsigned int done = 0;
+    int cntr;
+    int rc;
+
+    if (sscanf(buf, "%7s %u", which, &period) == 2) {
+        for (cntr = COLOR_RED; cntr < MAX_COLORS; cntr++) {
+            if ((strcmp(which, color_names[cntr]) == 0) ||
+                (strcmp(which, "hard") == 0 && rgbw_dev->props[cntr].type == RGBW_PWM) ||
+                (strcmp(which, "soft") == 0 && rgbw_dev->props[cntr].type == RGBW_GPIO))
+                mask |= 1 << cntr;
+        }
+    }
+    else if (sscanf(buf, "%u", &period) == 1) {
+        for (cntr = COLOR_RED; cntr < MAX_COLORS; cntr++) {
+            if (rgbw_dev->props[cntr].type == RGBW_PWM || rgbw_dev->props[cntr].type == RGBW_GPIO)
+                mask |= 1 << cntr;
+        }
+    }
+    if (!mask)
+        return -EINVAL;
+
+    mutex_lock(&rgbw_dev->ops_lock);
+    ops = rgbw_get_ops(rgbw_dev);
+    if (!ops) {
+        rc = -ENXIO;
+    }
+    else if (!ops->set_period) {
+        rc = -EOPNOTSUPP;
+    }
+    else {
+        rc = 0;
+        for (cntr = COLOR_RED; cntr < MAX_COLORS && !rc && ops->check_period; cntr++) {
+            if (mask & (1 << cntr))
+                rc = ops->check_period(rgbw_dev, cntr, period);
+        }
+        for (cntr = COLOR_RED; cntr < MAX_COLORS && !rc; cntr++) {
+            if (!(mask & (1 << cntr)))
+                continue;
+            rc = ops->set_period(rgbw_dev, cntr, period);
+            if (!rc) {
+                old[cntr] = rgbw_dev->props[cntr].period;
+                rgbw_dev->props[cntr].period = period;
+                done |= 1 << cntr;
+            }
+        }
+        /* without check_period a later color can still refuse, undo the others */
+        for (cntr = COLOR_RED; cntr < MAX_COLORS && rc; cntr++) {
+            if (!(done & (1 << cntr)) || !old[cntr])
+                continue;
+            if (!ops->set_period(rgbw_dev, cntr, old[cntr]))
+                rgbw_dev->props[cntr].period = old[cntr];
+        }
+        if (done)
+            rgbw_update_status(rgbw_dev);
+    }
+    mutex_unlock(&rgbw_dev->ops_lock);
+
+    return rc ? rc : count;
+}
+
+static ssize_t rgbw_show_stats(struct device *dev,
+        struct device_attribute *attr, char *buf)
+{
+    struct rgbw_device *rgbw_dev = to_rgbw_device(dev);
+
+    return sprintf(buf, "updates %lu\nhw_writes %lu\nseq %u\n",
+            (unsigned long)atomic_long_read(&rgbw_dev->stats.updates),
+            (unsigned long)atomic_long_read(&rgbw_dev->stats.hw_writes),
+            (u32)atomic_read(&rgbw_dev->seq));
+}
+
+/**
+ * __rgbw_latency_stamp - stamp an update request on every color
+ * @rgbw_dev: the rgbw device
+ *
+ * Colors still waiting for an earlier request keep the older stamp so
+ * the histogram shows how long the oldest write waited for the light.
+ */
+void __rgbw_latency_stamp(struct rgbw_device *rgbw_dev)
+{
+    struct rgbw_latency *lat = &rgbw_dev->lat;
+    u64 now = ktime_get_ns();
+    unsigned long flags;
+    int cntr;
+
+    spin_lock_irqsave(&lat->lock, flags);
+    for (cntr = COLOR_RED; cntr < MAX_COLORS; cntr++) {
+        if (!lat->stamp[cntr])
+            lat->stamp[cntr] = now;
+    }
+    spin_unlock_irqrestore(&lat->lock, flags);
+}
+EXPORT_SYMBOL(__rgbw_latency_stamp);
+
+/**
+ * __rgbw_latency_record - account a pending request as applied
+ * @rgbw_dev: the rgbw device
+ * @color: the color whose new level just reached the hardware
+ *
+ * Safe from hard irq context.
+ */
+void __rgbw_latency_record(struct rgbw_device *rgbw_dev, int color)
+{
+    struct rgbw_latency *lat = &rgbw_dev->lat;
+    u64 now = ktime_get_ns();
+    unsigned long flags;
+    u64 delta;
+    int bucket;
+
+    spin_lock_irqsave(&lat->lock, flags);
+    if (lat->stamp[color]) {
+        delta = now - lat->stamp[color];
+        lat->stamp[color] = 0;
+        /* bucket 0 is < 1us, bucket n is [2^(n-1), 2^n) us */
+        bucket = min_t(int, fls64(div_u64(delta, NSEC_PER_USEC)), RGBW_LAT_BUCKETS - 1);
+        lat->buckets[bucket]++;
+        lat->samples++;
+        if (delta > lat->max_ns)
+            lat->max_ns = delta;
+    }
+    spin_unlock_irqrestore(&lat->lock, flags);
+}
+EXPORT_SYMBOL(__rgbw_latency_record);
+
+static ssize_t rgbw_show_latency(struct device *dev,
+        struct device_attribute *attr, char *buf)
+{
+    struct rgbw_device *rgbw_dev = to_rgbw_device(dev);
+    struct rgbw_latency *lat = &rgbw_dev->lat;
+    unsigned long buckets[RGBW_LAT_BUCKETS];
+    unsigned long samples, flags;
+    u64 max_ns;
+    ssize_t len;
+    int cntr;
+
+    spin_lock_irqsave(&lat->lock, flags);
+    memcpy(buckets, lat->buckets, sizeof(buckets));
+    samples = lat->samples;
+    max_ns = lat->max_ns;
+    spin_unlock_irqrestore(&lat->lock, flags);
+
+    len = sprintf(buf, "enabled %d\nsamples %lu\nmax_us %llu\n", lat->enabled, samples,
+                  (unsigned long long)div_u64(max_ns, NSEC_PER_USEC));
+    for (cntr = 0; cntr < RGBW_LAT_BUCKETS - 1; cntr++)
+        len += sprintf(buf + len, "<%u %lu\n", 1U << cntr, buckets[cntr]);
+    len += sprintf(buf + len, ">=%u %lu\n", 1U << (RGBW_LAT_BUCKETS - 2), buckets[cntr]);
+
+    return len;
+}
+
+/* "1" clears the histogram and starts measuring, "0" stops */
+static ssize_t rgbw_store_latency(struct device *dev,
+        struct device_attribute *attr, const char *buf, size_t count)
+{
+    struct rgbw_device *rgbw_dev = to_rgbw_device(dev);
+    struct rgbw_latency *lat = &rgbw_dev->lat;
+    unsigned long flags;
+    unsigned long cmd;
+    int rc;
+
+    rc = kstrtoul(buf, 0, &cmd);
+    if (rc)
+        return rc;
+    if (cmd > 1)
+        return -EINVAL;
+
+    spin_lock_irqsave(&lat->lock, flags);
+    if (cmd) {
+        memset(lat->stamp, 0, sizeof(lat->stamp));
+        memset(lat->buckets, 0, sizeof(lat->buckets));
+        lat->samples = 0;
+        lat->max_ns = 0;
+    }
+    WRITE_ONCE(lat->enabled, cmd);
+    spin_unlock_irqrestore(&lat->lock, flags);
+
+    return count;
+}
+
+static void rgbw_fill_state(struct rgbw_device *rgbw_dev, struct rgbw_state *state)
+{
+    int cntr;
+
+    memset(state, 0, sizeof(*state));
+    state->version = RGBW_STATE_VERSION;
+    state->seq = atomic_read(&rgbw_dev->seq);
+    for (cntr = COLOR_RED; cntr < MAX_COLORS; cntr++) {
+        state->levels[cntr] = rgbw_dev->props[cntr].brightness;
+        state->max_levels[cntr] = rgbw_dev->props[cntr].max_brightness;
+        if (rgbw_dev->props[cntr].type == RGBW_PWM || rgbw_dev->props[cntr].type == RGBW_GPIO)
+            state->types[cntr] = rgbw_dev->props[cntr].type;
+    }
+    state->effect = rgbw_dev->acts.state & RGBW_EFFECTS_MASK;
+    state->pcolor = rgbw_dev->acts.pcolor;
+    if ((state->effect & RGBW_PULSE_ON) && rgbw_dev->acts.pcolor < MAX_COLORS)
+        state->phase = rgbw_dev->props[rgbw_dev->acts.pcolor].cntr;
+    else
+        state->phase = rgbw_dev->acts.bstate;
+}
+
+/* 
+ * Binary snapshot of the whole device in the fixed struct rgbw_state
+ * layout so monitoring tools can sample it with one pread() and no
+ * text parsing.
+ */
+static ssize_t rgbw_read_state(struct file *filp, struct kobject *kobj,
+        struct bin_attribute *attr, char *buf, loff_t off, size_t count)
+{
+    struct rgbw_device *rgbw_dev = to_rgbw_device(kobj_to_dev(kobj));
+    struct rgbw_state state;
+
+    if (off >= sizeof(state))
+        return 0;
+    if (count > sizeof(state) - off)
+        count = sizeof(state) - off;
+
+    rgbw_fill_state(rgbw_dev, &state);
+    memcpy(buf, (char *)&state + off, count);
+    return count;
+}
+
+static dev_t rgbw_devt;
+static DEFINE_IDA(rgbw_ida);
+
+/* 
+ * Steps a RGBW_IOC_SET fade. The first run happens at the requested
+ * apply time and latches the starting levels; after that it reschedules
+ * itself every TRANSITION_STEP_PER_MS until the target is reached.
+ */
+static void rgbw_transition_work(struct work_struct *work)
+{
+    struct rgbw_transition *trans = container_of(to_delayed_work(work),
+                                                 struct rgbw_transition, work);
+    struct rgbw_device *rgbw_dev = container_of(trans, struct rgbw_device, trans);
+    unsigned long elapsed;
+    bool done;
+    int cntr;
+
+    mutex_lock(&rgbw_dev->ops_lock);
+    if (!rgbw_get_ops(rgbw_dev) || !trans->mask) {
+        mutex_unlock(&rgbw_dev->ops_lock);
+        return;
+    }
+
+    if (!trans->started) {
+        for (cntr = COLOR_RED; cntr < MAX_COLORS; cntr++) {
+            trans->from[cntr] = rgbw_get_fine(&rgbw_dev->props[cntr]);
+        }
+        trans->start = jiffies;
+        trans->started = true;
+    }
+
+    elapsed = jiffies - trans->start;
+    done = elapsed >= trans->duration;
+
+    for (cntr = COLOR_RED; cntr < MAX_COLORS; cntr++) {
+        if (!(trans->mask & (1 << cntr)))
+            continue;
+        if (done)
+            rgbw_set_fine(&rgbw_dev->props[cntr], trans->to[cntr]);
+        else
+            rgbw_set_fine(&rgbw_dev->props[cntr], trans->from[cntr] +
+                div_s64(((s64)trans->to[cntr] - trans->from[cntr]) * elapsed, trans->duration));
+    }
+    rgbw_update_status(rgbw_dev);
+
+    if (done)
+        trans->mask = 0;
+    else
+        schedule_delayed_work(&trans->work, msecs_to_jiffies(TRANSITION_STEP_PER_MS));
+    mutex_unlock(&rgbw_dev->ops_lock);
+
+    if (done)
+        rgbw_generate_event(rgbw_dev);
+    else
+        rgbw_notify_state(rgbw_dev);
+}
+
+static long rgbw_ioctl_set(struct rgbw_device *rgbw_dev, void __user *argp)
+{
+    struct rgbw_transition *trans = &rgbw_dev->trans;
+    struct rgbw_set set;
+    u32 level[MAX_COLORS];
+    unsigned long delay = 0;
+    bool applied = false;
+    u64 now;
+    int cntr, idx;
+    long rc = 0;
+
+    if (copy_from_user(&set, argp, sizeof(set)))
+        return -EFAULT;
+
+    if (!set.mask || (set.mask & ~RGBW_CH_ALL) || (set.flags & ~RGBW_SET_RAW) || set.reserved)
+        return -EINVAL;
+
+    if (rgbw_dev->acts.state & RGBW_EFFECTS_MASK)
+        return -EBUSY;
+
+    for (cntr = COLOR_RED; cntr < MAX_COLORS; cntr++) {
+        if (!(set.mask & (1 << cntr)))
+            continue;
+        if (set.flags & RGBW_SET_RAW) {
+            if (set.levels[cntr] > rgbw_dev->props[cntr].max_brightness)
+                return -EINVAL;
+            level[cntr] = (u32)set.levels[cntr] << 16;
+        }
+        else {
+            /* keep the full 16 bit request, the driver dithers the fraction */
+            level[cntr] = rgbw_level16_to_fine(set.levels[cntr],
+                            rgbw_dev->props[cntr].max_brightness);
+        }
+    }
+
+    if (set.apply_at_ns) {
+        now = ktime_get_ns();
+        if (set.apply_at_ns > now)
+            delay = usecs_to_jiffies(div_u64(set.apply_at_ns - now, NSEC_PER_USEC));
+    }
+
+    /* a new request always replaces whatever is still pending */
+    cancel_delayed_work_sync(&trans->work);
+
+    if (!delay && !set.transition_ms) {
+        /* 
+         * The common case, applied right here with no work item and no
+         * lock; the cancelled fade can not run again so its mask is moot.
+         */
+        idx = rgbw_ops_read_lock(rgbw_dev);
+        if (rgbw_get_ops(rgbw_dev)) {
+            for (cntr = COLOR_RED; cntr < MAX_COLORS; cntr++) {
+                if (set.mask & (1 << cntr))
+                    rgbw_set_fine(&rgbw_dev->props[cntr], level[cntr]);
+            }
+            rgbw_update_status(rgbw_dev);
+            applied = true;
+        }
+        else {
+            rc = -ENXIO;
+        }
+        rgbw_ops_read_unlock(rgbw_dev, idx);
+    }
+    else {
+        mutex_lock(&rgbw_dev->ops_lock);
+        if (!rgbw_get_ops(rgbw_dev)) {
+            rc = -ENXIO;
+        }
+        else {
+            for (cntr = COLOR_RED; cntr < MAX_COLORS; cntr++) {
+                trans->to[cntr] = (set.mask & (1 << cntr)) ? level[cntr] : 0;
+            }
+            trans->mask = set.mask;
+            trans->started = false;
+            trans->duration = msecs_to_jiffies(set.transition_ms);
+            schedule_delayed_work(&trans->work, delay);
+        }
+        mutex_unlock(&rgbw_dev->ops_lock);
+    }
+
+    if (applied)
+        rgbw_generate_event(rgbw_dev);
+
+    return rc;
+}
+
+static long rgbw_ioctl(struct file *filp, unsigned int cmd, unsigned long arg)
+{
+    struct rgbw_device *rgbw_dev = filp->private_data;
+    struct rgbw_state state;
+
+    switch (cmd) {
+        case RGBW_IOC_SET:
+            return rgbw_ioctl_set(rgbw_dev, (void __user *)arg);
+        case RGBW_IOC_GET_STATE:
+            rgbw_fill_state(rgbw_dev, &state);
+            if (copy_to_user((void __user *)arg, &state, sizeof(state)))
+                return -EFAULT;
+            return 0;
+        default:
+            return -ENOTTY;
+    }
+}
+
+#ifdef CONFIG_COMPAT
+/* The rgbw_set and rgbw_state layouts match, only the pointer needs converting */
+static long rgbw_compat_ioctl(struct file *filp, unsigned int cmd, unsigned long arg)
+{
+    return rgbw_ioctl(filp, cmd, (unsigned long)compat_ptr(arg));
+}
+#endif
+
+static int rgbw_open(struct inode *inode, struct file *filp)
+{
+    struct rgbw_device *rgbw_dev = container_of(inode->i_cdev, struct rgbw_device, cdev);
+
+    get_device(&rgbw_dev->dev);
+    filp->private_data = rgbw_dev;
+    return nonseekable_open(inode, filp);
+}
+
+static int rgbw_release(struct inode *inode, struct file *filp)
+{
+    struct rgbw_device *rgbw_dev = filp->private_data;
+
+    put_device(&rgbw_dev->dev);
+    return 0;
+}
+
+static const struct file_operations rgbw_fops = {
+    .owner          = THIS_MODULE,
+    .open           = rgbw_open,
+    .release        = rgbw_release,
+    .unlocked_ioctl = rgbw_ioctl,
+#ifdef CONFIG_COMPAT
+    .compat_ioctl   = rgbw_compat_ioctl,
+#endif
+};
+
+static struct class *rgbw_class;
+
+static int rgbw_apply_group_dimmer(struct device *dev, void *data)
+{
+    struct rgbw_device *rgbw_dev = to_rgbw_device(dev);
+
+    if (rgbw_dev->dim_group == *(unsigned int *)data)
+        rgbw_apply_dimmer(rgbw_dev);
+    return 0;
+}
+
+static ssize_t rgbw_show_group_dimmer(const struct class *class,
+        const struct class_attribute *attr, char *buf)
+{
+    ssize_t len = 0;
+    int cntr;
+
+    mutex_lock(&rgbw_dim_lock);
+    for (cntr = 1; cntr < RGBW_DIM_GROUPS; cntr++) {
+        len += sprintf(buf + len, "%d %u\n", cntr, rgbw_group_dimmer[cntr]);
+    }
+    mutex_unlock(&rgbw_dim_lock);
+
+    return len;
+}
+
+/* "<group> <level>", every device in the group is rescaled */
+static ssize_t rgbw_store_group_dimmer(const struct class *class,
+        const struct class_attribute *attr, const char *buf, size_t count)
+{
+    unsigned int group, level;
+
+    if (sscanf(buf, "%u %u", &group, &level) != 2)
+        return -EINVAL;
+    if (!group || group >= RGBW_DIM_GROUPS || level > RGBW_DIM_FULL)
+        return -EINVAL;
+
+    mutex_lock(&rgbw_dim_lock);
+    rgbw_group_dimmer[group] = level;
+    class_for_each_device(rgbw_class, NULL, &group, rgbw_apply_group_dimmer);
+    mutex_unlock(&rgbw_dim_lock);
+
+    return count;
+}
+
+static struct class_attribute class_attr_group_dimmer =
+    __ATTR(group_dimmer, 00644, rgbw_show_group_dimmer, rgbw_store_group_dimmer);
+
+static int rgbw_update_supply(struct device *dev, void *data)
+{
+    struct rgbw_device *rgbw_dev = to_rgbw_device(dev);
+
+    if (rgbw_dev->power.group == *(unsigned int *)data)
+        rgbw_update_status(rgbw_dev);
+    return 0;
+}
+
+/* Re-run every device of the groups whose scale moved */
+static void rgbw_supply_work_fn(struct work_struct *work)
+{
+    unsigned int group;
+
+    for (group = 1; group < RGBW_SUPPLY_GROUPS; group++) {
+        if (test_and_clear_bit(group, &rgbw_supply_kick))
+            class_for_each_device(rgbw_class, NULL, &group, rgbw_update_supply);
+    }
+}
+
+static ssize_t rgbw_show_supply_budget(const struct class *class,
+        const struct class_attribute *attr, char *buf)
+{
+    ssize_t len = 0;
+    int cntr;
+
+    for (cntr = 1; cntr < RGBW_SUPPLY_GROUPS; cntr++) {
+        len += sprintf(buf + len, "%d %u %ld\n", cntr, READ_ONCE(rgbw_supply_budget[cntr]),
+                       atomic_long_read(&rgbw_supply_draw[cntr]));
+    }
+    return len;
+}
+
+/* "<group> <uA>", 0 uA for no budget */
+static ssize_t rgbw_store_supply_budget(const struct class *class,
+        const struct class_attribute *attr, const char *buf, size_t count)
+{
+    unsigned int group, budget;
+
+    if (sscanf(buf, "%u %u", &group, &budget) != 2)
+        return -EINVAL;
+    if (!group || group >= RGBW_SUPPLY_GROUPS)
+        return -EINVAL;
+
+    WRITE_ONCE(rgbw_supply_budget[group], budget);
+    rgbw_kick_supply(group);
+
+    return count;
+}
+
+static struct class_attribute class_attr_supply_budget =
+    __ATTR(supply_budget, 00644, rgbw_show_supply_budget, rgbw_store_supply_budget);
+
+/* Effect flag that owns each of the rgbw_timer[] entries */
+static const unsigned int rgbw_timer_flags[MAX_RGBWTIMER] = {
+    [TIMER_PULSE]     = RGBW_PULSE_ON,
+    [TIMER_BLINK]     = RGBW_BLINK_ON,
+    [TIMER_HEARTBEAT] = RGBW_HB_ON,
+    [TIMER_RAINBOW]   = RGBW_RB_ON,
+};
+
+static const char *const rgbw_scene_effects[] = {
+    "none", "pulse", "blink", "heartbeat", "rainbow",
+};
+
+/* Capture what the device shows now into slot, ops_lock held */
+static void rgbw_save_scene(struct rgbw_device *rgbw_dev, unsigned int slot,
+                unsigned int transition_ms)
+{
+    struct rgbw_scene *scene = &rgbw_dev->scenes[slot];
+    int cntr;
+
+    scene->effect = rgbw_dev->acts.state & RGBW_EFFECTS_MASK;
+    for (cntr = COLOR_RED; cntr < MAX_COLORS; cntr++) {
+        /* an effect keeps the levels it was started from in rgbw_values */
+        if (scene->effect)
+            scene->levels[cntr] = rgbw_dev->acts.rgbw_values[cntr] << 16;
+        else
+            scene->levels[cntr] = rgbw_get_fine(&rgbw_dev->props[cntr]);
+    }
+    scene->pcolor = rgbw_dev->acts.pcolor;
+    scene->rb_period = rgbw_dev->acts.rb_period;
+    scene->rb_sat = rgbw_dev->acts.rb_sat;
+    scene->rb_val = rgbw_dev->acts.rb_val;
+    scene->transition_ms = transition_ms;
+    scene->valid = true;
+}
+
+/* 
+ * Switch the device to a stored scene in one go. The running effect is
+ * parked and its timer killed the way suspend does it, so there is no
+ * wait for its last tick, then the scene's effect is started from its
+ * levels or the levels are faded to over the scene's transition time.
+ */
+static int rgbw_recall_scene(struct rgbw_device *rgbw_dev, unsigned int slot)
+{
+    struct rgbw_scene *scene = &rgbw_dev->scenes[slot];
+    struct rgbw_transition *trans = &rgbw_dev->trans;
+    unsigned int running;
+    int cntr;
+    int rc = 0;
+
+    /* a pending RGBW_IOC_SET fade loses to the scene */
+    cancel_delayed_work_sync(&trans->work);
+
+    mutex_lock(&rgbw_dev->ops_lock);
+    if (!rgbw_get_ops(rgbw_dev)) {
+        rc = -ENXIO;
+        goto out;
+    }
+    if (!scene->valid) {
+        rc = -ENOENT;
+        goto out;
+    }
+    if (rgbw_dev->props[COLOR_RED].state & RGBW_CORE_SUSPENDED) {
+        rc = -EBUSY;
+        goto out;
+    }
+
+    running = rgbw_dev->acts.state & RGBW_EFFECTS_MASK;
+    rgbw_dev->acts.state &= ~RGBW_EFFECTS_MASK;
+    for (cntr = TIMER_PULSE; cntr < MAX_RGBWTIMER; cntr++) {
+        if (running & rgbw_timer_flags[cntr])
+            del_timer_sync(&rgbw_dev->rgbw_timer[cntr]);
+    }
+    rgbw_dev->acts.pcolor = INVALID_COLOR;
+    rgbw_dev->acts.bstate = INVALID_COLOR;
+    trans->mask = 0;
+
+    for (cntr = COLOR_RED; cntr < MAX_COLORS; cntr++) {
+        rgbw_dev->props[cntr].cntr = 0;
+        rgbw_dev->acts.rgbw_values[cntr] = scene->levels[cntr] >> 16;
+    }
+
+    if (scene->effect) {
+        rgbw_dev->acts.rb_period = scene->rb_period;
+        rgbw_dev->acts.rb_sat = scene->rb_sat;
+        rgbw_dev->acts.rb_val = scene->rb_val;
+        for (cntr = COLOR_RED; cntr < MAX_COLORS; cntr++) {
+            if (scene->effect == RGBW_PULSE_ON)
+                rgbw_dev->props[cntr].brightness = 0;
+            else
+                rgbw_set_fine(&rgbw_dev->props[cntr], scene->levels[cntr]);
+        }
+        if (scene->effect == RGBW_PULSE_ON)
+            rgbw_dev->acts.pcolor = scene->pcolor;
+        else if (scene->effect != RGBW_RB_ON)
+            rgbw_dev->acts.bstate = 0;
+        rgbw_update_status(rgbw_dev);
+
+        rgbw_dev->acts.state |= scene->effect;
+        for (cntr = TIMER_PULSE; cntr < MAX_RGBWTIMER; cntr++) {
+            if (scene->effect & rgbw_timer_flags[cntr])
+                mod_timer(&rgbw_dev->rgbw_timer[cntr], jiffies + 1);
+        }
+    }
+    else if (!scene->transition_ms) {
+        for (cntr = COLOR_RED; cntr < MAX_COLORS; cntr++) {
+            rgbw_set_fine(&rgbw_dev->props[cntr], scene->levels[cntr]);
+        }
+        rgbw_update_status(rgbw_dev);
+    }
+    else {
+        /* the fade latches whatever the stopped effect left showing */
+        memcpy(trans->to, scene->levels, sizeof(trans->to));
+        trans->mask = RGBW_CH_ALL;
+        trans->started = false;
+        trans->duration = msecs_to_jiffies(scene->transition_ms);
+        schedule_delayed_work(&trans->work, 0);
+    }
+    rgbw_dev->scene = slot;
+
+out:
+    mutex_unlock(&rgbw_dev->ops_lock);
+
+    if (!rc)
+        rgbw_generate_event(rgbw_dev);
+
+    return rc;
+}
+
+static ssize_t rgbw_show_scene(struct device *dev,
+        struct device_attribute *attr, char *buf)
+{
+    struct rgbw_device *rgbw_dev = to_rgbw_device(dev);
+    struct rgbw_scene *scene;
+    ssize_t len = 0;
+    int slot;
+
+    mutex_lock(&rgbw_dev->ops_lock);
+    for (slot = 0; slot < RGBW_SCENES; slot++) {
+        scene = &rgbw_dev->scenes[slot];
+        if (!scene->valid)
+            continue;
+        len += sprintf(buf + len, "%c%d %u %u %u %u %s %u\n",
+                       (slot == rgbw_dev->scene) ? '*' : ' ', slot,
+                       scene->levels[COLOR_RED] >> 16, scene->levels[COLOR_GREEN] >> 16,
+                       scene->levels[COLOR_BLUE] >> 16, scene->levels[COLOR_WHITE] >> 16,
+                       rgbw_scene_effects[scene->effect ? __ffs(scene->effect) + 1 : 0],
+                       scene->transition_ms);
+    }
+    mutex_unlock(&rgbw_dev->ops_lock);
+
+    return len;
+}
+
+/* 
+ * "<slot>" recalls a scene, "store <slot> [transition_ms]" saves the
+ * current levels and effect into one and "clear <slot>" empties it.
+ */
+static ssize_t rgbw_store_scene(struct device *dev,
+        struct device_attribute *attr, const char *buf, size_t count)
+{
+    struct rgbw_device *rgbw_dev = to_rgbw_device(dev);
+    unsigned int slot, transition_ms = 0;
+    int rc;
+
+    if (sscanf(buf, "store %u %u", &slot, &transition_ms) >= 1 ||
+        sscanf(buf, "clear %u", &slot) == 1) {
+        if (slot >= RGBW_SCENES)
+            return -EINVAL;
+
+        mutex_lock(&rgbw_dev->ops_lock);
+        if (buf[0] == 's') {
+            rgbw_save_scene(rgbw_dev, slot, transition_ms);
+        }
+        else {
+            rgbw_dev->scenes[slot].valid = false;
+            if (rgbw_dev->scene == slot)
+                rgbw_dev->scene = -1;
+        }
+        mutex_unlock(&rgbw_dev->ops_lock);
+        return count;
+    }
+
+    if (kstrtouint(buf, 0, &slot))
+        return -EINVAL;
+    if (slot >= RGBW_SCENES)
+        return -EINVAL;
+
+    rc = rgbw_recall_scene(rgbw_dev, slot);
+    return rc ? rc : count;
+}
+
+static int rgbw_recall_group_scene(struct device *dev, void *data)
+{
+    struct rgbw_device *rgbw_dev = to_rgbw_device(dev);
+    const unsigned int *arg = data;
+
+    /* members without the slot keep what they show */
+    if (rgbw_dev->dim_group == arg[0])
+        rgbw_recall_scene(rgbw_dev, arg[1]);
+    return 0;
+}
+
+/* "<group> <slot>", every device of the dim group recalls its own slot */
+static ssize_t rgbw_store_group_scene(const struct class *class,
+        const struct class_attribute *attr, const char *buf, size_t count)
+{
+    unsigned int arg[2];
+
+    if (sscanf(buf, "%u %u", &arg[0], &arg[1]) != 2)
+        return -EINVAL;
+    if (!arg[0] || arg[0] >= RGBW_DIM_GROUPS || arg[1] >= RGBW_SCENES)
+        return -EINVAL;
+
+    class_for_each_device(rgbw_class, NULL, arg, rgbw_recall_group_scene);
+
+    return count;
+}
+
+static struct class_attribute class_attr_group_scene =
+    __ATTR(group_scene, 00200, NULL, rgbw_store_group_scene);
+
+#ifdef CONFIG_NET
+enum {
+    RGBW_GENL_GRP_STATE,
+};
+
+static const struct nla_policy rgbw_genl_policy[RGBW_ATTR_MAX + 1] = {
+    [RGBW_ATTR_DEVICE]  = { .type = NLA_U32 },
+};
+
+static int rgbw_genl_get(struct sk_buff *skb, struct genl_info *info);
+
+static const struct genl_ops rgbw_genl_ops[] = {
+    {
+        .cmd     = RGBW_CMD_GET,
+        .policy  = rgbw_genl_policy,
+        .maxattr = RGBW_ATTR_MAX,
+        .doit    = rgbw_genl_get,
+    },
+};
+
+static const struct genl_multicast_group rgbw_genl_mcgrps[] = {
+    [RGBW_GENL_GRP_STATE] = { .name = RGBW_GENL_MCGRP_STATE },
+};
+
+static struct genl_family rgbw_genl_family = {
+    .name       = RGBW_GENL_NAME,
+    .version    = RGBW_GENL_VERSION,
+    .maxattr    = RGBW_ATTR_MAX,
+    .module     = THIS_MODULE,
+    .ops        = rgbw_genl_ops,
+    .n_ops      = ARRAY_SIZE(rgbw_genl_ops),
+    .mcgrps     = rgbw_genl_mcgrps,
+    .n_mcgrps   = ARRAY_SIZE(rgbw_genl_mcgrps),
+};
+
+static bool rgbw_genl_registered;
+
+static size_t rgbw_genl_msg_size(void)
+{
+    return nla_total_size(sizeof(u32)) * 4 +
+           nla_total_size(sizeof(u32) * MAX_COLORS);
+}
+
+static int rgbw_genl_fill(struct sk_buff *skb, struct rgbw_device *rgbw_dev,
+              u32 portid, u32 seq, u32 state_seq, u32 mask, const u32 levels[MAX_COLORS],
+              bool name)
+{
+    void *hdr;
+
+    hdr = genlmsg_put(skb, portid, seq, &rgbw_genl_family, 0, RGBW_CMD_STATE);
+    if (!hdr)
+        return -EMSGSIZE;
+
+    /* the device goes first, see rgbw_uapi.h */
+    if (nla_put_u32(skb, RGBW_ATTR_DEVICE, MINOR(rgbw_dev->dev.devt)) ||
+        nla_put_u32(skb, RGBW_ATTR_SEQ, state_seq) ||
+        nla_put_u32(skb, RGBW_ATTR_MASK, mask) ||
+        nla_put(skb, RGBW_ATTR_LEVELS, sizeof(u32) * MAX_COLORS, levels) ||
+        nla_put_u32(skb, RGBW_ATTR_EFFECT, rgbw_dev->acts.state & RGBW_EFFECTS_MASK) ||
+        (name && nla_put_string(skb, RGBW_ATTR_NAME, dev_name(&rgbw_dev->dev)))) {
+        genlmsg_cancel(skb, hdr);
+        return -EMSGSIZE;
+    }
+    genlmsg_end(skb, hdr);
+
+    return 0;
+}
+
+/* 
+ * Multicast the change rgbw_notify_state() was called for, seq being
+ * the state sequence number it took for that change. Costs one
+ * check when nobody listens; the message is built in atomic context as
+ * effect timers notify every frame.
+ */
+static void rgbw_genl_notify(struct rgbw_device *rgbw_dev, u32 seq)
+{
+    struct sk_buff *skb;
+    u32 levels[MAX_COLORS];
+    u32 mask = 0;
+    int cntr;
+
+    if (!READ_ONCE(rgbw_genl_registered) ||
+        !genl_has_listeners(&rgbw_genl_family, &init_net, RGBW_GENL_GRP_STATE))
+        return;
+
+    for (cntr = COLOR_RED; cntr < MAX_COLORS; cntr++) {
+        levels[cntr] = READ_ONCE(rgbw_dev->props[cntr].brightness);
+        if (xchg(&rgbw_dev->nl_levels[cntr], levels[cntr]) != levels[cntr])
+            mask |= 1 << cntr;
+    }
+
+    skb = genlmsg_new(rgbw_genl_msg_size(), GFP_ATOMIC);
+    if (!skb)
+        return;
+    if (rgbw_genl_fill(skb, rgbw_dev, 0, 0, seq, mask, levels, false)) {
+        nlmsg_free(skb);
+        return;
+    }
+    genlmsg_multicast(&rgbw_genl_family, skb, 0, RGBW_GENL_GRP_STATE, GFP_ATOMIC);
+}
+
+static int rgbw_match_minor(struct device *dev, const void *data)
+{
+    return MINOR(dev->devt) == *(const u32 *)data;
+}
+
+static int rgbw_genl_get(struct sk_buff *skb, struct genl_info *info)
+{
+    struct rgbw_device *rgbw_dev;
+    struct sk_buff *msg;
+    struct device *dev;
+    u32 levels[MAX_COLORS];
+    u32 minor;
+    int cntr;
+    int rc;
+
+    if (!info->attrs[RGBW_ATTR_DEVICE])
+        return -EINVAL;
+    minor = nla_get_u32(info->attrs[RGBW_ATTR_DEVICE]);
+
+    dev = class_find_device(rgbw_class, NULL, &minor, rgbw_match_minor);
+    if (!dev)
+        return -ENODEV;
+    rgbw_dev = to_rgbw_device(dev);
+
+    msg = genlmsg_new(rgbw_genl_msg_size() +
+                      nla_total_size(strlen(dev_name(dev)) + 1), GFP_KERNEL);
+    if (!msg) {
+        put_device(dev);
+        return -ENOMEM;
+    }
+
+    for (cntr = COLOR_RED; cntr < MAX_COLORS; cntr++) {
+        levels[cntr] = READ_ONCE(rgbw_dev->props[cntr].brightness);
+    }
+    rc = rgbw_genl_fill(msg, rgbw_dev, info->snd_portid, info->snd_seq,
+                        atomic_read(&rgbw_dev->seq), RGBW_CH_ALL, levels, true);
+    put_device(dev);
+    if (rc) {
+        nlmsg_free(msg);
+        return rc;
+    }
+
+    return genlmsg_reply(msg, info);
+}
+
+/* 
+ * Genetlink itself comes up after the class' postcore init, so the
+ * family is registered along with the first device instead.
+ */
+static void rgbw_genl_init(void)
+{
+    static DEFINE_MUTEX(rgbw_genl_lock);
+    int rc;
+
+    mutex_lock(&rgbw_genl_lock);
+    if (!rgbw_genl_registered) {
+        rc = genl_register_family(&rgbw_genl_family);
+        if (rc)
+            pr_warn("Unable to register rgbw netlink family; errno = %d\n", rc);
+        else
+            WRITE_ONCE(rgbw_genl_registered, true);
+    }
+    mutex_unlock(&rgbw_genl_lock);
+}
+
+static void rgbw_genl_exit(void)
+{
+    if (rgbw_genl_registered)
+        genl_unregister_family(&rgbw_genl_family);
+}
+#else
+static inline void rgbw_genl_notify(struct rgbw_device *rgbw_dev, u32 seq)
+{
+}
+
+static inline void rgbw_genl_init(void)
+{
+}
+
+static inline void rgbw_genl_exit(void)
+{
+}
+#endif
+
+static int rgbw_suspend(struct device *dev)
+{
+    struct rgbw_device *rgbw_dev = to_rgbw_device(dev);
+    const struct rgbw_ops *ops;
+    int cntr;
+    
+    mutex_lock(&rgbw_dev->ops_lock);
+    ops = rgbw_get_ops(rgbw_dev);
+    if (ops && ops->options & RGBW_CORE_SUSPENDRESUME) {
+        /* 
+         * Park the running effects first so a callback that is already
+         * in flight will not re-arm itself, then kill the timers. The
+         * effect phase (pcolor, bstate and the per color cntr) is left
+         * untouched so the effect picks up where it stopped on resume.
+         */
+        rgbw_dev->acts.saved_state = rgbw_dev->acts.state & RGBW_EFFECTS_MASK;
+        rgbw_dev->acts.state &= ~RGBW_EFFECTS_MASK;
+        for (cntr = TIMER_PULSE; cntr < MAX_RGBWTIMER; cntr++) {
+            if (rgbw_dev->acts.saved_state & rgbw_timer_flags[cntr])
+                del_timer_sync(&rgbw_dev->rgbw_timer[cntr]);
+        }
+        
+        for (cntr = COLOR_RED; cntr < MAX_COLORS; cntr++) {
+            rgbw_dev->props[cntr].state |= RGBW_CORE_SUSPENDED;
+        }
+        /* the driver shuts its outputs and soft pwm timers down here */
+        rgbw_update_status(rgbw_dev);
+    }
+    mutex_unlock(&rgbw_dev->ops_lock);
+
+    return 0;
+}
+
+static int rgbw_resume(struct device *dev)
+{
+    struct rgbw_device *rgbw_dev = to_rgbw_device(dev);
+    const struct rgbw_ops *ops;
+    int cntr;
+    
+    mutex_lock(&rgbw_dev->ops_lock);
+    ops = rgbw_get_ops(rgbw_dev);
+    if (ops && ops->options & RGBW_CORE_SUSPENDRESUME) {
+        for (cntr = COLOR_RED; cntr < MAX_COLORS; cntr++) {
+            rgbw_dev->props[cntr].state &= ~RGBW_CORE_SUSPENDED;
+        }
+        rgbw_update_status(rgbw_dev);
+        
+        /* restart any parked effect from its stored phase on the next tick */
+        rgbw_dev->acts.state |= rgbw_dev->acts.saved_state;
+        for (cntr = TIMER_PULSE; cntr < MAX_RGBWTIMER; cntr++) {
+            if (rgbw_dev->acts.saved_state & rgbw_timer_flags[cntr])
+                mod_timer(&rgbw_dev->rgbw_timer[cntr], jiffies + 1);
+        }
+        rgbw_dev->acts.saved_state = 0;
+        if (READ_ONCE(rgbw_dev->comp.animated))
+            schedule_delayed_work(&rgbw_dev->comp.work, 0);
+    }
+    mutex_unlock(&rgbw_dev->ops_lock);
+
+    return 0;
+}
+
+static DEFINE_SIMPLE_DEV_PM_OPS(rgbw_class_pm, rgbw_suspend, rgbw_resume);
+
+static void rgbw_device_release(struct device *dev)
+{
+    struct rgbw_device *rgbw_dev = to_rgbw_device(dev);
+    ida_free(&rgbw_ida, MINOR(dev->devt));
+    cleanup_srcu_struct(&rgbw_dev->ops_srcu);
+    kfree(rgbw_dev);
+}
+
+static DEVICE_ATTR(RGBW_values, 00644, rgbw_show_values, rgbw_store_values);
+static DEVICE_ATTR(red_value, 00644, rgbw_show_single_color, rgbw_store_single_color);
+static DEVICE_ATTR(green_value, 00644, rgbw_show_single_color, rgbw_store_single_color);
+static DEVICE_ATTR(blue_value, 00644, rgbw_show_single_color, rgbw_store_single_color);
+static DEVICE_ATTR(white_value, 00644, rgbw_show_single_color, rgbw_store_single_color);
+static DEVICE_ATTR(per_color_max_value, 00444, rgbw_show_max_brightness, NULL);
+static DEVICE_ATTR(RGBW_types, 00444, rgbw_show_types, NULL);
+static DEVICE_ATTR(hsv, 00200, NULL, rgbw_store_hsx);
+static DEVICE_ATTR(hsl, 00200, NULL, rgbw_store_hsx);
+static DEVICE_ATTR(dimmer, 00644, rgbw_show_dimmer, rgbw_store_dimmer);
+static DEVICE_ATTR(dim_group, 00644, rgbw_show_dimmer, rgbw_store_dimmer);
+static DEVICE_ATTR(power_budget, 00644, rgbw_show_power, rgbw_store_power);
+static DEVICE_ATTR(supply_group, 00644, rgbw_show_power, rgbw_store_power);
+static DEVICE_ATTR(power, 00444, rgbw_show_power, NULL);
+static DEVICE_ATTR(pwm_period, 00644, rgbw_show_period, rgbw_store_period);
+static DEVICE_ATTR(color_matrix, 00644, rgbw_show_matrix, rgbw_store_matrix);
+static DEVICE_ATTR(white_extract, 00644, rgbw_show_white_extract, rgbw_store_white_extract);
+static DEVICE_ATTR(stats, 00444, rgbw_show_stats, NULL);
+static DEVICE_ATTR(latency, 00644, rgbw_show_latency, rgbw_store_latency);
+static DEVICE_ATTR(pulse, 00200, NULL, rgbw_set_pulse);
+static DEVICE_ATTR(blink, 00200, NULL, rgbw_set_blink);
+static DEVICE_ATTR(heartbeat, 00200, NULL, rgbw_set_heartbeat);
+static DEVICE_ATTR(rainbow, 00200, NULL, rgbw_set_rainbow);
+static DEVICE_ATTR(rainbow_config, 00644, rgbw_show_rainbow_config, rgbw_store_rainbow_config);
+static DEVICE_ATTR(scene, 00644, rgbw_show_scene, rgbw_store_scene);
+static DEVICE_ATTR(layers, 00644, rgbw_show_layers, rgbw_store_layers);
+
+static struct attribute *rgbw_attrs[] = {
+    &dev_attr_RGBW_values.attr,
+    &dev_attr_red_value.attr,
+    &dev_attr_green_value.attr,
+    &dev_attr_blue_value.attr,
+    &dev_attr_white_value.attr,
+    &dev_attr_per_color_max_value.attr,
+    &dev_attr_RGBW_types.attr,
+    &dev_attr_hsv.attr,
+    &dev_attr_hsl.attr,
+    &dev_attr_dimmer.attr,
+    &dev_attr_dim_group.attr,
+    &dev_attr_power_budget.attr,
+    &dev_attr_supply_group.attr,
+    &dev_attr_power.attr,
+    &dev_attr_pwm_period.attr,
+    &dev_attr_color_matrix.attr,
+    &dev_attr_white_extract.attr,
+    &dev_attr_stats.attr,
+    &dev_attr_latency.attr,
+    &dev_attr_pulse.attr,
+    &dev_attr_blink.attr,
+    &dev_attr_heartbeat.attr,
+    &dev_attr_rainbow.attr,
+    &dev_attr_rainbow_config.attr,
+    &dev_attr_scene.attr,
+    &dev_attr_layers.attr,
+    NULL,
+};
+
+static BIN_ATTR(state, 00444, rgbw_read_state, NULL, sizeof(struct rgbw_state));
+
+static struct bin_attribute *rgbw_bin_attrs[] = {
+    &bin_attr_state,
+    NULL,
+};
+
+static const struct attribute_group rgbw_group = {
+    .attrs = rgbw_attrs,
+    .bin_attrs = rgbw_bin_attrs,
+};
+__ATTRIBUTE_GROUPS(rgbw);
+
+#if IS_REACHABLE(CONFIG_LEDS_CLASS)
+/* 
+ * Apply whatever the LED class devices asked for since the last frame.
+ * The strip's own effects keep the colors while they run.
+ */
+static void rgbw_led_work_fn(struct work_struct *work)
+{
+    struct rgbw_device *rgbw_dev = container_of(to_delayed_work(work),
+                                                struct rgbw_device, led_work);
+    u32 level[MAX_COLORS];
+    unsigned long flags;
+    unsigned int dirty;
+    int cntr, idx;
+
+    spin_lock_irqsave(&rgbw_dev->led_lock, flags);
+    dirty = rgbw_dev->led_dirty;
+    rgbw_dev->led_dirty = 0;
+    memcpy(level, rgbw_dev->led_level, sizeof(level));
+    spin_unlock_irqrestore(&rgbw_dev->led_lock, flags);
+
+    if (!dirty || (rgbw_dev->acts.state & RGBW_EFFECTS_MASK))
+        return;
+
+    idx = rgbw_ops_read_lock(rgbw_dev);
+    if (rgbw_get_ops(rgbw_dev)) {
+        for (cntr = COLOR_RED; cntr < MAX_COLORS; cntr++) {
+            if (dirty & (1 << cntr))
+                rgbw_set_fine(&rgbw_dev->props[cntr], level[cntr]);
+        }
+        rgbw_update_status(rgbw_dev);
+    }
+    rgbw_ops_read_unlock(rgbw_dev, idx);
+    rgbw_dev->led_last = jiffies;
+
+    /* no uevent, triggers can fire at frame rate */
+    rgbw_notify_state(rgbw_dev);
+}
+
+/* Stage the latest level of a color for the next frame, under led_lock */
+static void rgbw_led_stage(struct rgbw_device *rgbw_dev, int color, u32 level)
+{
+    lockdep_assert_held(&rgbw_dev->led_lock);
+    rgbw_dev->led_level[color] = level;
+    rgbw_dev->led_dirty |= 1 << color;
+}
+
+/* 
+ * Called from any context, triggers set LEDs from timers and irqs. Only
+ * the latest level of each color is kept and at most one update runs
+ * per LED_FRAME_PER_MS however fast the trigger fires.
+ */
+static void rgbw_led_kick(struct rgbw_device *rgbw_dev)
+{
+    unsigned long next = rgbw_dev->led_last + msecs_to_jiffies(LED_FRAME_PER_MS);
+
+    schedule_delayed_work(&rgbw_dev->led_work,
+                          time_before(jiffies, next) ? next - jiffies : 0);
+}
+
+static void rgbw_led_queue(struct rgbw_device *rgbw_dev, int color, u32 level)
+{
+    unsigned long flags;
+
+    spin_lock_irqsave(&rgbw_dev->led_lock, flags);
+    rgbw_led_stage(rgbw_dev, color, level);
+    spin_unlock_irqrestore(&rgbw_dev->led_lock, flags);
+    rgbw_led_kick(rgbw_dev);
+}
+
+/* 
+ * brightness spread over the channels the LED is mapped to, each scaled
+ * by its weight and to its own max_brightness. Channels in @clear that
+ * are not mapped any more are turned off. Called with led_lock held.
+ */
+static void rgbw_led_stage_map(struct rgbw_led *led, enum led_brightness brightness,
+                               unsigned int clear)
+{
+    struct rgbw_device *rgbw_dev = led->rgbw_dev;
+    unsigned int max = led->cdev.max_brightness;
+    int cntr;
+
+    for (cntr = COLOR_RED; cntr < MAX_COLORS; cntr++) {
+        if (led->weight[cntr])
+            rgbw_led_stage(rgbw_dev, cntr,
+                           div_u64(((u64)brightness * led->weight[cntr] *
+                                    rgbw_dev->props[cntr].max_brightness) << 16, 255 * max));
+        else if (clear & (1 << cntr))
+            rgbw_led_stage(rgbw_dev, cntr, 0);
+    }
+}
+
+static void rgbw_led_color_set(struct led_classdev *led_cdev, enum led_brightness brightness)
+{
+    struct rgbw_led *led = container_of(led_cdev, struct rgbw_led, cdev);
+    unsigned long flags;
+
+    spin_lock_irqsave(&led->rgbw_dev->led_lock, flags);
+    rgbw_led_stage_map(led, brightness, 0);
+    spin_unlock_irqrestore(&led->rgbw_dev->led_lock, flags);
+    rgbw_led_kick(led->rgbw_dev);
+}
+
+static bool rgbw_led_present(struct rgbw_device *rgbw_dev, int color)
+{
+    return rgbw_dev->props[color].type == RGBW_PWM || rgbw_dev->props[color].type == RGBW_GPIO;
+}
+
+static ssize_t rgbw_led_show_channels(struct device *dev,
+        struct device_attribute *attr, char *buf)
+{
+    struct led_classdev *led_cdev = dev_get_drvdata(dev);
+    struct rgbw_led *led = container_of(led_cdev, struct rgbw_led, cdev);
+    u8 w[MAX_COLORS];
+    unsigned long flags;
+
+    spin_lock_irqsave(&led->rgbw_dev->led_lock, flags);
+    memcpy(w, led->weight, sizeof(w));
+    spin_unlock_irqrestore(&led->rgbw_dev->led_lock, flags);
+
+    return sprintf(buf, "%u %u %u %u\n", w[0], w[1], w[2], w[3]);
+}
+
+/* 
+ * "<red> <green> <blue> <white>", the share 0-255 of each channel the
+ * LED drives at full brightness: "255 255 0 0" makes an amber LED, all
+ * 255 drives the whole strip. Applied to the brightness it has now.
+ */
+static ssize_t rgbw_led_store_channels(struct device *dev,
+        struct device_attribute *attr, const char *buf, size_t count)
+{
+    struct led_classdev *led_cdev = dev_get_drvdata(dev);
+    struct rgbw_led *led = container_of(led_cdev, struct rgbw_led, cdev);
+    struct rgbw_device *rgbw_dev = led->rgbw_dev;
+    unsigned int w[MAX_COLORS];
+    unsigned int clear = 0;
+    unsigned long flags;
+    int cntr;
+
+    if (sscanf(buf, "%u %u %u %u", &w[0], &w[1], &w[2], &w[3]) != MAX_COLORS)
+        return -EINVAL;
+    for (cntr = COLOR_RED; cntr < MAX_COLORS; cntr++) {
+        if (w[cntr] > 255 || (w[cntr] && !rgbw_led_present(rgbw_dev, cntr)))
+            return -EINVAL;
+    }
+
+    spin_lock_irqsave(&rgbw_dev->led_lock, flags);
+    for (cntr = COLOR_RED; cntr < MAX_COLORS; cntr++) {
+        if (led->weight[cntr] && !w[cntr])
+            clear |= 1 << cntr;
+        led->weight[cntr] = w[cntr];
+    }
+    rgbw_led_stage_map(led, led_cdev->brightness, clear);
+    spin_unlock_irqrestore(&rgbw_dev->led_lock, flags);
+    rgbw_led_kick(rgbw_dev);
+
+    return count;
+}
+static DEVICE_ATTR(channels, 0644, rgbw_led_show_channels, rgbw_led_store_channels);
+
+static struct attribute *rgbw_led_attrs[] = {
+    &dev_attr_channels.attr,
+    NULL,
+};
+ATTRIBUTE_GROUPS(rgbw_led);
+
+#if RGBW_LED_MULTICOLOR
+static const unsigned int rgbw_led_colors[MAX_COLORS] = {
+    [COLOR_RED]     = LED_COLOR_ID_RED,
+    [COLOR_GREEN]   = LED_COLOR_ID_GREEN,
+    [COLOR_BLUE]    = LED_COLOR_ID_BLUE,
+    [COLOR_WHITE]   = LED_COLOR_ID_WHITE,
+};
+
+/* brightness scaled by multi_intensity, to full 16.16 levels */
+static void rgbw_led_mc_set(struct led_classdev *led_cdev, enum led_brightness brightness)
+{
+    struct led_classdev_mc *mc = lcdev_to_mccdev(led_cdev);
+    struct rgbw_device *rgbw_dev = container_of(mc, struct rgbw_device, mc);
+    unsigned int max = led_cdev->max_brightness;
+    struct mc_subled *sub;
+    unsigned int cntr;
+
+    for (cntr = 0; cntr < mc->num_colors; cntr++) {
+        sub = &mc->subled_info[cntr];
+        rgbw_led_queue(rgbw_dev, sub->channel,
+                       div_u64(((u64)brightness * min(sub->intensity, max)) << 16, max));
+    }
+}
+
+static int rgbw_led_mc_register(struct rgbw_device *rgbw_dev)
+{
+    struct led_classdev_mc *mc = &rgbw_dev->mc;
+    struct device_node *np = rgbw_dev->dev.parent ? rgbw_dev->dev.parent->of_node : NULL;
+    struct mc_subled *sub;
+    int cntr;
+    int rc;
+
+    mc->num_colors = 0;
+    for (cntr = COLOR_RED; cntr < MAX_COLORS; cntr++) {
+        if (!rgbw_led_present(rgbw_dev, cntr))
+            continue;
+        sub = &rgbw_dev->subled[mc->num_colors++];
+        sub->color_index = rgbw_led_colors[cntr];
+        sub->channel = cntr;
+        sub->intensity = rgbw_dev->props[cntr].max_brightness;
+    }
+    mc->subled_info = rgbw_dev->subled;
+
+    snprintf(rgbw_dev->led_name, sizeof(rgbw_dev->led_name), "%s:multicolor",
+             dev_name(&rgbw_dev->dev));
+    mc->led_cdev.name = rgbw_dev->led_name;
+    mc->led_cdev.max_brightness = rgbw_dev->props[COLOR_RED].max_brightness;
+    mc->led_cdev.brightness_set = rgbw_led_mc_set;
+    if (np)
+        of_property_read_string(np, "linux,default-trigger", &mc->led_cdev.default_trigger);
+
+    rc = led_classdev_multicolor_register(&rgbw_dev->dev, mc);
+    if (rc)
+        mc->led_cdev.dev = NULL;
+    return rc;
+}
+
+static void rgbw_led_mc_unregister(struct rgbw_device *rgbw_dev)
+{
+    if (!IS_ERR_OR_NULL(rgbw_dev->mc.led_cdev.dev))
+        led_classdev_multicolor_unregister(&rgbw_dev->mc);
+    rgbw_dev->mc.led_cdev.dev = NULL;
+}
+#else
+static inline int rgbw_led_mc_register(struct rgbw_device *rgbw_dev)
+{
+    return 0;
+}
+
+static inline void rgbw_led_mc_unregister(struct rgbw_device *rgbw_dev)
+{
+}
+#endif
+
+static void rgbw_led_unregister(struct rgbw_device *rgbw_dev)
+{
+    int cntr;
+
+    rgbw_led_mc_unregister(rgbw_dev);
+    for (cntr = COLOR_RED; cntr < MAX_COLORS; cntr++) {
+        if (!IS_ERR_OR_NULL(rgbw_dev->led[cntr].cdev.dev))
+            led_classdev_unregister(&rgbw_dev->led[cntr].cdev);
+        rgbw_dev->led[cntr].cdev.dev = NULL;
+    }
+    cancel_delayed_work_sync(&rgbw_dev->led_work);
+}
+
+/* 
+ * One LED per color for per channel triggers, plus one for the whole
+ * strip with a multicolor LED class. Each trigger is bound from the
+ * LED's own trigger file. A color LED drives its own channel unless
+ * its row of the parent's led-channels says otherwise:
+ *
+ * led-channels = <16 weights 0-255, row per color LED>;
+ */
+static int rgbw_led_register(struct rgbw_device *rgbw_dev)
+{
+    struct device_node *np = rgbw_dev->dev.parent ? rgbw_dev->dev.parent->of_node : NULL;
+    u32 map[MAX_COLORS][MAX_COLORS];
+    bool has_map = false;
+    struct rgbw_led *led;
+    int cntr, ch;
+    int rc;
+
+    if (np && of_property_count_u32_elems(np, "led-channels") > 0) {
+        rc = of_property_read_u32_array(np, "led-channels", (u32 *)map, MAX_COLORS * MAX_COLORS);
+        if (rc < 0) {
+            dev_err(&rgbw_dev->dev, "led-channels needs %d entries\n", MAX_COLORS * MAX_COLORS);
+            return rc;
+        }
+        has_map = true;
+    }
+
+    for (cntr = COLOR_RED; cntr < MAX_COLORS; cntr++) {
+        if (!rgbw_led_present(rgbw_dev, cntr))
+            continue;
+        led = &rgbw_dev->led[cntr];
+        led->rgbw_dev = rgbw_dev;
+        led->color = cntr;
+        for (ch = COLOR_RED; ch < MAX_COLORS; ch++) {
+            if (has_map)
+                led->weight[ch] = rgbw_led_present(rgbw_dev, ch) ? min_t(u32, map[cntr][ch], 255) : 0;
+            else
+                led->weight[ch] = (ch == cntr) ? 255 : 0;
+        }
+        snprintf(led->name, sizeof(led->name), "%s:%s", dev_name(&rgbw_dev->dev),
+                 color_names[cntr]);
+        led->cdev.name = led->name;
+        led->cdev.max_brightness = rgbw_dev->props[cntr].max_brightness;
+        led->cdev.brightness_set = rgbw_led_color_set;
+        led->cdev.groups = rgbw_led_groups;
+        rc = led_classdev_register(&rgbw_dev->dev, &led->cdev);
+        if (rc) {
+            led->cdev.dev = NULL;
+            goto err_unwind;
+        }
+    }
+
+    rc = rgbw_led_mc_register(rgbw_dev);
+    if (rc)
+        goto err_unwind;
+
+    return 0;
+
+err_unwind:
+    /* a trigger may already have queued a frame for the ones that made it */
+    rgbw_led_unregister(rgbw_dev);
+    return rc;
+}
+
+static void rgbw_led_init(struct rgbw_device *rgbw_dev)
+{
+    spin_lock_init(&rgbw_dev->led_lock);
+    INIT_DELAYED_WORK(&rgbw_dev->led_work, rgbw_led_work_fn);
+}
+#else
+static inline int rgbw_led_register(struct rgbw_device *rgbw_dev)
+{
+    return 0;
+}
+
+static inline void rgbw_led_unregister(struct rgbw_device *rgbw_dev)
+{
+}
+
+static inline void rgbw_led_init(struct rgbw_device *rgbw_dev)
+{
+}
+#endif
+
+/**
+ * rgbw_register_leds - expose a device to the LED subsystem
+ * @rgbw_dev: the rgbw device
+ *
+ * Registers an LED class device per color and, on kernels with the
+ * multicolor LED class, one for the whole strip so kernel triggers can
+ * drive it. A color LED's channels file maps it onto any mix of the
+ * strip's channels, no multicolor class needed. A default trigger may fire from inside this call, so the
+ * driver must be ready for updates, effect timers included. The LEDs
+ * go away again in rgbw_device_unregister(), or here already when one
+ * of them fails to register.
+ *
+ * Returns 0 when built without the LED class.
+ */
+int rgbw_register_leds(struct rgbw_device *rgbw_dev)
+{
+    return rgbw_led_register(rgbw_dev);
+}
+EXPORT_SYMBOL(rgbw_register_leds);
+
+/**
+ * rgbw_device_register - create and register a new object of
+ *   rgbw_device class.
+ * @name: the name of the new object(must be the same as the name of the
+ *   respective framebuffer device).
+ * @parent: a pointer to the parent device
+ * @devdata: an optional pointer to be stored for private driver use. The
+ *   methods may retrieve it by using rgbw_get_data(rgbw_dev).
+ * @ops: the color operations structure.
+ *
+ * Creates and registers new rgbw device. Returns either an
+ * ERR_PTR() or a pointer to the newly allocated device.
+ */
+struct rgbw_device *rgbw_device_register(const char *name,
+    struct device *parent, void *devdata, const struct rgbw_ops *ops,
+    struct rgbw_properties props[MAX_COLORS], struct rgbw_actions *acts)
+{
+    
+    struct rgbw_device *new_rgbw_dev;
+    int rc;
+    int cntr;
+    int minor;
+    
+    pr_debug("rgbw_device_register: name=%s\n", name);
+
+    new_rgbw_dev = kzalloc(sizeof(struct rgbw_device), GFP_KERNEL);
+    if (!new_rgbw_dev)
+        return ERR_PTR(-ENOMEM);
+
+    minor = ida_alloc_max(&rgbw_ida, RGBW_MAX_DEVICES - 1, GFP_KERNEL);
+    if (minor < 0) {
+        kfree(new_rgbw_dev);
+        return ERR_PTR(minor);
+    }
+
+    rc = init_srcu_struct(&new_rgbw_dev->ops_srcu);
+    if (rc) {
+        ida_free(&rgbw_ida, minor);
+        kfree(new_rgbw_dev);
+        return ERR_PTR(rc);
+    }
+
+    mutex_init(&new_rgbw_dev->update_lock);
+    mutex_init(&new_rgbw_dev->ops_lock);
+    spin_lock_init(&new_rgbw_dev->lat.lock);
+    spin_lock_init(&new_rgbw_dev->corr.lock);
+    for (cntr = COLOR_RED; cntr < MAX_COLORS; cntr++) {
+        new_rgbw_dev->corr.matrix[cntr][cntr] = RGBW_MATRIX_ONE;
+    }
+    new_rgbw_dev->corr.identity = true;
+    INIT_DELAYED_WORK(&new_rgbw_dev->trans.work, rgbw_transition_work);
+    INIT_DELAYED_WORK(&new_rgbw_dev->comp.work, rgbw_compose_work);
+
+    new_rgbw_dev->dev.class = rgbw_class;
+    new_rgbw_dev->dev.devt = MKDEV(MAJOR(rgbw_devt), minor);
+    new_rgbw_dev->dev.parent = parent;
+    new_rgbw_dev->dev.release = rgbw_device_release;
+    dev_set_name(&new_rgbw_dev->dev, name);
+    dev_set_drvdata(&new_rgbw_dev->dev, devdata);
+
+    /* Set default properties */
+    if (props) {
+        memcpy(&new_rgbw_dev->props, props,
+               sizeof(struct rgbw_properties) * MAX_COLORS);
+        for (cntr = COLOR_RED; cntr < MAX_COLORS; cntr++) {
+            if (props[cntr].type <= 0 || props[cntr].type >= RGBW_TYPE_MAX) {
+                WARN(1, "%s: invalid rgbw type", name);
+            }
+        }  
+    } 
+
+    /* ops and acts are in place before the sysfs and /dev nodes show up */
+    RCU_INIT_POINTER(new_rgbw_dev->ops, ops);
+    new_rgbw_dev->acts = *acts;
+    new_rgbw_dev->acts.rb_period = RAINBOW_PERIOD_MS;
+    new_rgbw_dev->acts.rb_sat = 0xffff;
+    new_rgbw_dev->acts.rb_val = 0xffff;
+    new_rgbw_dev->dimmer = RGBW_DIM_FULL;
+    new_rgbw_dev->dim_level = RGBW_DIM_FULL;
+    new_rgbw_dev->power.scale = RGBW_POWER_ONE;
+    new_rgbw_dev->thermal.cur_scale = RGBW_POWER_ONE;
+    new_rgbw_dev->scene = -1;
+    rgbw_led_init(new_rgbw_dev);
+
+    device_initialize(&new_rgbw_dev->dev);
+    if (ops && ops->init) {
+        rc = ops->init(new_rgbw_dev);
+        if (rc) {
+            put_device(&new_rgbw_dev->dev);
+            return ERR_PTR(rc);
+        }
+    }
+
+    cdev_init(&new_rgbw_dev->cdev, &rgbw_fops);
+    new_rgbw_dev->cdev.owner = THIS_MODULE;
+    new_rgbw_dev->cdev.kobj.parent = &new_rgbw_dev->dev.kobj;
+    rc = cdev_add(&new_rgbw_dev->cdev, new_rgbw_dev->dev.devt, 1);
+    if (rc) {
+        put_device(&new_rgbw_dev->dev);
+        return ERR_PTR(rc);
+    }
+
+    rc = device_add(&new_rgbw_dev->dev);
+    if (rc) {
+        cdev_del(&new_rgbw_dev->cdev);
+        put_device(&new_rgbw_dev->dev);
+        return ERR_PTR(rc);
+    }
+
+    new_rgbw_dev->state_kn = sysfs_get_dirent(new_rgbw_dev->dev.kobj.sd, "state");
+
+    /* observers only, the device works without it */
+    rgbw_genl_init();
+
+    return new_rgbw_dev;
+}
+EXPORT_SYMBOL(rgbw_device_register);
+
+/**
+ * rgbw_device_unregister - unregisters a rgbw device object.
+ * @rgbw_dev: the rgbw device object to be unregistered and freed.
+ *
+ * Unregisters a previously registered via rgbw_device_register object.
+ */
+void rgbw_device_unregister(struct rgbw_device *rgbw_dev)
+{
+    if (!rgbw_dev)
+        return;
+
+    /* stop the triggers first, they would only find ops gone */
+    rgbw_led_unregister(rgbw_dev);
+
+    mutex_lock(&rgbw_dev->ops_lock);
+    rcu_assign_pointer(rgbw_dev->ops, NULL);
+    mutex_unlock(&rgbw_dev->ops_lock);
+    /* no update_status() made through ops is left running after this */
+    synchronize_srcu(&rgbw_dev->ops_srcu);
+
+#if IS_REACHABLE(CONFIG_THERMAL)
+    if (rgbw_dev->thermal.cdev)
+        thermal_cooling_device_unregister(rgbw_dev->thermal.cdev);
+#endif
+
+    /* hand our share of the supply back to the rest of the group */
+    if (rgbw_dev->power.group) {
+        static const unsigned int none[MAX_COLORS];
+
+        rgbw_set_power_limit(rgbw_dev, none, 0, 0);
+    }
+
+    cancel_delayed_work_sync(&rgbw_dev->trans.work);
+    cancel_delayed_work_sync(&rgbw_dev->comp.work);
+    cdev_del(&rgbw_dev->cdev);
+
+    if (rgbw_dev->state_kn) {
+        sysfs_put(rgbw_dev->state_kn);
+        rgbw_dev->state_kn = NULL;
+    }
+    device_unregister(&rgbw_dev->dev);
+}
+EXPORT_SYMBOL(rgbw_device_unregister);
+
+static int of_parent_match(struct device *dev, const void *data)
+{
+    return dev->parent && dev->parent->of_node == data;
+}
+
+/**
+ * of_find_rgbw_by_node() - find rgbw device by device-tree node
+ * @node: device-tree node of the rgbw device
+ *
+ * Returns a pointer to the rgbw device corresponding to the given DT
+ * node or NULL if no such rgbw device exists or if the device hasn't
+ * been probed yet.
+ *
+ * This function obtains a reference on the rgbw device and it is the
+ * caller's responsibility to drop the reference by calling put_device() on
+ * the rgbw device's .dev field.  
+ */
+struct rgbw_device *of_find_rgbw_by_node(struct device_node *node)
+{
+    struct device *dev;
+
+    dev = class_find_device(rgbw_class, NULL, node, of_parent_match);
+
+    return dev ? to_rgbw_device(dev) : NULL;
+}
+EXPORT_SYMBOL(of_find_rgbw_by_node);
+
+/* Every brightness-levels table in use, looked up by its control points */
+static LIST_HEAD(rgbw_levels_list);
+static DEFINE_MUTEX(rgbw_levels_lock);
+
+/**
+ * rgbw_levels_get() - get a shared brightness-levels table
+ * @points: control points of the table
+ * @npoints: number of control points
+ * @steps: levels interpolated from one control point to the next, 0 or
+ *         1 to use @points as the whole table
+ *
+ * Strips with the same curve share one expanded table, so a long curve
+ * costs its memory and interpolation only once. @points may be freed
+ * after the call. Drop the reference with rgbw_levels_put().
+ *
+ * Returns the table or an ERR_PTR().
+ */
+struct rgbw_levels *rgbw_levels_get(const u32 *points, unsigned int npoints,
+        unsigned int steps)
+{
+    struct rgbw_levels *levels;
+    unsigned int count;
+
+    if (!npoints || npoints > RGBW_MAX_LEVELS || steps > RGBW_MAX_LEVELS)
+        return ERR_PTR(-EINVAL);
+    if (steps < 2)
+        steps = 0;
+    count = rgbw_levels_count(npoints, steps);
+    if (count > RGBW_MAX_LEVELS)
+        return ERR_PTR(-EINVAL);
+
+    mutex_lock(&rgbw_levels_lock);
+    list_for_each_entry(levels, &rgbw_levels_list, list) {
+        if (levels->npoints == npoints && levels->steps == steps &&
+            !memcmp(levels->points, points, npoints * sizeof(*points))) {
+            kref_get(&levels->ref);
+            goto out;
+        }
+    }
+
+    /* the control points are kept right behind the table */
+    levels = kmalloc(sizeof(*levels) + count * sizeof(levels->table[0]) +
+                     npoints * sizeof(*points), GFP_KERNEL);
+    if (!levels) {
+        levels = ERR_PTR(-ENOMEM);
+        goto out;
+    }
+    levels->points = memcpy(&levels->table[count], points, npoints * sizeof(*points));
+    levels->npoints = npoints;
+    levels->steps = steps;
+    levels->count = count;
+    rgbw_interpolate_levels(points, npoints, steps, levels->table);
+    kref_init(&levels->ref);
+    list_add(&levels->list, &rgbw_levels_list);
+out:
+    mutex_unlock(&rgbw_levels_lock);
+    return levels;
+}
+EXPORT_SYMBOL(rgbw_levels_get);
+
+static void rgbw_levels_release(struct kref *ref)
+{
+    struct rgbw_levels *levels = container_of(ref, struct rgbw_levels, ref);
+
+    list_del(&levels->list);
+    kfree(levels);
+}
+
+/**
+ * rgbw_levels_put() - drop a table taken with rgbw_levels_get()
+ * @levels: the table
+ */
+void rgbw_levels_put(struct rgbw_levels *levels)
+{
+    mutex_lock(&rgbw_levels_lock);
+    kref_put(&levels->ref, rgbw_levels_release);
+    mutex_unlock(&rgbw_levels_lock);
+}
+EXPORT_SYMBOL(rgbw_levels_put);
 
 
 static void __exit rgbw_class_exit(void)
 {
+    rgbw_genl_exit();
+    class_remove_file(rgbw_class, &class_attr_group_scene);
+    class_remove_file(rgbw_class, &class_attr_supply_budget);
+    class_remove_file(rgbw_class, &class_attr_group_dimmer);
+    cancel_work_sync(&rgbw_supply_work);
     class_destroy(rgbw_class);
+    unregister_chrdev_region(rgbw_devt, RGBW_MAX_DEVICES);
 }
 
 static int __init rgbw_class_init(void)
 {
+    int rc;
   
-    rgbw_class = class_create(THIS_MODULE, "rgbw");
+    rc = alloc_chrdev_region(&rgbw_devt, 0, RGBW_MAX_DEVICES, "rgbw");
+    if (rc) {
+        pr_warn("Unable to allocate rgbw char devices; errno = %d\n", rc);
+        return rc;
+    }
+
+    rgbw_class = class_create("rgbw");
     if (IS_ERR(rgbw_class)) {
         pr_warn("Unable to create rgbw class; errno = %ld\n",
             PTR_ERR(rgbw_class));
+        unregister_chrdev_region(rgbw_devt, RGBW_MAX_DEVICES);
         return PTR_ERR(rgbw_class);
     }
 
+    BUILD_BUG_ON(RGBW_EFFECT_PULSE != RGBW_PULSE_ON ||
+                 RGBW_EFFECT_BLINK != RGBW_BLINK_ON ||
+                 RGBW_EFFECT_HEARTBEAT != RGBW_HB_ON ||
+                 RGBW_EFFECT_RAINBOW != RGBW_RB_ON);
+    BUILD_BUG_ON(RGBW_UAPI_COLORS != MAX_COLORS);
+
     rgbw_class->dev_groups = rgbw_groups;
-    rgbw_class->suspend = rgbw_suspend;
-    rgbw_class->resume = rgbw_resume;
+    rgbw_class->pm = pm_sleep_ptr(&rgbw_class_pm);
+
+    rc = class_create_file(rgbw_class, &class_attr_group_dimmer);
+    if (rc)
+        pr_warn("Unable to create rgbw group_dimmer; errno = %d\n", rc);
+    rc = class_create_file(rgbw_class, &class_attr_supply_budget);
+    if (rc)
+        pr_warn("Unable to create rgbw supply_budget; errno = %d\n", rc);
+    rc = class_create_file(rgbw_class, &class_attr_group_scene);
+    if (rc)
+        pr_warn("Unable to create rgbw group_scene; errno = %d\n", rc);
        
     return 0;
 }
@@ -0,0 +1,841 @@
+/*
+ * RGB+W LED Generic Device Driver KUnit tests
+ *
+ * Copyleft 2016 Tudor Design Systems, LLC.
+ *
+ * Author: Cody Tudor <cody.tudor@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * Included at the end of leds-rgbw-generic.c with
+ * CONFIG_LEDS_RGBW_KUNIT_TEST so the tests reach the driver's statics.
+ *
+ * Every test applies leds-rgbw-generic-test.dtso and waits for the
+ * driver to probe the strips in it, through rgbw_dt_probe() like on a
+ * board. Their red, green and blue sit on a mock pwm chip that records
+ * each state applied to it, white is a gpio-sim line. Three things are
+ * recorded with their time:
+ *
+ * - pwm states as the mock chip's .apply gets them
+ * - pin values the driver asks for, from the rgbw_gpio_set tracepoint,
+ *   with the expiry of the soft pwm hrtimer when it came from there
+ * - writes to the gpio-sim line, from gpiolib's gpio_value tracepoint
+ *
+ * Tests drive the strip through the class' sysfs stores, wait for the
+ * operations they expect and check them and their timing from what was
+ * recorded. The pwm core drops a state that changes nothing, so only
+ * the colors a test changes are looked at.
+ */
+
+#include <kunit/test.h>
+#include <kunit/of.h>
+#include <kunit/platform_device.h>
+#include <linux/of_platform.h>
+#include <linux/gpio/consumer.h>
+#include <linux/completion.h>
+#include <linux/wait.h>
+#include <linux/math64.h>
+
+/* gpiolib defines these, only hook them here */
+#undef CREATE_TRACE_POINTS
+#include <trace/events/gpio.h>
+
+#define RGBW_TEST_MAX_OPS       256
+#define RGBW_TEST_STRIP_PWMS    3           // red, green and blue of each strip
+#define RGBW_TEST_EDGES         16          // soft pwm edges to look at
+#define RGBW_TEST_TIMEOUT       (5 * HZ)    // only hit when the driver is broken
+
+/* strips in the overlay, by brightness-levels */
+enum rgbw_test_strip {
+    RGBW_TEST_IDENTITY,
+    RGBW_TEST_HIGH,             // levels[max] above max_brightness
+    RGBW_TEST_LOW,              // levels[max] below max_brightness
+};
+
+static const char *const rgbw_test_paths[] = {
+    [RGBW_TEST_IDENTITY]    = "/rgbw-test",
+    [RGBW_TEST_HIGH]        = "/rgbw-test-high",
+    [RGBW_TEST_LOW]         = "/rgbw-test-low",
+};
+
+enum rgbw_test_op_type {
+    RGBW_TEST_PWM,              // pwm state applied to the mock chip
+    RGBW_TEST_EDGE,             // pin value the driver asked for
+    RGBW_TEST_PIN,              // write gpiolib made to the gpio-sim line
+};
+
+struct rgbw_test_op {
+    enum rgbw_test_op_type type;
+    ktime_t time;
+    unsigned long jiffies;
+    int color;
+    struct pwm_state state;     // RGBW_TEST_PWM
+    int value;                  // RGBW_TEST_EDGE and RGBW_TEST_PIN
+    ktime_t expires;            // RGBW_TEST_EDGE, when the soft pwm hrtimer was due, 0 outside it
+};
+
+struct rgbw_test {
+    enum rgbw_test_strip strip; // strip whose operations are recorded
+    struct platform_device *pdev;
+    struct rgbw_device *rgbw_dev;
+    struct pwm_rgbw_data *pb;
+    struct device *dev;         // set once the strip probed, what the tracepoints match
+    unsigned int gpio;          // white's gpio-sim line
+    unsigned int busy;          // RGBW_TEST_BUSY_* left running at teardown
+    bool torn_down;
+    spinlock_t lock;            // ops come from timers too
+    wait_queue_head_t wait;
+    unsigned int nr_ops;
+    struct rgbw_test_op ops[RGBW_TEST_MAX_OPS];
+};
+
+#define RGBW_TEST_BUSY_TIMER    BIT(0)      // an effect timer
+#define RGBW_TEST_BUSY_HRTIMER  BIT(1)      // a soft pwm hrtimer
+#define RGBW_TEST_BUSY_PIN      BIT(2)      // a sleeping gpio write
+#define RGBW_TEST_BUSY_GOV      BIT(3)      // the soft pwm governor
+#define RGBW_TEST_BUSY_DEV      BIT(4)      // pb still points at the class device
+
+/* the mock pwm chip is bound by the driver core, it finds the test here */
+static struct rgbw_test *rgbw_test_ctx;
+
+static struct rgbw_test_op *rgbw_test_record(struct rgbw_test *t, enum rgbw_test_op_type type,
+        int color)
+{
+    struct rgbw_test_op *op = NULL;
+
+    lockdep_assert_held(&t->lock);
+    if (t->nr_ops < RGBW_TEST_MAX_OPS) {
+        op = &t->ops[t->nr_ops];
+        memset(op, 0, sizeof(*op));
+        op->type = type;
+        op->time = ktime_get();
+        op->jiffies = jiffies;
+        op->color = color;
+    }
+    t->nr_ops++;
+
+    return op;
+}
+
+static void rgbw_test_clear(struct rgbw_test *t)
+{
+    unsigned long flags;
+
+    spin_lock_irqsave(&t->lock, flags);
+    t->nr_ops = 0;
+    spin_unlock_irqrestore(&t->lock, flags);
+}
+
+static int rgbw_test_pwm_apply(struct pwm_chip *chip, struct pwm_device *pwm,
+        const struct pwm_state *state)
+{
+    struct rgbw_test *t = READ_ONCE(rgbw_test_ctx);
+    struct rgbw_test_op *op;
+    unsigned long flags;
+
+    if (!t || pwm->hwpwm / RGBW_TEST_STRIP_PWMS != t->strip)
+        return 0;
+
+    spin_lock_irqsave(&t->lock, flags);
+    op = rgbw_test_record(t, RGBW_TEST_PWM, pwm->hwpwm % RGBW_TEST_STRIP_PWMS);
+    if (op)
+        op->state = *state;
+    spin_unlock_irqrestore(&t->lock, flags);
+    wake_up(&t->wait);
+
+    return 0;
+}
+
+static const struct pwm_ops rgbw_test_pwm_ops = {
+    .apply      = rgbw_test_pwm_apply,
+};
+
+static int rgbw_test_pwm_probe(struct platform_device *pdev)
+{
+    struct pwm_chip *chip;
+
+    chip = devm_pwmchip_alloc(&pdev->dev, ARRAY_SIZE(rgbw_test_paths) * RGBW_TEST_STRIP_PWMS, 0);
+    if (IS_ERR(chip))
+        return PTR_ERR(chip);
+    chip->ops = &rgbw_test_pwm_ops;
+    /* effects and soft pwm apply from timers, like i.MX the mock never sleeps */
+    chip->atomic = true;
+
+    return devm_pwmchip_add(&pdev->dev, chip);
+}
+
+static const struct of_device_id rgbw_test_pwm_match[] = {
+    { .compatible = "test,rgbw-pwm" },
+    { }
+};
+
+static struct platform_driver rgbw_test_pwm_driver = {
+    .driver     = {
+        .name           = "rgbw-test-pwm",
+        .of_match_table = rgbw_test_pwm_match,
+    },
+    .probe      = rgbw_test_pwm_probe,
+};
+
+static void rgbw_test_edge(void *data, struct device *dev, int color, int value)
+{
+    struct rgbw_test *t = data;
+    struct hrtimer *timer;
+    struct rgbw_test_op *op;
+    unsigned long flags;
+
+    if (dev != READ_ONCE(t->dev))
+        return;
+
+    /* still the edge it was due for, hrtimer_forward() comes after */
+    timer = &t->pb->soft_pwm[color].pwm_timer;
+    spin_lock_irqsave(&t->lock, flags);
+    op = rgbw_test_record(t, RGBW_TEST_EDGE, color);
+    if (op) {
+        op->value = value;
+        if (hrtimer_callback_running(timer))
+            op->expires = hrtimer_get_expires(timer);
+    }
+    spin_unlock_irqrestore(&t->lock, flags);
+    wake_up(&t->wait);
+}
+
+static void rgbw_test_gpio_value(void *data, unsigned int gpio, int get, int value)
+{
+    struct rgbw_test *t = data;
+    struct rgbw_test_op *op;
+    unsigned long flags;
+
+    if (get || !READ_ONCE(t->dev) || gpio != t->gpio)
+        return;
+
+    spin_lock_irqsave(&t->lock, flags);
+    op = rgbw_test_record(t, RGBW_TEST_PIN, COLOR_WHITE);
+    if (op)
+        op->value = value;
+    spin_unlock_irqrestore(&t->lock, flags);
+    wake_up(&t->wait);
+}
+
+static unsigned int rgbw_test_count(struct rgbw_test *t, enum rgbw_test_op_type type, int color)
+{
+    unsigned long flags;
+    unsigned int cntr, n = 0;
+
+    spin_lock_irqsave(&t->lock, flags);
+    for (cntr = 0; cntr < min_t(unsigned int, t->nr_ops, RGBW_TEST_MAX_OPS); cntr++) {
+        if (t->ops[cntr].type == type && t->ops[cntr].color == color)
+            n++;
+    }
+    spin_unlock_irqrestore(&t->lock, flags);
+
+    return n;
+}
+
+/* Wait for @n operations of @type on @color, no sleeping for a guessed time */
+static void rgbw_test_wait(struct kunit *test, enum rgbw_test_op_type type, int color,
+        unsigned int n)
+{
+    struct rgbw_test *t = test->priv;
+
+    KUNIT_ASSERT_GT_MSG(test, wait_event_timeout(t->wait, rgbw_test_count(t, type, color) >= n,
+                                                 RGBW_TEST_TIMEOUT), 0L,
+                        "%u operations of type %d on color %d never came", n, type, color);
+}
+
+/* Copy out the recorded operations of @type on @color */
+static unsigned int rgbw_test_ops(struct kunit *test, enum rgbw_test_op_type type, int color,
+        struct rgbw_test_op *ops)
+{
+    struct rgbw_test *t = test->priv;
+    unsigned long flags;
+    unsigned int cntr, n = 0;
+
+    spin_lock_irqsave(&t->lock, flags);
+    KUNIT_EXPECT_LE(test, t->nr_ops, (unsigned int)RGBW_TEST_MAX_OPS);
+    for (cntr = 0; cntr < min_t(unsigned int, t->nr_ops, RGBW_TEST_MAX_OPS); cntr++) {
+        if (t->ops[cntr].type == type && t->ops[cntr].color == color)
+            ops[n++] = t->ops[cntr];
+    }
+    spin_unlock_irqrestore(&t->lock, flags);
+
+    return n;
+}
+
+static void rgbw_test_put_device(void *dev)
+{
+    put_device(dev);
+}
+
+/* Apply the overlay and wait for @strip to probe */
+static struct rgbw_device *rgbw_test_strip(struct kunit *test, enum rgbw_test_strip strip)
+{
+    struct rgbw_test *t = test->priv;
+    struct platform_device *pdev;
+    struct device_node *np;
+    struct completion *probed;
+
+    of_root_kunit_skip(test);
+    t->strip = strip;
+    KUNIT_ASSERT_EQ(test, of_overlay_apply_kunit(test, leds_rgbw_generic_test), 0);
+
+    np = of_find_node_by_path(rgbw_test_paths[strip]);
+    KUNIT_ASSERT_NOT_NULL(test, np);
+    pdev = of_find_device_by_node(np);
+    of_node_put(np);
+    KUNIT_ASSERT_NOT_NULL(test, pdev);
+    KUNIT_ASSERT_EQ(test, kunit_add_action_or_reset(test, rgbw_test_put_device, &pdev->dev), 0);
+
+    /* the driver probes asynchronously */
+    probed = kunit_kzalloc(test, sizeof(*probed), GFP_KERNEL);
+    KUNIT_ASSERT_NOT_NULL(test, probed);
+    init_completion(probed);
+    KUNIT_ASSERT_EQ(test, kunit_platform_device_prepare_wait_for_probe(test, pdev, probed), 0);
+    KUNIT_ASSERT_GT(test, wait_for_completion_timeout(probed, RGBW_TEST_TIMEOUT), 0UL);
+
+    t->pdev = pdev;
+    t->rgbw_dev = platform_get_drvdata(pdev);
+    KUNIT_ASSERT_NOT_NULL(test, t->rgbw_dev);
+    t->pb = rgbw_get_data(t->rgbw_dev);
+    KUNIT_ASSERT_EQ(test, t->pb->types[COLOR_WHITE], RGBW_GPIO);
+    t->gpio = t->pb->soft_pwm[COLOR_WHITE].gpio;
+    WRITE_ONCE(t->dev, &pdev->dev);
+    rgbw_test_clear(t);
+
+    return t->rgbw_dev;
+}
+
+/* Write a class attribute the way sysfs would, returning what the store did */
+static ssize_t rgbw_test_write(struct kunit *test, struct rgbw_device *rgbw_dev,
+        const char *name, const char *buf)
+{
+    const struct attribute_group **groups = rgbw_dev->dev.class->dev_groups;
+    struct device_attribute *dattr;
+    struct attribute **attr;
+
+    for (; *groups; groups++) {
+        for (attr = (*groups)->attrs; *attr; attr++) {
+            if (strcmp((*attr)->name, name))
+                continue;
+            dattr = container_of(*attr, struct device_attribute, attr);
+            return dattr->store(&rgbw_dev->dev, dattr, buf, strlen(buf));
+        }
+    }
+    KUNIT_FAIL(test, "no attribute %s", name);
+    return -ENOENT;
+}
+
+/* and one that has to be taken */
+static void rgbw_test_store(struct kunit *test, struct rgbw_device *rgbw_dev,
+        const char *name, const char *buf)
+{
+    KUNIT_ASSERT_EQ(test, rgbw_test_write(test, rgbw_dev, name, buf), (ssize_t)strlen(buf));
+}
+
+/* Duty in ns the driver's table gives @brightness at full dimmer */
+static u64 rgbw_test_duty(struct pwm_rgbw_data *pb, unsigned int brightness, unsigned int period)
+{
+    return ((u64)pb->duty_buf[0][brightness] * period) >> 31;
+}
+
+/* White as the gpio-sim line has it now */
+static int rgbw_test_line(struct rgbw_test *t)
+{
+    return gpiod_get_raw_value_cansleep(gpio_to_desc(t->gpio));
+}
+
+static struct rgbw_test_op *rgbw_test_alloc_ops(struct kunit *test)
+{
+    struct rgbw_test_op *ops = kunit_kcalloc(test, RGBW_TEST_MAX_OPS, sizeof(*ops), GFP_KERNEL);
+
+    KUNIT_ASSERT_NOT_NULL(test, ops);
+    return ops;
+}
+
+static void rgbw_test_values(struct kunit *test)
+{
+    struct rgbw_device *rgbw_dev = rgbw_test_strip(test, RGBW_TEST_IDENTITY);
+    struct pwm_rgbw_data *pb = rgbw_get_data(rgbw_dev);
+    struct rgbw_test_op *ops = rgbw_test_alloc_ops(test);
+
+    /* red and blue come on with one state each, green stays off */
+    rgbw_test_store(test, rgbw_dev, "RGBW_values", "#80004000\n");
+    KUNIT_ASSERT_EQ(test, rgbw_test_ops(test, RGBW_TEST_PWM, COLOR_RED, ops), 1U);
+    KUNIT_EXPECT_TRUE(test, ops[0].state.enabled);
+    KUNIT_EXPECT_EQ(test, ops[0].state.period, (u64)RGBW_DEFAULT_PERIOD_NS);
+    KUNIT_EXPECT_EQ(test, ops[0].state.duty_cycle, rgbw_test_duty(pb, 0x80, RGBW_DEFAULT_PERIOD_NS));
+    KUNIT_EXPECT_EQ(test, ops[0].state.polarity, PWM_POLARITY_NORMAL);
+    /* the identity curve is linear to within a step */
+    KUNIT_EXPECT_LE(test, abs((int)ops[0].state.duty_cycle - (int)(0x80ULL * RGBW_DEFAULT_PERIOD_NS / 255)),
+                    RGBW_DEFAULT_PERIOD_NS / 255);
+    KUNIT_ASSERT_EQ(test, rgbw_test_ops(test, RGBW_TEST_PWM, COLOR_BLUE, ops), 1U);
+    KUNIT_EXPECT_TRUE(test, ops[0].state.enabled);
+    KUNIT_EXPECT_EQ(test, ops[0].state.duty_cycle, rgbw_test_duty(pb, 0x40, RGBW_DEFAULT_PERIOD_NS));
+    KUNIT_EXPECT_EQ(test, rgbw_test_ops(test, RGBW_TEST_PWM, COLOR_GREEN, ops), 0U);
+
+    /* red off is a disable, blue moves its duty cycle */
+    rgbw_test_clear(test->priv);
+    rgbw_test_store(test, rgbw_dev, "RGBW_values", "#00002000\n");
+    KUNIT_ASSERT_EQ(test, rgbw_test_ops(test, RGBW_TEST_PWM, COLOR_RED, ops), 1U);
+    KUNIT_EXPECT_FALSE(test, ops[0].state.enabled);
+    KUNIT_ASSERT_EQ(test, rgbw_test_ops(test, RGBW_TEST_PWM, COLOR_BLUE, ops), 1U);
+    KUNIT_EXPECT_TRUE(test, ops[0].state.enabled);
+    KUNIT_EXPECT_EQ(test, ops[0].state.duty_cycle, rgbw_test_duty(pb, 0x20, RGBW_DEFAULT_PERIOD_NS));
+
+    /* full on is the whole period */
+    rgbw_test_clear(test->priv);
+    rgbw_test_store(test, rgbw_dev, "green_value", "255\n");
+    KUNIT_ASSERT_EQ(test, rgbw_test_ops(test, RGBW_TEST_PWM, COLOR_GREEN, ops), 1U);
+    KUNIT_EXPECT_TRUE(test, ops[0].state.enabled);
+    KUNIT_EXPECT_EQ(test, ops[0].state.duty_cycle, (u64)RGBW_DEFAULT_PERIOD_NS);
+}
+
+static void rgbw_test_period(struct kunit *test)
+{
+    struct rgbw_device *rgbw_dev = rgbw_test_strip(test, RGBW_TEST_IDENTITY);
+    struct pwm_rgbw_data *pb = rgbw_get_data(rgbw_dev);
+    struct rgbw_test_op *ops = rgbw_test_alloc_ops(test);
+
+    rgbw_test_store(test, rgbw_dev, "pwm_period", "red 1000000\n");
+    rgbw_test_clear(test->priv);
+    rgbw_test_store(test, rgbw_dev, "RGBW_values", "#40400000\n");
+
+    KUNIT_ASSERT_EQ(test, rgbw_test_ops(test, RGBW_TEST_PWM, COLOR_RED, ops), 1U);
+    KUNIT_EXPECT_EQ(test, ops[0].state.period, 1000000ULL);
+    KUNIT_EXPECT_EQ(test, ops[0].state.duty_cycle, rgbw_test_duty(pb, 0x40, 1000000));
+
+    /* the other colors keep the default */
+    KUNIT_ASSERT_EQ(test, rgbw_test_ops(test, RGBW_TEST_PWM, COLOR_GREEN, ops), 1U);
+    KUNIT_EXPECT_EQ(test, ops[0].state.period, (u64)RGBW_DEFAULT_PERIOD_NS);
+}
+
+/* A period one color refuses changes none of them */
+static void rgbw_test_period_refused(struct kunit *test)
+{
+    struct rgbw_device *rgbw_dev = rgbw_test_strip(test, RGBW_TEST_IDENTITY);
+    struct rgbw_test_op *ops = rgbw_test_alloc_ops(test);
+    unsigned int before[MAX_COLORS];
+    int cntr;
+
+    for (cntr = COLOR_RED; cntr < MAX_COLORS; cntr++) {
+        before[cntr] = rgbw_dev->props[cntr].period;
+    }
+
+    /* fine for the pwms, too fast for white's soft pwm */
+    KUNIT_EXPECT_EQ(test, rgbw_test_write(test, rgbw_dev, "pwm_period", "20000\n"), (ssize_t)-EINVAL);
+    for (cntr = COLOR_RED; cntr < MAX_COLORS; cntr++) {
+        KUNIT_EXPECT_EQ(test, rgbw_dev->props[cntr].period, before[cntr]);
+    }
+
+    rgbw_test_store(test, rgbw_dev, "RGBW_values", "#40000000\n");
+    KUNIT_ASSERT_EQ(test, rgbw_test_ops(test, RGBW_TEST_PWM, COLOR_RED, ops), 1U);
+    KUNIT_EXPECT_EQ(test, ops[0].state.period, (u64)RGBW_DEFAULT_PERIOD_NS);
+}
+
+static void rgbw_test_dimmer(struct kunit *test)
+{
+    struct rgbw_device *rgbw_dev = rgbw_test_strip(test, RGBW_TEST_IDENTITY);
+    struct rgbw_test_op *ops = rgbw_test_alloc_ops(test);
+    u64 half = div_u64((u64)RGBW_DEFAULT_PERIOD_NS * 32768, RGBW_DIM_FULL);
+
+    rgbw_test_store(test, rgbw_dev, "RGBW_values", "#ff000000\n");
+    rgbw_test_clear(test->priv);
+    rgbw_test_store(test, rgbw_dev, "dimmer", "32768\n");
+
+    /* the dimmer scales the duty cycle, the pwm stays enabled */
+    KUNIT_ASSERT_EQ(test, rgbw_test_ops(test, RGBW_TEST_PWM, COLOR_RED, ops), 1U);
+    KUNIT_EXPECT_TRUE(test, ops[0].state.enabled);
+    KUNIT_EXPECT_LE(test, abs((int)ops[0].state.duty_cycle - (int)half), 1);
+}
+
+/* Blink toggles from its timer, never sooner than BLINK_STATE_PER_MS */
+static void rgbw_test_blink(struct kunit *test)
+{
+    struct rgbw_device *rgbw_dev = rgbw_test_strip(test, RGBW_TEST_IDENTITY);
+    struct rgbw_test_op *ops = rgbw_test_alloc_ops(test);
+    unsigned int n, cntr;
+
+    rgbw_test_store(test, rgbw_dev, "RGBW_values", "#ff000000\n");
+    rgbw_test_clear(test->priv);
+    rgbw_test_store(test, rgbw_dev, "blink", "1\n");
+    rgbw_test_wait(test, RGBW_TEST_PWM, COLOR_RED, 3);
+
+    /*
+     * Off first, then on and off again. Each toggle is recorded before
+     * the callback re-arms the timer, so the next one cannot run until
+     * a whole blink state of jiffies later.
+     */
+    n = rgbw_test_ops(test, RGBW_TEST_PWM, COLOR_RED, ops);
+    for (cntr = 0; cntr < 3; cntr++) {
+        KUNIT_EXPECT_EQ(test, ops[cntr].state.enabled, cntr == 1);
+        if (cntr)
+            KUNIT_EXPECT_GE(test, ops[cntr].jiffies - ops[cntr - 1].jiffies,
+                            msecs_to_jiffies(BLINK_STATE_PER_MS));
+    }
+
+    /* stopping restores the level blink started from */
+    rgbw_test_store(test, rgbw_dev, "blink", "0\n");
+    n = rgbw_test_ops(test, RGBW_TEST_PWM, COLOR_RED, ops);
+    KUNIT_EXPECT_EQ(test, rgbw_dev->props[COLOR_RED].brightness, 255);
+    KUNIT_EXPECT_TRUE(test, ops[n - 1].state.enabled);
+}
+
+/* Fully on and fully off are a single pin write, with no hrtimer running */
+static void rgbw_test_soft_static(struct kunit *test)
+{
+    struct rgbw_device *rgbw_dev = rgbw_test_strip(test, RGBW_TEST_IDENTITY);
+    struct pwm_rgbw_data *pb = rgbw_get_data(rgbw_dev);
+    struct soft_pwm_device *spwm = &pb->soft_pwm[COLOR_WHITE];
+    struct rgbw_test_op *ops = rgbw_test_alloc_ops(test);
+    struct rgbw_test *t = test->priv;
+    unsigned int n;
+
+    rgbw_test_store(test, rgbw_dev, "white_value", "255\n");
+    flush_work(&spwm->pin_work);
+    KUNIT_ASSERT_EQ(test, rgbw_test_ops(test, RGBW_TEST_EDGE, COLOR_WHITE, ops), 1U);
+    KUNIT_EXPECT_EQ(test, ops[0].value, 1);
+    KUNIT_EXPECT_EQ(test, ops[0].expires, 0);
+    KUNIT_EXPECT_FALSE(test, hrtimer_active(&spwm->pwm_timer));
+    n = rgbw_test_ops(test, RGBW_TEST_PIN, COLOR_WHITE, ops);
+    KUNIT_ASSERT_EQ(test, n, 1U);
+    KUNIT_EXPECT_EQ(test, ops[0].value, 1);
+    KUNIT_EXPECT_EQ(test, rgbw_test_line(t), 1);
+
+    rgbw_test_clear(t);
+    rgbw_test_store(test, rgbw_dev, "white_value", "0\n");
+    flush_work(&spwm->pin_work);
+    KUNIT_ASSERT_EQ(test, rgbw_test_ops(test, RGBW_TEST_EDGE, COLOR_WHITE, ops), 1U);
+    KUNIT_EXPECT_EQ(test, ops[0].value, 0);
+    KUNIT_EXPECT_FALSE(test, hrtimer_active(&spwm->pwm_timer));
+    KUNIT_ASSERT_EQ(test, rgbw_test_ops(test, RGBW_TEST_PIN, COLOR_WHITE, ops), 1U);
+    KUNIT_EXPECT_EQ(test, ops[0].value, 0);
+    KUNIT_EXPECT_EQ(test, rgbw_test_line(t), 0);
+}
+
+/*
+ * White at half brightness on a 2ms soft pwm. A high phase lasts the
+ * on time the duty table gives, a low one the rest of the period. An
+ * edge may run late, then hrtimer_forward() skips ahead by whole phases,
+ * so the hrtimer expiries of consecutive edges are always a whole
+ * number of phases apart and an edge never runs before it is due.
+ */
+static void rgbw_test_soft_edges(struct kunit *test, enum rgbw_test_strip strip)
+{
+    struct rgbw_device *rgbw_dev = rgbw_test_strip(test, strip);
+    struct pwm_rgbw_data *pb = rgbw_get_data(rgbw_dev);
+    struct soft_pwm_device *spwm = &pb->soft_pwm[COLOR_WHITE];
+    struct rgbw_test_op *ops = rgbw_test_alloc_ops(test);
+    struct rgbw_test *t = test->priv;
+    const unsigned int period = 2000000;
+    unsigned int n, cntr;
+    u64 on_time, phase, span, rem;
+
+    on_time = rgbw_test_duty(pb, 128, period);
+    KUNIT_ASSERT_GT(test, on_time, 0ULL);
+    KUNIT_ASSERT_LT(test, on_time, (u64)period);
+
+    rgbw_test_store(test, rgbw_dev, "pwm_period", "soft 2000000\n");
+    rgbw_test_clear(t);
+    rgbw_test_store(test, rgbw_dev, "white_value", "128\n");
+    rgbw_test_wait(test, RGBW_TEST_EDGE, COLOR_WHITE, RGBW_TEST_EDGES);
+    rgbw_test_store(test, rgbw_dev, "white_value", "0\n");
+    KUNIT_EXPECT_FALSE(test, hrtimer_active(&spwm->pwm_timer));
+    flush_work(&spwm->pin_work);
+
+    n = rgbw_test_ops(test, RGBW_TEST_EDGE, COLOR_WHITE, ops);
+    for (cntr = 0; cntr < n && ops[cntr].expires; cntr++) {
+        KUNIT_EXPECT_GE(test, ktime_compare(ops[cntr].time, ops[cntr].expires), 0);
+        if (!cntr) {
+            KUNIT_EXPECT_EQ(test, ops[cntr].value, 1);
+            continue;
+        }
+        KUNIT_EXPECT_NE(test, ops[cntr].value, ops[cntr - 1].value);
+        phase = ops[cntr - 1].value ? on_time : period - on_time;
+        span = ktime_to_ns(ktime_sub(ops[cntr].expires, ops[cntr - 1].expires));
+        KUNIT_EXPECT_GE(test, span, phase);
+        div64_u64_rem(span, phase, &rem);
+        KUNIT_EXPECT_EQ_MSG(test, rem, 0ULL, "edge %u, %llu ns after the last one, phase %llu ns",
+                            cntr, span, phase);
+    }
+    KUNIT_EXPECT_GE(test, cntr, (unsigned int)RGBW_TEST_EDGES);
+
+    /* the line only ever saw alternating values, and ends low */
+    n = rgbw_test_ops(test, RGBW_TEST_PIN, COLOR_WHITE, ops);
+    KUNIT_ASSERT_GE(test, n, 2U);
+    KUNIT_EXPECT_EQ(test, ops[0].value, 1);
+    for (cntr = 1; cntr < n; cntr++)
+        KUNIT_EXPECT_NE(test, ops[cntr].value, ops[cntr - 1].value);
+    KUNIT_EXPECT_EQ(test, ops[n - 1].value, 0);
+    KUNIT_EXPECT_EQ(test, rgbw_test_line(t), 0);
+}
+
+static void rgbw_test_soft_pwm(struct kunit *test)
+{
+    rgbw_test_soft_edges(test, RGBW_TEST_IDENTITY);
+}
+
+/* Soft on times come from the duty table whatever brightness-levels end at */
+static void rgbw_test_soft_levels_high(struct kunit *test)
+{
+    rgbw_test_soft_edges(test, RGBW_TEST_HIGH);
+}
+
+static void rgbw_test_soft_levels_low(struct kunit *test)
+{
+    rgbw_test_soft_edges(test, RGBW_TEST_LOW);
+}
+
+/* Each cooling state caps the output at its cooling-levels percentage */
+static void rgbw_test_cooling(struct kunit *test)
+{
+#if IS_REACHABLE(CONFIG_THERMAL)
+    struct rgbw_device *rgbw_dev = rgbw_test_strip(test, RGBW_TEST_IDENTITY);
+    struct pwm_rgbw_data *pb = rgbw_get_data(rgbw_dev);
+    struct rgbw_test_op *ops = rgbw_test_alloc_ops(test);
+    struct thermal_cooling_device *cdev = rgbw_dev->thermal.cdev;
+    unsigned long state;
+
+    KUNIT_ASSERT_NOT_NULL(test, cdev);
+    KUNIT_ASSERT_EQ(test, cdev->ops->get_max_state(cdev, &state), 0);
+    KUNIT_EXPECT_EQ(test, state, 2UL);
+    rgbw_test_store(test, rgbw_dev, "RGBW_values", "#80000000\n");
+
+    /* 50% */
+    rgbw_test_clear(test->priv);
+    KUNIT_ASSERT_EQ(test, cdev->ops->set_cur_state(cdev, 1), 0);
+    KUNIT_EXPECT_EQ(test, rgbw_get_output(rgbw_dev, COLOR_RED), 0x40U << 16);
+    KUNIT_ASSERT_EQ(test, rgbw_test_ops(test, RGBW_TEST_PWM, COLOR_RED, ops), 1U);
+    KUNIT_EXPECT_TRUE(test, ops[0].state.enabled);
+    KUNIT_EXPECT_EQ(test, ops[0].state.duty_cycle, rgbw_test_duty(pb, 0x40, RGBW_DEFAULT_PERIOD_NS));
+    /* what was asked for is kept underneath */
+    KUNIT_EXPECT_EQ(test, rgbw_dev->props[COLOR_RED].brightness, 0x80);
+
+    /* 0% turns the channel off */
+    rgbw_test_clear(test->priv);
+    KUNIT_ASSERT_EQ(test, cdev->ops->set_cur_state(cdev, 2), 0);
+    KUNIT_ASSERT_EQ(test, rgbw_test_ops(test, RGBW_TEST_PWM, COLOR_RED, ops), 1U);
+    KUNIT_EXPECT_FALSE(test, ops[0].state.enabled);
+
+    /* cooled down, full output again */
+    rgbw_test_clear(test->priv);
+    KUNIT_ASSERT_EQ(test, cdev->ops->set_cur_state(cdev, 0), 0);
+    KUNIT_ASSERT_EQ(test, rgbw_test_ops(test, RGBW_TEST_PWM, COLOR_RED, ops), 1U);
+    KUNIT_EXPECT_TRUE(test, ops[0].state.enabled);
+    KUNIT_EXPECT_EQ(test, ops[0].state.duty_cycle, rgbw_test_duty(pb, 0x80, RGBW_DEFAULT_PERIOD_NS));
+
+    KUNIT_EXPECT_EQ(test, cdev->ops->set_cur_state(cdev, 3), -EINVAL);
+#else
+    kunit_skip(test, "built without the thermal framework");
+#endif
+}
+
+/* A color LED mapped to red and green drives both from its brightness */
+static void rgbw_test_led_channels(struct kunit *test)
+{
+#if IS_REACHABLE(CONFIG_LEDS_CLASS)
+    struct rgbw_device *rgbw_dev = rgbw_test_strip(test, RGBW_TEST_IDENTITY);
+    struct rgbw_led *led = &rgbw_dev->led[COLOR_RED];
+    struct device_attribute *dattr;
+    const char *amber = "255 255 0 0\n";
+    const char *clear = "0 128 0 0\n";
+
+    KUNIT_ASSERT_FALSE(test, IS_ERR_OR_NULL(led->cdev.dev));
+    KUNIT_ASSERT_NOT_NULL(test, led->cdev.groups);
+    dattr = container_of(led->cdev.groups[0]->attrs[0], struct device_attribute, attr);
+    KUNIT_ASSERT_STREQ(test, dattr->attr.name, "channels");
+
+    KUNIT_EXPECT_EQ(test, dattr->store(led->cdev.dev, dattr, amber, strlen(amber)),
+                    (ssize_t)strlen(amber));
+    led_set_brightness(&led->cdev, 0x80);
+    flush_delayed_work(&rgbw_dev->led_work);
+    KUNIT_EXPECT_EQ(test, rgbw_dev->props[COLOR_RED].brightness, 0x80);
+    KUNIT_EXPECT_EQ(test, rgbw_dev->props[COLOR_GREEN].brightness, 0x80);
+    KUNIT_EXPECT_EQ(test, rgbw_dev->props[COLOR_BLUE].brightness, 0);
+
+    /* dropping red from the map turns it off, green follows its weight */
+    KUNIT_EXPECT_EQ(test, dattr->store(led->cdev.dev, dattr, clear, strlen(clear)),
+                    (ssize_t)strlen(clear));
+    flush_delayed_work(&rgbw_dev->led_work);
+    KUNIT_EXPECT_EQ(test, rgbw_dev->props[COLOR_RED].brightness, 0);
+    KUNIT_EXPECT_EQ(test, rgbw_dev->props[COLOR_GREEN].brightness, 0x40);
+
+    /* no weight above full scale */
+    KUNIT_EXPECT_EQ(test, dattr->store(led->cdev.dev, dattr, "256 0 0 0", 9), (ssize_t)-EINVAL);
+#else
+    kunit_skip(test, "built without the LED class");
+#endif
+}
+
+/* The strip's multicolor LED sets each channel from brightness and its intensity */
+static void rgbw_test_multicolor(struct kunit *test)
+{
+#if RGBW_LED_MULTICOLOR
+    struct rgbw_device *rgbw_dev = rgbw_test_strip(test, RGBW_TEST_IDENTITY);
+    struct pwm_rgbw_data *pb = rgbw_get_data(rgbw_dev);
+    struct rgbw_test_op *ops = rgbw_test_alloc_ops(test);
+    struct led_classdev_mc *mc = &rgbw_dev->mc;
+    static const unsigned int intensity[MAX_COLORS] = {
+        [COLOR_RED]     = 255,
+        [COLOR_BLUE]    = 0x80,
+    };
+    unsigned int cntr;
+
+    KUNIT_ASSERT_FALSE(test, IS_ERR_OR_NULL(mc->led_cdev.dev));
+    KUNIT_ASSERT_EQ(test, mc->num_colors, (unsigned int)MAX_COLORS);
+    for (cntr = 0; cntr < mc->num_colors; cntr++) {
+        mc->subled_info[cntr].intensity = intensity[mc->subled_info[cntr].channel];
+    }
+    led_set_brightness(&mc->led_cdev, 255);
+    flush_delayed_work(&rgbw_dev->led_work);
+
+    KUNIT_EXPECT_EQ(test, rgbw_dev->props[COLOR_RED].brightness, 255);
+    KUNIT_EXPECT_EQ(test, rgbw_dev->props[COLOR_BLUE].brightness, 0x80);
+    KUNIT_ASSERT_EQ(test, rgbw_test_ops(test, RGBW_TEST_PWM, COLOR_RED, ops), 1U);
+    KUNIT_EXPECT_EQ(test, ops[0].state.duty_cycle, (u64)RGBW_DEFAULT_PERIOD_NS);
+    KUNIT_ASSERT_EQ(test, rgbw_test_ops(test, RGBW_TEST_PWM, COLOR_BLUE, ops), 1U);
+    KUNIT_EXPECT_EQ(test, ops[0].state.duty_cycle, rgbw_test_duty(pb, 0x80, RGBW_DEFAULT_PERIOD_NS));
+    KUNIT_EXPECT_EQ(test, rgbw_test_ops(test, RGBW_TEST_PWM, COLOR_GREEN, ops), 0U);
+
+    /* half brightness halves every channel */
+    rgbw_test_clear(test->priv);
+    led_set_brightness(&mc->led_cdev, 0x80);
+    flush_delayed_work(&rgbw_dev->led_work);
+    KUNIT_EXPECT_EQ(test, rgbw_dev->props[COLOR_RED].brightness, 0x80);
+    KUNIT_EXPECT_EQ(test, rgbw_dev->props[COLOR_BLUE].brightness, 0x40);
+#else
+    kunit_skip(test, "built without the multicolor LED class");
+#endif
+}
+
+/*
+ * Runs once remove is done and before devres frees pb: whatever is
+ * still armed here would go on to touch freed memory or the hardware.
+ */
+static void rgbw_test_teardown(void *data)
+{
+    struct rgbw_test *t = data;
+    struct pwm_rgbw_data *pb = t->pb;
+    int cntr;
+
+    WRITE_ONCE(t->dev, NULL);
+    for (cntr = TIMER_PULSE; cntr < MAX_RGBWTIMER; cntr++) {
+        if (timer_pending(&t->rgbw_dev->rgbw_timer[cntr]))
+            t->busy |= RGBW_TEST_BUSY_TIMER;
+    }
+    for (cntr = COLOR_RED; cntr < MAX_COLORS; cntr++) {
+        if (pb->types[cntr] != RGBW_GPIO)
+            continue;
+        if (hrtimer_active(&pb->soft_pwm[cntr].pwm_timer))
+            t->busy |= RGBW_TEST_BUSY_HRTIMER;
+        if (work_pending(&pb->soft_pwm[cntr].pin_work))
+            t->busy |= RGBW_TEST_BUSY_PIN;
+    }
+    if (delayed_work_pending(&pb->gov_work))
+        t->busy |= RGBW_TEST_BUSY_GOV;
+    if (pb->rgbw_dev)
+        t->busy |= RGBW_TEST_BUSY_DEV;
+    t->torn_down = true;
+}
+
+/* Unbinding with an effect and a soft pwm running leaves nothing behind */
+static void rgbw_test_unregister(struct kunit *test)
+{
+    struct rgbw_device *rgbw_dev = rgbw_test_strip(test, RGBW_TEST_IDENTITY);
+    struct rgbw_test_op *ops = rgbw_test_alloc_ops(test);
+    struct rgbw_test *t = test->priv;
+    unsigned int n;
+
+    rgbw_test_store(test, rgbw_dev, "pwm_period", "soft 1000000\n");
+    rgbw_test_store(test, rgbw_dev, "RGBW_values", "#80000080\n");
+    rgbw_test_wait(test, RGBW_TEST_EDGE, COLOR_WHITE, 4);
+    rgbw_test_store(test, rgbw_dev, "blink", "1\n");
+
+    /* the effect timers live in the class device, keep it for the check */
+    get_device(&rgbw_dev->dev);
+    KUNIT_ASSERT_EQ(test, kunit_add_action_or_reset(test, rgbw_test_put_device, &rgbw_dev->dev), 0);
+    KUNIT_ASSERT_EQ(test, devm_add_action(&t->pdev->dev, rgbw_test_teardown, t), 0);
+    device_release_driver(&t->pdev->dev);
+
+    KUNIT_ASSERT_TRUE(test, t->torn_down);
+    KUNIT_EXPECT_EQ(test, t->busy, 0U);
+
+    /* and it left the strip dark */
+    n = rgbw_test_ops(test, RGBW_TEST_PWM, COLOR_RED, ops);
+    KUNIT_ASSERT_GE(test, n, 1U);
+    KUNIT_EXPECT_FALSE(test, ops[n - 1].state.enabled);
+    n = rgbw_test_ops(test, RGBW_TEST_PIN, COLOR_WHITE, ops);
+    KUNIT_ASSERT_GE(test, n, 1U);
+    KUNIT_EXPECT_EQ(test, ops[n - 1].value, 0);
+}
+
+static int rgbw_test_init(struct kunit *test)
+{
+    struct rgbw_test *t;
+    int ret;
+
+    t = kunit_kzalloc(test, sizeof(*t), GFP_KERNEL);
+    if (!t)
+        return -ENOMEM;
+    spin_lock_init(&t->lock);
+    init_waitqueue_head(&t->wait);
+
+    ret = register_trace_rgbw_gpio_set(rgbw_test_edge, t);
+    if (ret)
+        return ret;
+    ret = register_trace_gpio_value(rgbw_test_gpio_value, t);
+    if (ret) {
+        unregister_trace_rgbw_gpio_set(rgbw_test_edge, t);
+        tracepoint_synchronize_unregister();
+        return ret;
+    }
+    test->priv = t;
+    WRITE_ONCE(rgbw_test_ctx, t);
+
+    return kunit_platform_driver_register(test, &rgbw_test_pwm_driver);
+}
+
+static void rgbw_test_exit(struct kunit *test)
+{
+    struct rgbw_test *t = test->priv;
+
+    if (!t)
+        return;
+
+    unregister_trace_gpio_value(rgbw_test_gpio_value, t);
+    unregister_trace_rgbw_gpio_set(rgbw_test_edge, t);
+    tracepoint_synchronize_unregister();
+    WRITE_ONCE(rgbw_test_ctx, NULL);
+}
+
+static struct kunit_case rgbw_test_cases[] = {
+    KUNIT_CASE(rgbw_test_values),
+    KUNIT_CASE(rgbw_test_period),
+    KUNIT_CASE(rgbw_test_period_refused),
+    KUNIT_CASE(rgbw_test_dimmer),
+    KUNIT_CASE_SLOW(rgbw_test_blink),
+    KUNIT_CASE(rgbw_test_soft_static),
+    KUNIT_CASE(rgbw_test_soft_pwm),
+    KUNIT_CASE(rgbw_test_soft_levels_high),
+    KUNIT_CASE(rgbw_test_soft_levels_low),
+    KUNIT_CASE(rgbw_test_cooling),
+    KUNIT_CASE(rgbw_test_led_channels),
+    KUNIT_CASE(rgbw_test_multicolor),
+    KUNIT_CASE(rgbw_test_unregister),
+    {}
+};
+
+static struct kunit_suite rgbw_test_suite = {
+    .name       = "leds-rgbw-generic",
+    .init       = rgbw_test_init,
+    .exit       = rgbw_test_exit,
+    .test_cases = rgbw_test_cases,
+};
+kunit_test_suite(rgbw_test_suite);
@@ -41,8 +41,25 @@
 #include <linux/sched.h>
 #include <linux/pwm.h>
 #include <linux/reboot.h>
+#include <linux/panic_notifier.h>
+#include <linux/ktime.h>
+#include <linux/rcupdate.h>
 
-static bool reboot_stop = false;
+#define CREATE_TRACE_POINTS
+#include "rgbw_trace.h"
+
+#define RGBW_DEFAULT_PERIOD_NS      10000000    // 100Hz
+#define RGBW_MIN_PERIOD_NS          1000        // hard pwm, 1MHz
+#define RGBW_MIN_SOFT_PERIOD_NS     50000       // soft pwm, 20kHz of edge irqs at most
+#define RGBW_MAX_PERIOD_NS          1000000000  // 1Hz
+
+/* soft pwm governor, see rgbw_governor_work() */
+#define RGBW_GOV_INTERVAL_MS        1000
+#define RGBW_GOV_LATE_PERMILLE      20          // late edges that count as overrun
+#define RGBW_GOV_BUSY_PERMILLE      50          // cpu share of the soft pwm callbacks
+#define RGBW_GOV_IDLE_WINDOWS       5           // quiet windows before speeding up again
+
+struct pwm_rgbw_data;
 
 /* soft_pwm_device
  *
@@ -52,7 +69,16 @@ static bool reboot_stop = false;
 struct soft_pwm_device {
     unsigned int gpio;          // gpio number
     int value;                  // current GPIO pin value (0 or 1 only)
+    u32 dither;                 // dither error accumulator, see rgbw_soft_pwm_edge()
+    unsigned int period;        // period in ns, latched at each rising edge
+    unsigned int lth;           // one brightness step in ns, latched with period, the governor's lateness limit
     struct hrtimer pwm_timer;   // hrtimer struct for each soft pwm
+    enum rgbw_colors color;     // color this soft pwm drives
+    struct pwm_rgbw_data *pb;   // owning driver data
+    bool can_sleep;             // gpio behind a bus, written from pin_work
+    int pin;                    // last value asked of a sleeping gpio
+    int pin_written;            // last value pin_work wrote
+    struct work_struct pin_work;
 };
 
 /* pwm_rgbw_data
@@ -65,9 +91,29 @@ struct pwm_rgbw_data {
     struct soft_pwm_device  soft_pwm[MAX_COLORS];   // array holding four possible possible soft_pwm_devices in [R,G,B,W] format
     struct device           *dev;                   // parent dev
     enum rgbw_type          types[MAX_COLORS];      // array stating whether each color is soft_pwm OR hard_pwm in [R,G,B,W] format
-    unsigned int            period;                 // period of PWM in ns
-    unsigned int            lth_brightness;         // time period of smallest pwm pulse_width in ns
+    seqlock_t               timing_lock;            // period and lth_brightness change together
+    unsigned int            period[MAX_COLORS];     // period of PWM in ns per color
+    unsigned int            lth_brightness[MAX_COLORS]; // one brightness step in ns per color
+    unsigned int            lth_div;                // max_brightness, lth_brightness = period / lth_div
     unsigned int            *levels;                // array of values
+    unsigned int            max_brightness;         // last entry of levels and duty
+    unsigned int            dimmer;                 // master intensity folded into duty
+    u32 __rcu               *duty;                  // Q31 duty table in use, see rgbw_fold_duty()
+    u32                     *duty_buf[2];           // duty swaps between these on a dimmer change
+    struct rgbw_device      *rgbw_dev;              // class device we drive
+    /* soft pwm governor, only running when gov_max_period is set */
+    struct mutex            gov_lock;               // soft_target and gov_shift
+    unsigned int            soft_target[MAX_COLORS]; // soft period asked for by DT or pwm_period
+    unsigned int            gov_max_period;         // slowest period the governor may pick
+    unsigned int            gov_shift;              // soft periods run at soft_target << gov_shift
+    unsigned int            gov_idle;               // quiet windows seen in a row
+    atomic_t                gov_edges;              // edges in this window
+    atomic_t                gov_late;               // edges later than one brightness step
+    atomic_long_t           gov_busy_ns;            // time spent in the callback
+    struct delayed_work     gov_work;
+    bool                    reboot_stop;            // outputs forced off for reboot/panic
+    struct notifier_block   reboot_nb;              // per device so probes can run in parallel
+    struct notifier_block   panic_nb;
     int                     (*notify)(struct device *, int brightness);
     void                    (*notify_after)(struct device *, int brightness);
     void                    (*exit)(struct device *);
@@ -76,8 +122,21 @@ struct pwm_rgbw_data {
 struct platform_rgbw_data {
     unsigned int max_brightness;
     unsigned int lth_brightness;
-    unsigned int pwm_period_ns;
+    unsigned int pwm_period_ns;                 // hard pwm period, default RGBW_DEFAULT_PERIOD_NS
+    unsigned int soft_pwm_period_ns;            // soft pwm period, default RGBW_DEFAULT_PERIOD_NS
+    unsigned int soft_pwm_max_period_ns;        // enables the soft pwm governor, 0 for off
+    bool has_color_matrix;                      // color_matrix is set
+    s32 color_matrix[MAX_COLORS][MAX_COLORS];   // Q16 output correction, see rgbw_set_correction()
+    bool white_extract;                         // move min(R,G,B) into white
+    unsigned int current_ua[MAX_COLORS];        // draw per color fully on, see rgbw_set_power_limit()
+    unsigned int power_budget_ua;               // budget of this strip, 0 for none
+    unsigned int supply_group;                  // supply shared with other strips, 0 for none
+    unsigned int num_cooling_levels;            // 0 when not a cooling device
+    u32 cooling_levels[RGBW_MAX_COOLING_STATES]; // output ceiling in % per cooling state
     unsigned int *levels;
+    unsigned int default_levels[MAX_COLORS];    // level applied at probe in [R,G,B,W] format
+    unsigned int default_effect;                // RGBW_*_ON effect started at probe, 0 for none
+    int default_pcolor;                         // color for a default pulse
     int (*init)(struct device *dev);
     int (*notify)(struct device *dev, int brightness);
     void (*notify_after)(struct device *dev, int brightness);
@@ -92,42 +151,26 @@ const char *const color_names[] = {
 
 };
 
-/* Values to set our PWM channel every 50ms. These values are calculated 
- * using the Excel VB script:
- * =TRUNC((EXP(SIN(B1 * 3.1415926 / 2)) - (1 / EXP(1)))*(255 / (EXP(1) - (1 / EXP(1)))))
- * which is an adaptation of the natural equation:
- * [e^sin(x * pi/2) - 1/e] * [255/(e - 1/e)] with x in seconds
- * 
- * This "breathing" function gives us set of values between 0 - 255 that
- * are cycled through at a fixed interval. In our case we set the
- * interval to be 50ms. The pi/2 expression lengthens our period which can
- * be decreased or increased by decreasing or increasing this multiplier
- * respectively. Since the Linux kernel cannot perform floating point
- * math we simply create a lookup table instead. For natural feel you
- * must include one FULL period - 1 value i.e. from zero to the value 
- * before the next zero. 
- */
-const unsigned int pulse_val_table[] = {
-    0, 1, 2, 3, 4, 6, 8, 10, 13, 16, 20,
-    24, 28, 34, 39, 45, 52, 60, 68, 77, 
-    86, 97, 107, 119, 130, 143, 155, 167,
-    180, 192, 203, 214, 224, 233, 240, 246, 
-    251, 254, 254, 254, 251, 246, 240, 233,
-    224, 214, 203, 192, 180, 167, 155, 143,
-    130, 119, 107, 97, 86, 77, 68, 60, 52,
-    45, 39, 34, 28, 24, 20, 16, 13, 10, 8,
-    6, 4, 3, 2, 1, 0, 0, 0, 0
+/* DT "default-effect" names and the effect flag/timer each one starts */
+static const struct {
+    const char *name;
+    unsigned int flag;
+    enum timer_type timer;
+} rgbw_default_effects[] = {
+    { "pulse",      RGBW_PULSE_ON,  TIMER_PULSE },
+    { "blink",      RGBW_BLINK_ON,  TIMER_BLINK },
+    { "heartbeat",  RGBW_HB_ON,     TIMER_HEARTBEAT },
+    { "rainbow",    RGBW_RB_ON,     TIMER_RAINBOW },
 };
 
-struct rgbw_device *g_rgbw_dev;
-
 static int rgbw_reboot_notifier(struct notifier_block *nb,
                                      unsigned long code, void *unused)
 {
+	struct pwm_rgbw_data *pb = container_of(nb, struct pwm_rgbw_data, reboot_nb);
 	int cntr;
-	reboot_stop = true;
+	pb->reboot_stop = true;
 	for (cntr = TIMER_PULSE; cntr < MAX_RGBWTIMER; cntr++) {  
-		del_timer_sync(&g_rgbw_dev->rgbw_timer[cntr]);    
+		del_timer_sync(&pb->rgbw_dev->rgbw_timer[cntr]);    
     }
     return NOTIFY_DONE;
 }
@@ -135,49 +178,343 @@ static int rgbw_reboot_notifier(struct notifier_block *nb,
 static int rgbw_panic_notifier(struct notifier_block *nb,
                                     unsigned long code, void *unused)
 {	
-	reboot_stop = true;
+	struct pwm_rgbw_data *pb = container_of(nb, struct pwm_rgbw_data, panic_nb);
+	pb->reboot_stop = true;
     return NOTIFY_DONE;
 }
- 
-static struct notifier_block rgbw_reboot_nb = {
-        .notifier_call = rgbw_reboot_notifier,
-};
 
-static struct notifier_block rgbw_panic_nb = {
-        .notifier_call = rgbw_panic_notifier,
-};
+/* 
+ * Every hardware write goes through these so each one shows up as an
+ * rgbw trace event with its timestamp and in the class' hw_writes stat.
+ * pb->rgbw_dev is cleared on remove once nothing can call these anymore.
+ */
+static inline void rgbw_hw_count(struct pwm_rgbw_data *pb)
+{
+    if (pb->rgbw_dev)
+        rgbw_count_hw_write(pb->rgbw_dev);
+}
+
+/* 
+ * Effects and the soft pwm step from timer context, a controller that
+ * can be written from there is.
+ */
+static int rgbw_pwm_apply(struct pwm_device *pwm, const struct pwm_state *state)
+{
+    if (!pwm_might_sleep(pwm))
+        return pwm_apply_atomic(pwm, state);
+    return pwm_apply_might_sleep(pwm, state);
+}
+
+/* Period, duty cycle and enable go out as one state, with the DT polarity */
+static void rgbw_hw_pwm_config(struct pwm_rgbw_data *pb, int color, int duty_cycle,
+        unsigned int period)
+{
+    struct pwm_state state;
+
+    trace_rgbw_pwm_config(pb->dev, color, duty_cycle, period);
+    trace_rgbw_pwm_enable(pb->dev, color, 1);
+    pwm_init_state(pb->pwm[color], &state);
+    state.period = period;
+    state.duty_cycle = duty_cycle;
+    state.enabled = true;
+    rgbw_pwm_apply(pb->pwm[color], &state);
+    rgbw_hw_count(pb);
+}
+
+static void rgbw_get_timing(struct pwm_rgbw_data *pb, int color,
+        unsigned int *period, unsigned int *lth)
+{
+    unsigned int seq;
+
+    do {
+        seq = read_seqbegin(&pb->timing_lock);
+        *period = pb->period[color];
+        *lth = pb->lth_brightness[color];
+    } while (read_seqretry(&pb->timing_lock, seq));
+}
+
+/* 
+ * On times come from the duty table for hard and soft pwms alike, the
+ * step length is only kept as a measure of how late a soft edge may be.
+ */
+static void rgbw_set_timing(struct pwm_rgbw_data *pb, int color, unsigned int period)
+{
+    unsigned long flags;
+    unsigned int lth = period / pb->lth_div;
+
+    write_seqlock_irqsave(&pb->timing_lock, flags);
+    pb->period[color] = period;
+    pb->lth_brightness[color] = lth;
+    write_sequnlock_irqrestore(&pb->timing_lock, flags);
+}
+
+/* Level at which a soft pwm color is held on, out of reach while dimmed */
+static inline unsigned int rgbw_soft_full(struct rgbw_device *rgbw_dev,
+        struct pwm_rgbw_data *pb, int color)
+{
+    return rgbw_dev->props[color].max_brightness + (READ_ONCE(pb->dimmer) < RGBW_DIM_FULL);
+}
+
+static int rgbw_check_period(struct pwm_rgbw_data *pb, int color, unsigned int period)
+{
+    unsigned int min;
+
+    if (pb->types[color] == RGBW_PWM)
+        min = RGBW_MIN_PERIOD_NS;
+    else if (pb->types[color] == RGBW_GPIO)
+        min = RGBW_MIN_SOFT_PERIOD_NS;
+    else
+        return -ENODEV;
+
+    /* every brightness step needs at least 1ns of on time */
+    if (period < min || period > RGBW_MAX_PERIOD_NS || period < pb->lth_div)
+        return -EINVAL;
+    return 0;
+}
+
+/* 
+ * Soft pwm period the governor wants for color right now: the target
+ * slowed down by gov_shift, but never past gov_max_period unless the
+ * target itself is slower. Called with gov_lock held.
+ */
+static unsigned int rgbw_governed_period(struct pwm_rgbw_data *pb, int color)
+{
+    u64 period = (u64)pb->soft_target[color] << pb->gov_shift;
+
+    if (period > pb->gov_max_period)
+        period = max(pb->gov_max_period, pb->soft_target[color]);
+    return period;
+}
+
+/* 
+ * Hard pwms take the new period with the next rgbw_hw_pwm_config(), which the
+ * controller latches at its period end. Soft pwms pick it up at their
+ * next rising edge.
+ */
+static int rgbw_check_color_period(struct rgbw_device *rgbw_dev, int color, unsigned int period)
+{
+    return rgbw_check_period(rgbw_get_data(rgbw_dev), color, period);
+}
+
+static int rgbw_set_period(struct rgbw_device *rgbw_dev, int color, unsigned int period)
+{
+    struct pwm_rgbw_data *pb = rgbw_get_data(rgbw_dev);
+    int ret;
+
+    ret = rgbw_check_period(pb, color, period);
+    if (ret)
+        return ret;
+
+    /* 
+     * Under gov_lock, or the governor could apply a period worked out
+     * from the old target after ours and undo it.
+     */
+    if (pb->types[color] == RGBW_GPIO && pb->gov_max_period) {
+        mutex_lock(&pb->gov_lock);
+        pb->soft_target[color] = period;
+        rgbw_set_timing(pb, color, rgbw_governed_period(pb, color));
+        mutex_unlock(&pb->gov_lock);
+    }
+    else {
+        rgbw_set_timing(pb, color, period);
+    }
+
+    return 0;
+}
+
+/* 
+ * Once per RGBW_GOV_INTERVAL_MS look at how the soft pwm edges of the
+ * last window went. Too many edges landing more than one brightness
+ * step late, or the callbacks eating more than their cpu share, halve
+ * the soft pwm frequency. After RGBW_GOV_IDLE_WINDOWS quiet windows in
+ * a row it is doubled again, back up to the configured period.
+ */
+static void rgbw_governor_work(struct work_struct *work)
+{
+    struct pwm_rgbw_data *pb = container_of(to_delayed_work(work),
+                                            struct pwm_rgbw_data, gov_work);
+    unsigned int edges = atomic_xchg(&pb->gov_edges, 0);
+    unsigned int late = atomic_xchg(&pb->gov_late, 0);
+    unsigned long busy = atomic_long_xchg(&pb->gov_busy_ns, 0);
+    u64 busy_limit = (u64)RGBW_GOV_INTERVAL_MS * NSEC_PER_MSEC / 1000 * RGBW_GOV_BUSY_PERMILLE;
+    unsigned int shift;
+    unsigned int period;
+    bool slowest = true;
+    int cntr;
+
+    mutex_lock(&pb->gov_lock);
+    shift = pb->gov_shift;
+    for (cntr = COLOR_RED; cntr < MAX_COLORS; cntr++) {
+        if (pb->types[cntr] == RGBW_GPIO && rgbw_governed_period(pb, cntr) < pb->gov_max_period)
+            slowest = false;
+    }
+
+    if ((u64)late * 1000 > (u64)edges * RGBW_GOV_LATE_PERMILLE || busy > busy_limit) {
+        pb->gov_idle = 0;
+        if (!slowest)
+            pb->gov_shift++;
+    }
+    else if (pb->gov_shift && ++pb->gov_idle >= RGBW_GOV_IDLE_WINDOWS) {
+        /* half the load limits so the two directions do not fight */
+        if ((u64)late * 2000 <= (u64)edges * RGBW_GOV_LATE_PERMILLE && busy * 2 <= busy_limit)
+            pb->gov_shift--;
+        pb->gov_idle = 0;
+    }
+
+    if (shift != pb->gov_shift) {
+        for (cntr = COLOR_RED; cntr < MAX_COLORS; cntr++) {
+            if (pb->types[cntr] != RGBW_GPIO)
+                continue;
+            period = rgbw_governed_period(pb, cntr);
+            rgbw_set_timing(pb, cntr, period);
+            trace_rgbw_soft_governor(pb->dev, cntr, period, edges, late, busy);
+        }
+        dev_dbg(pb->dev, "soft pwm slowed by %u, %u of %u edges late, %lu ns busy\n",
+                1 << pb->gov_shift, late, edges, busy);
+    }
+    mutex_unlock(&pb->gov_lock);
+
+    schedule_delayed_work(&pb->gov_work, msecs_to_jiffies(RGBW_GOV_INTERVAL_MS));
+}
+
+/* 
+ * Build the new duty table aside and swap it in, so an update or soft
+ * pwm edge in flight keeps reading a whole table, then wait for those
+ * before the old one can be rebuilt by the next call.
+ */
+static int rgbw_set_dimmer(struct rgbw_device *rgbw_dev, unsigned int level)
+{
+    struct pwm_rgbw_data *pb = rgbw_get_data(rgbw_dev);
+    u32 *duty = rcu_dereference_protected(pb->duty, lockdep_is_held(&rgbw_dev->ops_lock));
+
+    duty = (duty == pb->duty_buf[0]) ? pb->duty_buf[1] : pb->duty_buf[0];
+    rgbw_fold_duty(pb->levels, pb->max_brightness, level, duty);
+    rcu_assign_pointer(pb->duty, duty);
+    WRITE_ONCE(pb->dimmer, level);
+
+    synchronize_rcu();
+    return 0;
+}
+
+static void rgbw_hw_pwm_disable(struct pwm_rgbw_data *pb, int color)
+{
+    struct pwm_state state;
+
+    trace_rgbw_pwm_enable(pb->dev, color, 0);
+    pwm_get_state(pb->pwm[color], &state);
+    state.enabled = false;
+    rgbw_pwm_apply(pb->pwm[color], &state);
+    rgbw_hw_count(pb);
+}
+
+/* 
+ * A gpio that can sleep cannot be written from the soft pwm hrtimer or
+ * the effect timers, its writes go through pin_work instead. Only the
+ * last value counts there: edges closer together than the bus can take
+ * are dropped rather than queued up.
+ */
+static void rgbw_gpio_pin_work(struct work_struct *work)
+{
+    struct soft_pwm_device *spwm = container_of(work, struct soft_pwm_device, pin_work);
+    int value = READ_ONCE(spwm->pin);
+
+    if (value == spwm->pin_written)
+        return;
+    gpio_set_value_cansleep(spwm->gpio, value);
+    spwm->pin_written = value;
+    rgbw_hw_count(spwm->pb);
+}
+
+static void rgbw_hw_gpio_set(struct pwm_rgbw_data *pb, int color, int value)
+{
+    struct soft_pwm_device *spwm = &pb->soft_pwm[color];
+
+    trace_rgbw_gpio_set(pb->dev, color, value);
+    if (spwm->can_sleep) {
+        WRITE_ONCE(spwm->pin, value);
+        queue_work(system_highpri_wq, &spwm->pin_work);
+        return;
+    }
+    gpio_set_value(spwm->gpio, value);
+    rgbw_hw_count(pb);
+}
+
+/* 
+ * Soft pwm colors fully off or fully on are a single gpio write, and
+ * only a write when the pin actually changes, with the hrtimer stopped.
+ * The timer only runs while a color sits at a fractional duty, which
+ * is also what rgbw_soft_pwm_edge() decides from the same output.
+ */
+static void rgbw_soft_pwm_update(struct rgbw_device *rgbw_dev,
+        struct pwm_rgbw_data *pb, int color)
+{
+    struct soft_pwm_device *spwm = &pb->soft_pwm[color];
+    u32 level = rgbw_get_output(rgbw_dev, color);
+    int value;
+
+    if ((level >> 16) >= rgbw_soft_full(rgbw_dev, pb, color)) {
+        value = 1;
+    }
+    else if (level == 0 || !READ_ONCE(pb->dimmer)) {
+        value = 0;
+    }
+    else {
+        /* latency is recorded on the first edge */
+        if (!hrtimer_active(&spwm->pwm_timer))
+            hrtimer_start(&spwm->pwm_timer, ktime_set(0,1000), HRTIMER_MODE_REL);
+        return;
+    }
+
+    if (hrtimer_active(&spwm->pwm_timer))
+        hrtimer_cancel(&spwm->pwm_timer);
+    if (spwm->value != value) {
+        spwm->value = value;
+        rgbw_hw_gpio_set(pb, color, value);
+    }
+    rgbw_latency_record(rgbw_dev, color);
+}
+
+static int rgbw_color_update(struct rgbw_device *rgbw_dev);
 
 static int pulse_color_update(struct rgbw_device *rgbw_dev, const int pcolor)
 {
     struct pwm_rgbw_data *pb = rgbw_get_data(rgbw_dev);
     int brightness;
+    unsigned int frac;
+    unsigned int period, lth;
     int max;
     int duty_cycle;
     
     if (pcolor >= MAX_COLORS)
         return -EINVAL;
+
+    /* through the output stage one color can move all four */
+    if (READ_ONCE(rgbw_dev->corr.active))
+        return rgbw_color_update(rgbw_dev);
         
     brightness = rgbw_dev->props[pcolor].brightness;
+    frac = rgbw_get_frac(&rgbw_dev->props[pcolor]);
     max = rgbw_dev->props[pcolor].max_brightness;
         
-    if (pb->notify)
+    if (pb->notify) {
         brightness = pb->notify(pb->dev, brightness);
+        frac = 0;
+    }
     
     if (pb->types[pcolor] == RGBW_PWM) {
-        if (brightness == 0) {
-	    pwm_disable(pb->pwm[pcolor]);
+        if (brightness == 0 && frac == 0) {
+	    rgbw_hw_pwm_disable(pb, pcolor);
         } else {
-            duty_cycle = (pb->levels) ? pb->levels[brightness] : brightness;
-
-            duty_cycle = pb->lth_brightness +
-                 (duty_cycle * (pb->period - pb->lth_brightness) / max);
-            pwm_config(pb->pwm[pcolor], duty_cycle, pb->period);
-            pwm_enable(pb->pwm[pcolor]);
+            rgbw_get_timing(pb, pcolor, &period, &lth);
+            rcu_read_lock();
+            duty_cycle = rgbw_duty_cycle(brightness, frac, max, rcu_dereference(pb->duty), period);
+            rcu_read_unlock();
+            rgbw_hw_pwm_config(pb, pcolor, duty_cycle, period);
         }
     }
     
-    if ((pb->types[pcolor] == RGBW_GPIO) && (!hrtimer_active(&pb->soft_pwm[pcolor].pwm_timer)))
-        hrtimer_start(&pb->soft_pwm[pcolor].pwm_timer, ktime_set(0,1000), HRTIMER_MODE_REL);
+    if (pb->types[pcolor] == RGBW_GPIO)
+        rgbw_soft_pwm_update(rgbw_dev, pb, pcolor);
 
     if (pb->notify_after)
         pb->notify_after(pb->dev, brightness);
@@ -189,36 +526,60 @@ static int rgbw_color_update(struct rgbw_device *rgbw_dev)
 {
     struct pwm_rgbw_data *pb = rgbw_get_data(rgbw_dev);
     int brightness[MAX_COLORS];
+    unsigned int frac[MAX_COLORS];
     int max[MAX_COLORS];
+    unsigned int period, lth;
     int duty_cycle;
+    u32 level;
     int cntr;
     
+    rgbw_update_output(rgbw_dev);
     for (cntr = COLOR_RED; cntr < MAX_COLORS; cntr++) {
-        brightness[cntr] = rgbw_dev->props[cntr].brightness;
+        level = rgbw_get_output(rgbw_dev, cntr);
+        brightness[cntr] = level >> 16;
+        frac[cntr] = level & 0xffff;
         max[cntr] = rgbw_dev->props[cntr].max_brightness;
     }
         
     if (pb->notify) {
+        /* the board hook works in whole steps, drop the fraction */
         for (cntr = COLOR_RED; cntr < MAX_COLORS; cntr++) {
             brightness[cntr] = pb->notify(pb->dev, brightness[cntr]);
+            frac[cntr] = 0;
         }
     }
     
     for (cntr = COLOR_RED; cntr < MAX_COLORS; cntr++) {
+        if (rgbw_dev->props[cntr].state & RGBW_CORE_SUSPENDED) {
+            /* 
+             * Going to sleep: stop the soft pwm outright rather than
+             * letting it fire into a suspended device, and turn off
+             * the hard pwm. Resume calls back in here to restart both.
+             */
+            if (pb->types[cntr] == RGBW_PWM)
+                rgbw_hw_pwm_disable(pb, cntr);
+            if (pb->types[cntr] == RGBW_GPIO) {
+                hrtimer_cancel(&pb->soft_pwm[cntr].pwm_timer);
+                pb->soft_pwm[cntr].value = 0;
+                rgbw_hw_gpio_set(pb, cntr, 0);
+            }
+            continue;
+        }
         if (pb->types[cntr] == RGBW_PWM) {
-            if (brightness[cntr] == 0) {
-				pwm_disable(pb->pwm[cntr]);
+            if (brightness[cntr] == 0 && frac[cntr] == 0) {
+				rgbw_hw_pwm_disable(pb, cntr);
             } else {
-                duty_cycle = (pb->levels) ? pb->levels[brightness[cntr]] : brightness[cntr];
-
-                duty_cycle = pb->lth_brightness +
-                     (duty_cycle * (pb->period - pb->lth_brightness) / max[cntr]);
-                pwm_config(pb->pwm[cntr], duty_cycle, pb->period);
-                pwm_enable(pb->pwm[cntr]);
+                rgbw_get_timing(pb, cntr, &period, &lth);
+                rcu_read_lock();
+                duty_cycle = rgbw_duty_cycle(brightness[cntr], frac[cntr], max[cntr],
+                                             rcu_dereference(pb->duty), period);
+                rcu_read_unlock();
+                rgbw_hw_pwm_config(pb, cntr, duty_cycle, period);
             }
+            rgbw_latency_record(rgbw_dev, cntr);
         }
-        if ((pb->types[cntr] == RGBW_GPIO) && (!hrtimer_active(&pb->soft_pwm[cntr].pwm_timer)))
-            hrtimer_start(&pb->soft_pwm[cntr].pwm_timer, ktime_set(0,1000), HRTIMER_MODE_REL);
+        if (pb->types[cntr] == RGBW_GPIO)
+            rgbw_soft_pwm_update(rgbw_dev, pb, cntr);
     }
 
     if (pb->notify_after) {
@@ -230,22 +591,20 @@ static int rgbw_color_update(struct rgbw_device *rgbw_dev)
     return 0;
 }
 
-static const struct rgbw_ops pwm_color_ops = {
-    .update_status  = rgbw_color_update,
-};
-
 /* The rainbow timer callback is called only when the rainbow function
  * is enabled. We should have already saved the state of the RGBW prior
  * to starting so that we can restore it once the rainbow function is
  * stopped. 
  */
-static void rgbw_rb_timer_callback(unsigned long data)
+static void rgbw_rb_timer_callback(struct timer_list *t)
 {
-	struct rgbw_device *rgbw_dev = (struct rgbw_device *) data; 
+	struct rgbw_device *rgbw_dev = from_timer(rgbw_dev, t, rgbw_timer[TIMER_RAINBOW]);
+    struct pwm_rgbw_data *pb = rgbw_get_data(rgbw_dev);
     int bstate = rgbw_dev->acts.state;
     int cntr;
+    unsigned int delay;
     
-    if (unlikely(reboot_stop)) {
+    if (unlikely(pb->reboot_stop)) {
 		for (cntr = COLOR_RED; cntr < MAX_COLORS; cntr++) {
             rgbw_dev->props[cntr].brightness = 0;
         } 
@@ -254,49 +613,10 @@ static void rgbw_rb_timer_callback(unsigned long data)
 	}
     
     if (bstate & RGBW_RB_ON) { 
-        bstate = rgbw_dev->acts.bstate;                      
-        switch (bstate) {
-            case 0: /*  Red 255, Green increasing */
-                rgbw_dev->props[COLOR_GREEN].brightness++;
-                if (rgbw_dev->props[COLOR_GREEN].brightness > (rgbw_dev->props[COLOR_GREEN].max_brightness - 1))
-                    rgbw_dev->acts.bstate = 1;
-                break;
-            case 1: /*  Green 255, Red decreasing */
-                rgbw_dev->props[COLOR_RED].brightness--;
-                if (rgbw_dev->props[COLOR_RED].brightness < 1)
-                    rgbw_dev->acts.bstate = 2;
-                break;
-            case 2: /*  Green 255, Blue increasing */
-                rgbw_dev->props[COLOR_BLUE].brightness++;
-                if (rgbw_dev->props[COLOR_BLUE].brightness > (rgbw_dev->props[COLOR_BLUE].max_brightness - 1))
-                    rgbw_dev->acts.bstate = 3;
-                break;
-            case 3: /*  Blue 255, Green decreasing */
-                rgbw_dev->props[COLOR_GREEN].brightness--;
-                if (rgbw_dev->props[COLOR_GREEN].brightness < 1)
-                    rgbw_dev->acts.bstate = 4;
-                break;
-            case 4: /*  Blue 255, Red increasing */
-                rgbw_dev->props[COLOR_RED].brightness++;
-                if (rgbw_dev->props[COLOR_RED].brightness > (rgbw_dev->props[COLOR_RED].max_brightness - 1))
-                    rgbw_dev->acts.bstate = 5;
-                break;
-            case 5: /*  Red 255, Blue decreasing */
-                rgbw_dev->props[COLOR_BLUE].brightness--;
-                if (rgbw_dev->props[COLOR_BLUE].brightness < 1)
-                    rgbw_dev->acts.bstate = 0;
-                break;
-            default:
-                rgbw_dev->acts.bstate = 0;
-                rgbw_dev->props[COLOR_RED].brightness = rgbw_dev->props[COLOR_RED].max_brightness;
-                rgbw_dev->props[COLOR_GREEN].brightness = 0;
-                rgbw_dev->props[COLOR_BLUE].brightness = 0;
-                rgbw_dev->props[COLOR_WHITE].brightness = 0;
-                break;
-        };
-      
+        delay = rgbw_rainbow_step(rgbw_dev->props, &rgbw_dev->acts);
         rgbw_color_update(rgbw_dev); 
-        mod_timer(&rgbw_dev->rgbw_timer[TIMER_RAINBOW], jiffies + msecs_to_jiffies(PULSE_VALUE_PER_MS));
+        rgbw_notify_state(rgbw_dev);
+        mod_timer(&rgbw_dev->rgbw_timer[TIMER_RAINBOW], jiffies + msecs_to_jiffies(delay));
     }
 }
 
@@ -305,13 +625,15 @@ static void rgbw_rb_timer_callback(unsigned long data)
  * to starting so that we can restore it once the heartbeat function is
  * stopped. 
  */
-static void rgbw_hb_timer_callback(unsigned long data)
+static void rgbw_hb_timer_callback(struct timer_list *t)
 {
-	struct rgbw_device *rgbw_dev = (struct rgbw_device *) data;
+	struct rgbw_device *rgbw_dev = from_timer(rgbw_dev, t, rgbw_timer[TIMER_HEARTBEAT]);
+    struct pwm_rgbw_data *pb = rgbw_get_data(rgbw_dev);
     int bstate = rgbw_dev->acts.state;
     int cntr;
+    unsigned int delay;
     
-    if (unlikely(reboot_stop)) {
+    if (unlikely(pb->reboot_stop)) {
 		for (cntr = COLOR_RED; cntr < MAX_COLORS; cntr++) {
             rgbw_dev->props[cntr].brightness = 0;
         } 
@@ -320,20 +642,10 @@ static void rgbw_hb_timer_callback(unsigned long data)
 	}
     
     if (bstate & RGBW_HB_ON) {              
-        bstate = rgbw_dev->acts.bstate;
-        
-        for (cntr = COLOR_RED; cntr < MAX_COLORS; cntr++) {
-            rgbw_dev->props[cntr].brightness = (bstate % 2) ? 0 : rgbw_dev->acts.rgbw_values[cntr];          
-        }
-        
-        rgbw_dev->acts.bstate = (bstate < 3) ? rgbw_dev->acts.bstate+1 : 0;
-        
+        delay = rgbw_heartbeat_step(rgbw_dev->props, &rgbw_dev->acts);
         rgbw_color_update(rgbw_dev);
-        
-        if (bstate < 3)
-			mod_timer(&rgbw_dev->rgbw_timer[TIMER_HEARTBEAT], jiffies + msecs_to_jiffies(100));
-        else
-			mod_timer(&rgbw_dev->rgbw_timer[TIMER_HEARTBEAT], jiffies + msecs_to_jiffies(700));
+        rgbw_notify_state(rgbw_dev);
+        mod_timer(&rgbw_dev->rgbw_timer[TIMER_HEARTBEAT], jiffies + msecs_to_jiffies(delay));
     }
 }
 
@@ -342,13 +654,15 @@ static void rgbw_hb_timer_callback(unsigned long data)
  * to starting so that we can restore it once the blink function is
  * stopped. 
  */
-static void rgbw_blink_timer_callback(unsigned long data)
+static void rgbw_blink_timer_callback(struct timer_list *t)
 {
-	struct rgbw_device *rgbw_dev = (struct rgbw_device *) data;
+	struct rgbw_device *rgbw_dev = from_timer(rgbw_dev, t, rgbw_timer[TIMER_BLINK]);
+    struct pwm_rgbw_data *pb = rgbw_get_data(rgbw_dev);
     int bstate = rgbw_dev->acts.state;
     int cntr;
+    unsigned int delay;
     
-    if (unlikely(reboot_stop)) {
+    if (unlikely(pb->reboot_stop)) {
 		for (cntr = COLOR_RED; cntr < MAX_COLORS; cntr++) {
             rgbw_dev->props[cntr].brightness = 0;
         } 
@@ -357,13 +671,10 @@ static void rgbw_blink_timer_callback(unsigned long data)
 	}
     
     if (bstate & RGBW_BLINK_ON) {               
-        bstate = rgbw_dev->acts.bstate;                             
-        for (cntr = COLOR_RED; cntr < MAX_COLORS; cntr++) {
-            rgbw_dev->props[cntr].brightness = (!bstate) ? 0 : rgbw_dev->acts.rgbw_values[cntr];
-        }       
-        rgbw_dev->acts.bstate = (!bstate) ? 1 : 0;       
+        delay = rgbw_blink_step(rgbw_dev->props, &rgbw_dev->acts);
         rgbw_color_update(rgbw_dev);
-        mod_timer(&rgbw_dev->rgbw_timer[TIMER_BLINK], jiffies + msecs_to_jiffies(BLINK_STATE_PER_MS));
+        rgbw_notify_state(rgbw_dev);
+        mod_timer(&rgbw_dev->rgbw_timer[TIMER_BLINK], jiffies + msecs_to_jiffies(delay));
     }
 }
 
@@ -372,27 +683,25 @@ static void rgbw_blink_timer_callback(unsigned long data)
  * to starting so that we can restore it once the pulse function is
  * stopped. 
  */
-static void rgbw_pulse_timer_callback(unsigned long data)
+static void rgbw_pulse_timer_callback(struct timer_list *t)
 {
-	struct rgbw_device *rgbw_dev = (struct rgbw_device *) data;
-    int pulse_val_size = ARRAY_SIZE(pulse_val_table);
+	struct rgbw_device *rgbw_dev = from_timer(rgbw_dev, t, rgbw_timer[TIMER_PULSE]);
+    struct pwm_rgbw_data *pb = rgbw_get_data(rgbw_dev);
+    unsigned int delay;
     int bstate = rgbw_dev->acts.state; 
     int pcolor = rgbw_dev->acts.pcolor; 
     
-    if (unlikely(reboot_stop)) {
+    if (unlikely(pb->reboot_stop)) {
 		rgbw_dev->props[pcolor].brightness = 0;
 		pulse_color_update(rgbw_dev, rgbw_dev->acts.pcolor);
 		return;
 	}
 	   
     if (bstate & RGBW_PULSE_ON) {         
-        if (rgbw_dev->props[pcolor].cntr >= pulse_val_size)
-            rgbw_dev->props[pcolor].cntr = 0;        
-        rgbw_dev->props[pcolor].brightness = pulse_val_table[rgbw_dev->props[pcolor].cntr];
-        rgbw_dev->props[pcolor].cntr++;
-        
+        delay = rgbw_pulse_step(rgbw_dev->props, &rgbw_dev->acts);
         pulse_color_update(rgbw_dev, pcolor);
-        mod_timer(&rgbw_dev->rgbw_timer[TIMER_PULSE], jiffies + msecs_to_jiffies(PULSE_VALUE_PER_MS));
+        rgbw_notify_state(rgbw_dev);
+        mod_timer(&rgbw_dev->rgbw_timer[TIMER_PULSE], jiffies + msecs_to_jiffies(delay));
 	}        
 }
 
@@ -403,43 +712,50 @@ static void rgbw_pulse_timer_callback(unsigned long data)
  
 static enum hrtimer_restart rgbw_gpio_hrtimer_callback(struct hrtimer *timer)
 {
-    struct pwm_rgbw_data *pb = rgbw_get_data(g_rgbw_dev);   
+    struct soft_pwm_device *spwm = container_of(timer, struct soft_pwm_device, pwm_timer);
+    struct pwm_rgbw_data *pb = spwm->pb;
+    struct rgbw_properties *props = &pb->rgbw_dev->props[spwm->color];
     enum hrtimer_restart ret = HRTIMER_NORESTART;
     ktime_t hrtimer_next_tick  = ktime_set(0,0);
+    ktime_t now = ktime_get();
+    u32 level;
+    s64 late;
     u64 next_toggle; // a nanosecond value
-    int cntr;
     
-    if (unlikely(reboot_stop)) {
-		for (cntr = COLOR_RED; cntr < MAX_COLORS; cntr++) {
-			if (pb->types[cntr] == RGBW_GPIO) { 
-				__gpio_set_value(pb->soft_pwm[cntr].gpio, 0);
-			}
-		}
+    if (unlikely(pb->reboot_stop)) {
+		spwm->value = 0;
+		rgbw_hw_gpio_set(pb, spwm->color, 0);
 		return ret;
 	}
     
-    for (cntr = COLOR_RED; cntr < MAX_COLORS; cntr++) {
-        if (pb->types[cntr] == RGBW_GPIO) {            
-            if (hrtimer_callback_running(&pb->soft_pwm[cntr].pwm_timer)) {
-                if (g_rgbw_dev->props[cntr].brightness >= g_rgbw_dev->props[cntr].max_brightness) {
-                    pb->soft_pwm[cntr].value = 1;
-                }
-                else if (g_rgbw_dev->props[cntr].brightness == 0) {
-                    pb->soft_pwm[cntr].value = 0;
-                }
-                else {
-                    pb->soft_pwm[cntr].value = 1 - pb->soft_pwm[cntr].value;
-                    next_toggle = (pb->soft_pwm[cntr].value) ? (g_rgbw_dev->props[cntr].brightness * pb->lth_brightness) : (pb->period - (g_rgbw_dev->props[cntr].brightness * pb->lth_brightness)); 
-                    hrtimer_next_tick = ns_to_ktime(next_toggle);
-                }
-                __gpio_set_value(pb->soft_pwm[cntr].gpio, pb->soft_pwm[cntr].value); 
-                break;               
-            }                  
-        }
+    if (props->state & RGBW_CORE_SUSPENDED) {
+        spwm->value = 0;
     }
+    else {
+        /* a period change only takes effect at a period boundary */
+        if (!spwm->value)
+            rgbw_get_timing(pb, spwm->color, &spwm->period, &spwm->lth);
+        level = rgbw_get_output(pb->rgbw_dev, spwm->color);
+        rcu_read_lock();
+        next_toggle = rgbw_soft_pwm_edge(level >> 16, level & 0xffff,
+                                         rgbw_soft_full(pb->rgbw_dev, pb, spwm->color), spwm->period,
+                                         rcu_dereference(pb->duty), &spwm->value, &spwm->dither);
+        rcu_read_unlock();
+        hrtimer_next_tick = ns_to_ktime(next_toggle);
+    }
+    rgbw_hw_gpio_set(pb, spwm->color, spwm->value); 
+    rgbw_latency_record(pb->rgbw_dev, spwm->color);
     
+    if (pb->gov_max_period) {
+        late = ktime_to_ns(ktime_sub(now, hrtimer_get_expires(timer)));
+        atomic_inc(&pb->gov_edges);
+        if (late > spwm->lth)
+            atomic_inc(&pb->gov_late);
+        atomic_long_add(ktime_to_ns(ktime_sub(ktime_get(), now)), &pb->gov_busy_ns);
+    }
+
     if (ktime_compare(hrtimer_next_tick, ktime_set(0,0)) > 0)  {
-        hrtimer_forward(timer, ktime_get(), hrtimer_next_tick);
+        hrtimer_forward(timer, now, hrtimer_next_tick);
         ret = HRTIMER_RESTART;
     }
        
@@ -524,46 +840,243 @@ static int rgbw_dt_validation(struct platform_device *pdev)
     return num_def_colors;    
 }
 
+static void rgbw_put_levels(void *levels)
+{
+    rgbw_levels_put(levels);
+}
+
 static int rgbw_parse_dt(struct device *dev,
                   struct platform_rgbw_data *data)
 {
     struct device_node *node = dev->of_node;
-    struct property *prop;
+    struct rgbw_levels *levels;
+    u32 steps = 0;
+    u32 *points;
+    const char *name;
     int length;
     int ret;
+    int cntr;
 
     if (!node)
         return -ENODEV;
 
     memset(data, 0, sizeof(*data));
 
-    /* determine the number of brightness levels */
-    prop = of_find_property(node, "brightness-levels", &length);
-    if (!prop)
+    /* 
+     * brightness-levels is either the whole table or, with
+     * num-interpolated-steps = <n>, control points joined by n levels
+     * each. Strips with the same curve share one table.
+     */
+    length = of_property_count_u32_elems(node, "brightness-levels");
+    if (length <= 0)
         return -EINVAL;
 
-    data->max_brightness = length / sizeof(u32);
+    points = kcalloc(length, sizeof(*points), GFP_KERNEL);
+    if (!points)
+        return -ENOMEM;
+    ret = of_property_read_u32_array(node, "brightness-levels", points, length);
+    if (!ret) {
+        of_property_read_u32(node, "num-interpolated-steps", &steps);
+        levels = rgbw_levels_get(points, length, steps);
+        if (IS_ERR(levels))
+            ret = PTR_ERR(levels);
+    }
+    kfree(points);
+    if (ret < 0) {
+        dev_err(dev, "invalid brightness-levels (%d)\n", ret);
+        return ret;
+    }
+
+    ret = devm_add_action_or_reset(dev, rgbw_put_levels, levels);
+    if (ret < 0)
+        return ret;
+    data->levels = levels->table;
+    data->max_brightness = levels->count - 1;
 
-    /* read brightness levels from DT property */
-    if (data->max_brightness > 0) {
-        size_t size = sizeof(*data->levels) * data->max_brightness;
+    /* 
+     * Optional pwm periods in ns, 10ms when absent; they can be changed
+     * at runtime through the class' pwm_period attribute:
+     * pwm-period-ns = <n>;         for the hard pwm colors
+     * soft-pwm-period-ns = <n>;    for the gpio colors
+     */
+    of_property_read_u32(node, "pwm-period-ns", &data->pwm_period_ns);
+    of_property_read_u32(node, "soft-pwm-period-ns", &data->soft_pwm_period_ns);
 
-        data->levels = devm_kzalloc(dev, size, GFP_KERNEL);
-        if (!data->levels)
-            return -ENOMEM;
+    /* 
+     * Optional soft pwm governor, slows the gpio colors down to at most
+     * this period while edges run late and back up once the load goes:
+     * soft-pwm-max-period-ns = <n>;
+     */
+    of_property_read_u32(node, "soft-pwm-max-period-ns", &data->soft_pwm_max_period_ns);
+
+    /* 
+     * Optional per fixture calibration run in the class' output stage,
+     * also adjustable through its color_matrix and white_extract files:
+     * color-matrix = <16 Q16 coefficients, row per output color>;
+     * white-extraction;
+     */
+    if (of_property_count_u32_elems(node, "color-matrix") > 0) {
+        ret = of_property_read_u32_array(node, "color-matrix", (u32 *)data->color_matrix,
+                                         MAX_COLORS * MAX_COLORS);
+        if (ret < 0) {
+            dev_err(dev, "color-matrix needs %d entries\n", MAX_COLORS * MAX_COLORS);
+            return ret;
+        }
+        data->has_color_matrix = true;
+    }
+    data->white_extract = of_property_read_bool(node, "white-extraction");
 
-        ret = of_property_read_u32_array(node, "brightness-levels",
-                         data->levels,
-                         data->max_brightness);
+    /* 
+     * Optional power limit run in the class' output stage, the budgets
+     * can also be changed through power_budget, supply_group and the
+     * class' supply_budget files:
+     * channel-current-microamp = <red green blue [white]>;
+     * power-budget-microamp = <uA>;
+     * supply-group = <1..15>;
+     */
+    length = of_property_count_u32_elems(node, "channel-current-microamp");
+    if (length > 0) {
+        if (length > MAX_COLORS) {
+            dev_err(dev, "channel-current-microamp has %d entries, at most %d allowed\n",
+                    length, MAX_COLORS);
+            return -EINVAL;
+        }
+        ret = of_property_read_u32_array(node, "channel-current-microamp",
+                                         data->current_ua, length);
         if (ret < 0)
-            return ret;       
-            
-        data->max_brightness--;
+            return ret;
+    }
+    of_property_read_u32(node, "power-budget-microamp", &data->power_budget_ua);
+    of_property_read_u32(node, "supply-group", &data->supply_group);
+
+    /* 
+     * Optional thermal derating, a node with #cooling-cells can be used
+     * in a thermal zone's cooling-maps:
+     * cooling-levels = <100 [...]>;  output ceiling in % per state,
+     * defaults to 100 80 60 40 20
+     */
+    if (of_find_property(node, "#cooling-cells", NULL)) {
+        length = of_property_count_u32_elems(node, "cooling-levels");
+        if (length > 0) {
+            if (length < 2 || length > RGBW_MAX_COOLING_STATES) {
+                dev_err(dev, "cooling-levels needs 2 to %d entries\n", RGBW_MAX_COOLING_STATES);
+                return -EINVAL;
+            }
+            ret = of_property_read_u32_array(node, "cooling-levels",
+                                             data->cooling_levels, length);
+            if (ret < 0)
+                return ret;
+            data->num_cooling_levels = length;
+        }
+        else {
+            for (cntr = 0; cntr < 5; cntr++) {
+                data->cooling_levels[cntr] = 100 - cntr * 20;
+            }
+            data->num_cooling_levels = 5;
+        }
+    }
+
+    /* 
+     * Optional early boot state, applied directly at probe so a status
+     * color is up before userspace runs:
+     * default-levels = <red green blue [white]>;
+     * default-effect = "pulse" | "blink" | "heartbeat" | "rainbow";
+     * default-pulse-color = "red" | "green" | "blue" | "white";
+     */
+    data->default_pcolor = INVALID_COLOR;
+    length = of_property_count_u32_elems(node, "default-levels");
+    if (length > 0) {
+        if (length > MAX_COLORS) {
+            dev_err(dev, "default-levels has %d entries, at most %d allowed\n", length, MAX_COLORS);
+            return -EINVAL;
+        }
+        ret = of_property_read_u32_array(node, "default-levels",
+                         data->default_levels, length);
+        if (ret < 0)
+            return ret;
+        for (cntr = COLOR_RED; cntr < length; cntr++) {
+            if (data->default_levels[cntr] > data->max_brightness) {
+                dev_warn(dev, "default %s level %u clamped to %u\n", color_names[cntr],
+                         data->default_levels[cntr], data->max_brightness);
+                data->default_levels[cntr] = data->max_brightness;
+            }
+        }
+    }
+
+    if (!of_property_read_string(node, "default-effect", &name)) {
+        for (cntr = 0; cntr < ARRAY_SIZE(rgbw_default_effects); cntr++) {
+            if (strcmp(name, rgbw_default_effects[cntr].name) == 0)
+                data->default_effect = rgbw_default_effects[cntr].flag;
+        }
+        if (!data->default_effect) {
+            dev_err(dev, "unknown default-effect \"%s\"\n", name);
+            return -EINVAL;
+        }
+    }
+
+    if (data->default_effect == RGBW_PULSE_ON) {
+        if (of_property_read_string(node, "default-pulse-color", &name)) {
+            dev_err(dev, "default-effect \"pulse\" needs a default-pulse-color\n");
+            return -EINVAL;
+        }
+        for (cntr = COLOR_RED; cntr < MAX_COLORS; cntr++) {
+            if (strcmp(name, color_names[cntr]) == 0)
+                data->default_pcolor = cntr;
+        }
+        if (data->default_pcolor == INVALID_COLOR) {
+            dev_err(dev, "unknown default-pulse-color \"%s\"\n", name);
+            return -EINVAL;
+        }
     }
 
     return 0;
 }
 
+/* 
+ * Soft pwm lines start at their final level when it is fully on so the
+ * strip does not flash dark between the request and the first update.
+ * A default pulse starts from dark on every color.
+ */
+static unsigned long rgbw_gpio_init_flags(struct platform_rgbw_data *data, int color)
+{
+    if (data->default_effect == RGBW_PULSE_ON)
+        return GPIOF_OUT_INIT_LOW;
+    if (data->default_levels[color] && data->default_levels[color] >= data->max_brightness)
+        return GPIOF_OUT_INIT_HIGH;
+    return GPIOF_OUT_INIT_LOW;
+}
+
+/* Start the DT default effect the same way the class sysfs setters do */
+static void rgbw_start_default_effect(struct rgbw_device *rgbw_dev,
+                  struct platform_rgbw_data *data)
+{
+    int effect, cntr;
+
+    for (effect = 0; effect < ARRAY_SIZE(rgbw_default_effects); effect++) {
+        if (rgbw_default_effects[effect].flag == data->default_effect)
+            break;
+    }
+    if (effect == ARRAY_SIZE(rgbw_default_effects))
+        return;
+
+    if (data->default_effect == RGBW_PULSE_ON) {
+        rgbw_dev->acts.pcolor = data->default_pcolor;
+        for (cntr = COLOR_RED; cntr < MAX_COLORS; cntr++) {
+            rgbw_dev->props[cntr].brightness = 0;
+        }
+        rgbw_dev->props[data->default_pcolor].cntr = 0;
+    }
+    else if (data->default_effect == RGBW_RB_ON) {
+        rgbw_dev->acts.bstate = INVALID_COLOR;
+    }
+    else {
+        rgbw_dev->acts.bstate = 0;
+    }
+
+    rgbw_dev->acts.state |= data->default_effect;
+    mod_timer(&rgbw_dev->rgbw_timer[rgbw_default_effects[effect].timer], jiffies + 1);
+}
+
 static struct of_device_id rgbw_of_match[] = {
     { .compatible = "pwm-rgbw" },
     { }
@@ -571,7 +1084,7 @@ static struct of_device_id rgbw_of_match[] = {
 
 MODULE_DEVICE_TABLE(of, rgbw_of_match);
 
-typedef void (*timer_callbackfn)( unsigned long );
+typedef void (*timer_callbackfn)(struct timer_list *);
 timer_callbackfn callbackfn_list[MAX_RGBWTIMER + 1] = {
 	rgbw_pulse_timer_callback,
 	rgbw_blink_timer_callback,
@@ -580,6 +1093,209 @@ timer_callbackfn callbackfn_list[MAX_RGBWTIMER + 1] = {
 	NULL,
 };
 
+/* 
+ * Called by the class before the device shows up in sysfs and /dev:
+ * the first store or default trigger may already use pb->rgbw_dev and
+ * arm the effect timers.
+ */
+static int rgbw_color_init(struct rgbw_device *rgbw_dev)
+{
+    struct pwm_rgbw_data *pb = rgbw_get_data(rgbw_dev);
+    int cntr;
+
+    pb->rgbw_dev = rgbw_dev;
+    for (cntr = COLOR_RED; cntr < MAX_COLORS; cntr++) {
+        rgbw_dev->acts.rgbw_values[cntr] = rgbw_dev->props[cntr].brightness;
+        rgbw_dev->props[cntr].cntr = 0;
+    }
+    for (cntr = TIMER_PULSE; cntr < MAX_RGBWTIMER; cntr++) {
+        timer_setup(&rgbw_dev->rgbw_timer[cntr], callbackfn_list[cntr], 0);
+    }
+
+    return 0;
+}
+
+static const struct rgbw_ops pwm_color_ops = {
+    .options        = RGBW_CORE_SUSPENDRESUME,
+    .init           = rgbw_color_init,
+    .update_status  = rgbw_color_update,
+    .set_period     = rgbw_set_period,
+    .check_period   = rgbw_check_color_period,
+    .set_dimmer     = rgbw_set_dimmer,
+};
+
+/* 
+ * Everything past getting the pwms and gpios: the duty tables and
+ * timing of each color, the class device with its effect timers and
+ * the DT defaults, ending with the first update. pb->pwm, the soft pwm
+ * gpios and pb->types are set up by the caller.
+ */
+static struct rgbw_device *rgbw_strip_register(struct device *dev, struct pwm_rgbw_data *pb,
+        struct platform_rgbw_data *data, struct rgbw_properties *props)
+{
+    struct rgbw_actions acts;
+    struct rgbw_device *rgbw_dev;
+    int ret;
+    int cntr;
+
+    /* duty tables of hard and soft pwms, the second one is for dimmer changes */
+    pb->levels = data->levels;
+    pb->max_brightness = data->max_brightness;
+    pb->duty_buf[0] = devm_kcalloc(dev, 2 * (data->max_brightness + 1),
+                                   sizeof(u32), GFP_KERNEL);
+    if (!pb->duty_buf[0])
+        return ERR_PTR(-ENOMEM);
+    pb->duty_buf[1] = pb->duty_buf[0] + data->max_brightness + 1;
+    rgbw_fold_duty(pb->levels, pb->max_brightness, RGBW_DIM_FULL, pb->duty_buf[0]);
+    RCU_INIT_POINTER(pb->duty, pb->duty_buf[0]);
+
+    /* 
+	 * Periods default to 10ms, a frequency of 100Hz, unless the board
+	 * sets pwm-period-ns / soft-pwm-period-ns
+	 */
+    seqlock_init(&pb->timing_lock);
+    pb->lth_div = max(data->max_brightness, 1U);
+    pb->dimmer = RGBW_DIM_FULL;
+    for (cntr = COLOR_RED; cntr < MAX_COLORS; cntr++) {
+        unsigned int period;
+
+        if (pb->types[cntr] == RGBW_PWM)
+            period = data->pwm_period_ns ? data->pwm_period_ns : RGBW_DEFAULT_PERIOD_NS;
+        else if (pb->types[cntr] == RGBW_GPIO)
+            period = data->soft_pwm_period_ns ? data->soft_pwm_period_ns : RGBW_DEFAULT_PERIOD_NS;
+        else
+            continue;
+        if (rgbw_check_period(pb, cntr, period)) {
+            dev_err(dev, "invalid %s pwm period %u ns\n", color_names[cntr], period);
+            return ERR_PTR(-EINVAL);
+        }
+        rgbw_set_timing(pb, cntr, period);
+        pb->soft_target[cntr] = period;
+        props[cntr].period = period;
+    }
+
+    mutex_init(&pb->gov_lock);
+    INIT_DELAYED_WORK(&pb->gov_work, rgbw_governor_work);
+    for (cntr = COLOR_RED; cntr < MAX_COLORS; cntr++) {
+        if (pb->types[cntr] == RGBW_GPIO && data->soft_pwm_max_period_ns)
+            break;
+    }
+    if (cntr < MAX_COLORS) {
+        if (data->soft_pwm_max_period_ns > RGBW_MAX_PERIOD_NS) {
+            dev_err(dev, "soft-pwm-max-period-ns above %u\n", RGBW_MAX_PERIOD_NS);
+            return ERR_PTR(-EINVAL);
+        }
+        pb->gov_max_period = data->soft_pwm_max_period_ns;
+    }
+    
+    acts.pcolor = INVALID_COLOR;
+    acts.bstate = INVALID_COLOR;
+    acts.state = 0;
+    acts.saved_state = 0;
+
+    /* 
+     * Everything the soft pwm callback needs hangs off pb so several
+     * strips can be probed at the same time without sharing state.
+     */
+    for (cntr = COLOR_RED; cntr < MAX_COLORS; cntr++) {
+        if (pb->types[cntr] == RGBW_GPIO) {
+            pb->soft_pwm[cntr].color = cntr;
+            pb->soft_pwm[cntr].pb = pb;
+            pb->soft_pwm[cntr].period = pb->period[cntr];
+            pb->soft_pwm[cntr].lth = pb->lth_brightness[cntr];
+            pb->soft_pwm[cntr].pin = pb->soft_pwm[cntr].value;
+            pb->soft_pwm[cntr].pin_written = pb->soft_pwm[cntr].value;
+            INIT_WORK(&pb->soft_pwm[cntr].pin_work, rgbw_gpio_pin_work);
+            hrtimer_init(&pb->soft_pwm[cntr].pwm_timer, CLOCK_MONOTONIC, HRTIMER_MODE_REL);
+            pb->soft_pwm[cntr].pwm_timer.function = &rgbw_gpio_hrtimer_callback;
+        }
+    }
+
+    rgbw_dev = rgbw_device_register(dev_name(dev), dev, pb,
+                       &pwm_color_ops, props, &acts);
+    if (IS_ERR(rgbw_dev)) {
+        dev_err(dev, "failed to register rgbw channel\n");
+        pb->rgbw_dev = NULL;
+        return rgbw_dev;
+    }
+    /* pb->rgbw_dev and the effect timers were set up by rgbw_color_init() */
+
+    /* 
+     * Bring up the DT default color (or an effect on top of it) right
+     * away. Userspace taking over later just writes on top of this state
+     * and stopping a default effect restores the default levels.
+     */
+    if (data->has_color_matrix || data->white_extract) {
+        ret = rgbw_set_correction(rgbw_dev, data->has_color_matrix ?
+                                  (const s32 (*)[MAX_COLORS])data->color_matrix : NULL,
+                                  data->white_extract);
+        if (ret == -EOPNOTSUPP)
+            dev_warn(dev, "color correction ignored, it needs a white channel\n");
+        else if (ret < 0)
+            dev_warn(dev, "color-matrix ignored, coefficients above %d\n", RGBW_MATRIX_MAX);
+    }
+    ret = rgbw_set_power_limit(rgbw_dev, data->current_ua, data->power_budget_ua,
+                               data->supply_group);
+    if (ret < 0)
+        dev_warn(dev, "power limit ignored, invalid current or supply-group\n");
+    if (data->num_cooling_levels) {
+        ret = rgbw_register_cooling(rgbw_dev, dev->of_node, data->cooling_levels,
+                                    data->num_cooling_levels);
+        if (ret < 0)
+            dev_warn(dev, "not registered as a cooling device (%d)\n", ret);
+    }
+    /* a default pulse clears the other colors, so set it up before the first update */
+    rgbw_start_default_effect(rgbw_dev, data);
+    rgbw_update_status(rgbw_dev);
+
+    return rgbw_dev;
+}
+
+/* 
+ * Undo rgbw_strip_register(). Everything that can touch the class
+ * device from timer or work context is stopped before it goes away:
+ * reboot_stop keeps the callbacks from re-arming or notifying, so once
+ * they are cancelled nothing but sysfs and ops are left, and those are
+ * taken down by rgbw_device_unregister().
+ */
+static void rgbw_strip_unregister(struct pwm_rgbw_data *pb)
+{
+    struct rgbw_device *rgbw_dev = pb->rgbw_dev;
+    int cntr;
+
+    get_device(&rgbw_dev->dev);
+    pb->reboot_stop = true;
+    rgbw_dev->acts.pcolor = INVALID_COLOR;
+    rgbw_dev->acts.bstate = INVALID_COLOR;
+    for (cntr = TIMER_PULSE; cntr < MAX_RGBWTIMER; cntr++) {
+		del_timer_sync(&rgbw_dev->rgbw_timer[cntr]);
+    }
+    cancel_delayed_work_sync(&pb->gov_work);
+    for (cntr = COLOR_RED; cntr < MAX_COLORS; cntr++) {
+        if (pb->types[cntr] == RGBW_GPIO)
+            hrtimer_cancel(&pb->soft_pwm[cntr].pwm_timer);
+    }
+
+    rgbw_device_unregister(rgbw_dev);
+
+    /* a store that raced with the above may have armed an effect again */
+    for (cntr = TIMER_PULSE; cntr < MAX_RGBWTIMER; cntr++) {
+		del_timer_sync(&rgbw_dev->rgbw_timer[cntr]);
+    }
+    for (cntr = COLOR_RED; cntr < MAX_COLORS; cntr++) {
+        if (pb->types[cntr] == RGBW_PWM) {
+			rgbw_hw_pwm_disable(pb, cntr);
+        }
+        if (pb->types[cntr] == RGBW_GPIO) {
+            hrtimer_cancel(&pb->soft_pwm[cntr].pwm_timer);
+            rgbw_hw_gpio_set(pb, cntr, 0);
+            flush_work(&pb->soft_pwm[cntr].pin_work);
+        }
+    }
+    pb->rgbw_dev = NULL;
+    put_device(&rgbw_dev->dev);
+}
+
 /* This function is called by the system when a DT entry
  * has a platform_device with matching compatible string.
  * We can expect a single DT entry with one, multiple, or
@@ -599,13 +1315,13 @@ static int rgbw_dt_probe(struct platform_device *pdev)
     struct platform_rgbw_data *data = pdev->dev.platform_data;
     struct platform_rgbw_data defdata;
     struct rgbw_properties props[MAX_COLORS];
-    struct rgbw_actions acts;
     struct rgbw_device *rgbw_dev;
     struct pwm_rgbw_data *pb;
-    unsigned int max, num_named_colors, gpio_api_num;
+    unsigned int num_named_colors, gpio_api_num;
     int ret;
     unsigned int cntr = 0;
     int index = -ENODATA;
+    ktime_t probe_start = ktime_get();
 
     if (!data) {
         ret = rgbw_parse_dt(&pdev->dev, &defdata);
@@ -645,12 +1361,6 @@ static int rgbw_dt_probe(struct platform_device *pdev)
         goto err_alloc;
     }
 
-    if (data->levels) {
-        max = data->levels[data->max_brightness];
-        pb->levels = data->levels;
-    } else
-        max = data->max_brightness;
-
     pb->notify = data->notify;
     pb->notify_after = data->notify_after;
     pb->exit = data->exit;
@@ -660,6 +1370,7 @@ static int rgbw_dt_probe(struct platform_device *pdev)
     
     for (cntr = COLOR_RED; cntr < MAX_COLORS; cntr++) {
         props[cntr].max_brightness = data->max_brightness;
+        props[cntr].brightness = data->default_levels[cntr];
     }
     
     if (num_named_colors > 0) {
@@ -672,15 +1383,12 @@ static int rgbw_dt_probe(struct platform_device *pdev)
             props[cntr].type = RGBW_TYPE_INVALID;
             index = of_property_match_string(pdev->dev.of_node, "pwm-names", color_names[cntr]);
             if (index >= 0) {
-                pb->pwm[cntr] = devm_of_pwm_get(&pdev->dev, pdev->dev.of_node, color_names[cntr]);
+                pb->pwm[cntr] = devm_pwm_get(&pdev->dev, color_names[cntr]);
                 //printk(KERN_INFO "pwms of property index for %s: %d\n", color_names[cntr], index);
                 if (IS_ERR(pb->pwm[cntr])) {
-                    dev_err(&pdev->dev, "unable to request PWM for color %s using devm_of_pwm_get\n", color_names[cntr]);
-                    pb->pwm[cntr] = devm_pwm_get(&pdev->dev, color_names[cntr]);
-                    if (IS_ERR(pb->pwm[cntr])) {
-                        dev_err(&pdev->dev, "unable to request PWM for color %s\n", color_names[cntr]);
-                        goto err_alloc;
-                    }
+                    ret = PTR_ERR(pb->pwm[cntr]);
+                    dev_err(&pdev->dev, "unable to request PWM for color %s\n", color_names[cntr]);
+                    goto err_alloc;
                 }
                 dev_dbg(&pdev->dev, "got pwm for color %s\n", color_names[cntr]);
                 pb->types[cntr] = RGBW_PWM;
@@ -691,18 +1399,15 @@ static int rgbw_dt_probe(struct platform_device *pdev)
             
             index = of_property_match_string(pdev->dev.of_node, "gpio-names", color_names[cntr]);
             if (index >= 0) {
-                gpio_api_num = of_get_named_gpio_flags(pdev->dev.of_node, "gpios", index, NULL);
+                gpio_api_num = of_get_named_gpio(pdev->dev.of_node, "gpios", index);
                 //printk(KERN_INFO "gpio number for %s: %d\n", color_names[cntr], gpio_api_num);
-                ret = gpio_request(gpio_api_num, "rgbw-drv");
+                ret = devm_gpio_request_one(&pdev->dev, gpio_api_num,
+                                            rgbw_gpio_init_flags(data, cntr), "rgbw-drv");
                 if (ret < 0)
                     goto err_alloc;
-                ret = gpio_direction_output(gpio_api_num, 0);
-                if (ret < 0) {
-                    gpio_free(gpio_api_num);
-                    goto err_alloc;
-                }
                 pb->soft_pwm[cntr].gpio = gpio_api_num;
-                pb->soft_pwm[cntr].value = 0;
+                pb->soft_pwm[cntr].value = (rgbw_gpio_init_flags(data, cntr) == GPIOF_OUT_INIT_HIGH);
+                pb->soft_pwm[cntr].can_sleep = gpio_cansleep(gpio_api_num);
                 dev_dbg(&pdev->dev, "created soft pwm for color %s\n", color_names[cntr]);
                 pb->types[cntr] = RGBW_GPIO;
                 props[cntr].type = RGBW_GPIO;
@@ -727,14 +1432,11 @@ static int rgbw_dt_probe(struct platform_device *pdev)
             for (; cntr < num_hpwms; cntr++) {
                 pb->types[cntr] = RGBW_TYPE_INVALID;
                 props[cntr].type = RGBW_TYPE_INVALID;
-                pb->pwm[cntr] = devm_of_pwm_get(&pdev->dev, pdev->dev.of_node, color_names[cntr]);
+                pb->pwm[cntr] = devm_pwm_get(&pdev->dev, color_names[cntr]);
                 if (IS_ERR(pb->pwm[cntr])) {
-                    dev_err(&pdev->dev, "unable to request PWM for color %s using devm_of_pwm_get\n", color_names[cntr]);
-                    pb->pwm[cntr] = devm_pwm_get(&pdev->dev, color_names[cntr]);
-                    if (IS_ERR(pb->pwm[cntr])) {
-                        dev_err(&pdev->dev, "unable to request PWM for color %s\n", color_names[cntr]);
-                        goto err_alloc;
-                    }
+                    ret = PTR_ERR(pb->pwm[cntr]);
+                    dev_err(&pdev->dev, "unable to request PWM for color %s\n", color_names[cntr]);
+                    goto err_alloc;
                 }
                 dev_dbg(&pdev->dev, "got pwm for color %s\n", color_names[cntr]);
                 pb->types[cntr] = RGBW_PWM;
@@ -746,18 +1448,15 @@ static int rgbw_dt_probe(struct platform_device *pdev)
             for (; cntr < total_pwms; cntr++) {
                 pb->types[cntr] = RGBW_TYPE_INVALID;
                 props[cntr].type = RGBW_TYPE_INVALID;
-                gpio_api_num = of_get_named_gpio_flags(pdev->dev.of_node, "gpios", cntr - num_hpwms, NULL);
+                gpio_api_num = of_get_named_gpio(pdev->dev.of_node, "gpios", cntr - num_hpwms);
                 //printk(KERN_INFO "gpio number for %s: %d\n", color_names[cntr], gpio_api_num);
-                ret = gpio_request(gpio_api_num, "rgbw-drv");
+                ret = devm_gpio_request_one(&pdev->dev, gpio_api_num,
+                                            rgbw_gpio_init_flags(data, cntr), "rgbw-drv");
                 if (ret < 0)
                     goto err_alloc;
-                ret = gpio_direction_output(gpio_api_num, 0);
-                if (ret < 0) {
-                    gpio_free(gpio_api_num);
-                    goto err_alloc;
-                }
                 pb->soft_pwm[cntr].gpio = gpio_api_num;
-                pb->soft_pwm[cntr].value = 0;           
+                pb->soft_pwm[cntr].value = (rgbw_gpio_init_flags(data, cntr) == GPIOF_OUT_INIT_HIGH);           
+                pb->soft_pwm[cntr].can_sleep = gpio_cansleep(gpio_api_num);
                 dev_dbg(&pdev->dev, "created soft pwm for color %s\n", color_names[cntr]);
                 pb->types[cntr] = RGBW_GPIO;
                 props[cntr].type = RGBW_GPIO;
@@ -771,56 +1470,29 @@ static int rgbw_dt_probe(struct platform_device *pdev)
         
     }
 
-    /* 
-	 * Set our period arbitrarily to be 10ms
-	 * which is a frequency of 100Hz
-	 */
-	pb->period = 10000000;
-	pb->lth_brightness = (pb->period / max);
-    
-    acts.pcolor = INVALID_COLOR;
-    acts.bstate = INVALID_COLOR;
-    acts.state = 0;
-
-    rgbw_dev = rgbw_device_register(dev_name(&pdev->dev), &pdev->dev, pb,
-                       &pwm_color_ops, props, &acts);
+    rgbw_dev = rgbw_strip_register(&pdev->dev, pb, data, props);
     if (IS_ERR(rgbw_dev)) {
-        dev_err(&pdev->dev, "failed to register rgbw channel\n");
         ret = PTR_ERR(rgbw_dev);
         goto err_alloc;
     }
 
-    for (cntr = COLOR_RED; cntr < MAX_COLORS; cntr++) {        
-        rgbw_dev->props[cntr].brightness = 0;
-        rgbw_dev->acts.rgbw_values[cntr] = 0;
-        rgbw_dev->props[cntr].cntr = 0;
-    }
-    
-    for (cntr = COLOR_RED; cntr < MAX_COLORS; cntr++) {
-        if (pb->types[cntr] == RGBW_GPIO) {
-            hrtimer_init(&pb->soft_pwm[cntr].pwm_timer, CLOCK_MONOTONIC, HRTIMER_MODE_REL);
-            pb->soft_pwm[cntr].pwm_timer.function = &rgbw_gpio_hrtimer_callback;
-        }
-    }
-    
-    setup_timer(&rgbw_dev->rgbw_timer[TIMER_PULSE], callbackfn_list[TIMER_PULSE], (unsigned long) rgbw_dev);
-    set_timer_slack(&rgbw_dev->rgbw_timer[TIMER_PULSE], 0);
-    setup_timer(&rgbw_dev->rgbw_timer[TIMER_BLINK], callbackfn_list[TIMER_BLINK], (unsigned long) rgbw_dev);
-    set_timer_slack(&rgbw_dev->rgbw_timer[TIMER_BLINK], 0);
-    setup_timer(&rgbw_dev->rgbw_timer[TIMER_HEARTBEAT], callbackfn_list[TIMER_HEARTBEAT], (unsigned long) rgbw_dev);
-    set_timer_slack(&rgbw_dev->rgbw_timer[TIMER_HEARTBEAT], 0);
-    setup_timer(&rgbw_dev->rgbw_timer[TIMER_RAINBOW], callbackfn_list[TIMER_RAINBOW], (unsigned long) rgbw_dev);
-    set_timer_slack(&rgbw_dev->rgbw_timer[TIMER_RAINBOW], 0);
-    
-    rgbw_update_status(rgbw_dev);
-
     platform_set_drvdata(pdev, rgbw_dev);
-    g_rgbw_dev = rgbw_dev;
     
-    atomic_notifier_chain_register(&panic_notifier_list, &rgbw_panic_nb);
-    register_reboot_notifier(&rgbw_reboot_nb);
+    pb->reboot_nb.notifier_call = rgbw_reboot_notifier;
+    pb->panic_nb.notifier_call = rgbw_panic_notifier;
+    atomic_notifier_chain_register(&panic_notifier_list, &pb->panic_nb);
+    register_reboot_notifier(&pb->reboot_nb);
+
+    if (pb->gov_max_period)
+        schedule_delayed_work(&pb->gov_work, msecs_to_jiffies(RGBW_GOV_INTERVAL_MS));
 
-	reboot_stop = false;
+    /* last, a default trigger can start driving the strip right away */
+    ret = rgbw_register_leds(rgbw_dev);
+    if (ret < 0)
+        dev_warn(&pdev->dev, "no LED class device (%d)\n", ret);
+
+    dev_info(&pdev->dev, "probed in %lld us\n",
+             ktime_us_delta(ktime_get(), probe_start));
     return 0;
 
 err_alloc:
@@ -829,34 +1501,16 @@ err_alloc:
     return ret;
 }
 
-static int rgbw_color_remove(struct platform_device *pdev)
+static void rgbw_color_remove(struct platform_device *pdev)
 {
     struct rgbw_device *rgbw_dev = platform_get_drvdata(pdev);
     struct pwm_rgbw_data *pb = rgbw_get_data(rgbw_dev);
-    int cntr;
     
-    rgbw_dev->acts.pcolor = INVALID_COLOR;
-    rgbw_dev->acts.bstate = INVALID_COLOR;
-    dev_err(&pdev->dev, "cancelling our timers\n");
-    for (cntr = TIMER_PULSE; cntr < MAX_RGBWTIMER; cntr++) {
-		del_timer_sync(&rgbw_dev->rgbw_timer[cntr]);
-    }
-    reboot_stop = true;
-    rgbw_device_unregister(rgbw_dev);
-    for (cntr = COLOR_RED; cntr < MAX_COLORS; cntr++) {
-        if (pb->types[cntr] == RGBW_PWM) {
-			pwm_disable(pb->pwm[cntr]);
-        }
-        if (pb->types[cntr] == RGBW_GPIO) {
-            __gpio_set_value(pb->soft_pwm[cntr].gpio, 0);
-            gpio_free(pb->soft_pwm[cntr].gpio);
-        }
-    }
-    unregister_reboot_notifier(&rgbw_reboot_nb);
-	atomic_notifier_chain_unregister(&panic_notifier_list, &rgbw_panic_nb);
+    unregister_reboot_notifier(&pb->reboot_nb);
+    atomic_notifier_chain_unregister(&panic_notifier_list, &pb->panic_nb);
+    rgbw_strip_unregister(pb);
     if (pb->exit)
         pb->exit(&pdev->dev);
-    return 0;
 }
 
 static struct platform_driver pwm_rgbw_driver = {
@@ -864,9 +1518,14 @@ static struct platform_driver pwm_rgbw_driver = {
         .name       = "rgbw-drv",
         .owner      = THIS_MODULE,
         .of_match_table = of_match_ptr(rgbw_of_match),
+        .probe_type = PROBE_PREFER_ASYNCHRONOUS,
     },
     .probe      = rgbw_dt_probe,
-    .remove     = rgbw_color_remove,
+    .remove_new = rgbw_color_remove,
 };
 
 module_platform_driver(pwm_rgbw_driver);
+
+#ifdef CONFIG_LEDS_RGBW_KUNIT_TEST
+#include "leds-rgbw-generic-test.c"
+#endif
@@ -0,0 +1,641 @@
+/*
+ * RGB+W LED Class Library
+ *
+ * Copyleft 2016 Tudor Design Systems, LLC.
+ *
+ * Author: Cody Tudor <cody.tudor@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * Hardware independent pieces of the class and the generic driver: the
+ * "#RRGGBB[WW]" parser, the effect state machines, the duty cycle math
+ * and the soft pwm edge computation. Nothing in here may sleep, lock,
+ * or touch a device so the same file also builds in userspace against
+ * the shim in tools/kshim for the benchmarks in tools/.
+ *
+ */
+
+#include "rgbw.h"
+#include <linux/kernel.h>
+#include <linux/module.h>
+#include <linux/errno.h>
+#include <linux/string.h>
+#include <linux/jiffies.h>
+
+/* Values to set our PWM channel every 50ms. These values are calculated
+ * using the Excel VB script:
+ * =TRUNC((EXP(SIN(B1 * 3.1415926 / 2)) - (1 / EXP(1)))*(255 / (EXP(1) - (1 / EXP(1)))))
+ * which is an adaptation of the natural equation:
+ * [e^sin(x * pi/2) - 1/e] * [255/(e - 1/e)] with x in seconds
+ *
+ * This "breathing" function gives us set of values between 0 - 255 that
+ * are cycled through at a fixed interval. In our case we set the
+ * interval to be 50ms. The pi/2 expression lengthens our period which can
+ * be decreased or increased by decreasing or increasing this multiplier
+ * respectively. Since the Linux kernel cannot perform floating point
+ * math we simply create a lookup table instead. For natural feel you
+ * must include one FULL period - 1 value i.e. from zero to the value
+ * before the next zero.
+ */
+static const unsigned int pulse_val_table[] = {
+    0, 1, 2, 3, 4, 6, 8, 10, 13, 16, 20,
+    24, 28, 34, 39, 45, 52, 60, 68, 77,
+    86, 97, 107, 119, 130, 143, 155, 167,
+    180, 192, 203, 214, 224, 233, 240, 246,
+    251, 254, 254, 254, 251, 246, 240, 233,
+    224, 214, 203, 192, 180, 167, 155, 143,
+    130, 119, 107, 97, 86, 77, 68, 60, 52,
+    45, 39, 34, 28, 24, 20, 16, 13, 10, 8,
+    6, 4, 3, 2, 1, 0, 0, 0, 0
+};
+
+/**
+ * rgbw_parse_html - parse a "#RRGGBB[WW]" color
+ * @buf: the string, a single trailing newline is allowed
+ * @count: length of @buf
+ * @levels: filled with the parsed levels in [R,G,B,W] order
+ *
+ * Returns the number of colors parsed (3 or 4) or -EINVAL if @buf is
+ * not in "#RRGGBB[WW]" format. levels[COLOR_WHITE] is left untouched
+ * when only three colors are given.
+ */
+int rgbw_parse_html(const char *buf, size_t count, unsigned int levels[MAX_COLORS])
+{
+    int colors, cntr, hi, lo;
+
+    if (count && buf[count - 1] == '\n')
+        count--;
+
+    if (count == 7)
+        colors = 3;
+    else if (count == 9)
+        colors = 4;
+    else
+        return -EINVAL;
+
+    if (buf[0] != '#')
+        return -EINVAL;
+
+    for (cntr = COLOR_RED; cntr < colors; cntr++) {
+        hi = hex_to_bin(buf[1 + 2 * cntr]);
+        lo = hex_to_bin(buf[2 + 2 * cntr]);
+        if ((hi < 0) || (lo < 0))
+            return -EINVAL;
+        levels[cntr] = (hi << 4) | lo;
+    }
+
+    return colors;
+}
+EXPORT_SYMBOL(rgbw_parse_html);
+
+/**
+ * rgbw_pulse_step - advance the pulse effect by one tick
+ * @props: the device's color properties
+ * @acts: the device's effect state, acts->pcolor is the pulsed color
+ *
+ * Returns the delay in ms until the next tick.
+ */
+unsigned int rgbw_pulse_step(struct rgbw_properties *props, struct rgbw_actions *acts)
+{
+    struct rgbw_properties *prop = &props[acts->pcolor];
+
+    if (prop->cntr >= ARRAY_SIZE(pulse_val_table))
+        prop->cntr = 0;
+    prop->brightness = pulse_val_table[prop->cntr];
+    prop->cntr++;
+
+    return PULSE_VALUE_PER_MS;
+}
+EXPORT_SYMBOL(rgbw_pulse_step);
+
+/**
+ * rgbw_blink_step - advance the blink effect by one tick
+ * @props: the device's color properties
+ * @acts: the device's effect state
+ *
+ * Toggles between off and the saved colors. Returns the delay in ms
+ * until the next tick.
+ */
+unsigned int rgbw_blink_step(struct rgbw_properties *props, struct rgbw_actions *acts)
+{
+    int bstate = acts->bstate;
+    int cntr;
+
+    for (cntr = COLOR_RED; cntr < MAX_COLORS; cntr++) {
+        props[cntr].brightness = (!bstate) ? 0 : acts->rgbw_values[cntr];
+    }
+    acts->bstate = (!bstate) ? 1 : 0;
+
+    return BLINK_STATE_PER_MS;
+}
+EXPORT_SYMBOL(rgbw_blink_step);
+
+/**
+ * rgbw_heartbeat_step - advance the heartbeat effect by one tick
+ * @props: the device's color properties
+ * @acts: the device's effect state
+ *
+ * Two short flashes of the saved colors followed by a long pause.
+ * Returns the delay in ms until the next tick.
+ */
+unsigned int rgbw_heartbeat_step(struct rgbw_properties *props, struct rgbw_actions *acts)
+{
+    int bstate = acts->bstate;
+    int cntr;
+
+    for (cntr = COLOR_RED; cntr < MAX_COLORS; cntr++) {
+        props[cntr].brightness = (bstate % 2) ? 0 : acts->rgbw_values[cntr];
+    }
+    acts->bstate = (bstate < 3) ? bstate + 1 : 0;
+
+    return (bstate < 3) ? 100 : 700;
+}
+EXPORT_SYMBOL(rgbw_heartbeat_step);
+
+/* x * y / 0xffff rounded, both factors 16 bit so the product fits a u32 */
+static inline u32 rgbw_mul16(u32 x, u32 y)
+{
+    return (x * y + 0x7fff) / 0xffff;
+}
+
+/**
+ * rgbw_hsv_to_rgb - fixed point HSV to RGB conversion
+ * @hue: 0..0xffff is one full turn of the color wheel, 0 is red
+ * @sat: saturation, 0..0xffff
+ * @val: value, 0..0xffff
+ * @rgb: full scale 16 bit [R,G,B] result
+ *
+ * Integer only and branch light so the rainbow can afford one call per
+ * frame from timer context.
+ */
+void rgbw_hsv_to_rgb(u16 hue, u16 sat, u16 val, u16 rgb[3])
+{
+    u32 sector = (u32)hue * 6;
+    u32 f = sector & 0xffff;
+    u16 p, q, t;
+
+    p = rgbw_mul16(val, 0xffff - sat);
+    q = rgbw_mul16(val, 0xffff - rgbw_mul16(sat, f));
+    t = rgbw_mul16(val, 0xffff - rgbw_mul16(sat, 0xffff - f));
+
+    switch (sector >> 16) {
+        case 0:
+            rgb[0] = val; rgb[1] = t; rgb[2] = p;
+            break;
+        case 1:
+            rgb[0] = q; rgb[1] = val; rgb[2] = p;
+            break;
+        case 2:
+            rgb[0] = p; rgb[1] = val; rgb[2] = t;
+            break;
+        case 3:
+            rgb[0] = p; rgb[1] = q; rgb[2] = val;
+            break;
+        case 4:
+            rgb[0] = t; rgb[1] = p; rgb[2] = val;
+            break;
+        default:
+            rgb[0] = val; rgb[1] = p; rgb[2] = q;
+            break;
+    };
+}
+EXPORT_SYMBOL(rgbw_hsv_to_rgb);
+
+/**
+ * rgbw_hsl_to_hsv - convert HSL saturation and lightness to HSV
+ * @sat: HSL saturation, 0..0xffff
+ * @light: HSL lightness, 0..0xffff
+ * @hsv_sat: resulting HSV saturation
+ * @hsv_val: resulting HSV value
+ *
+ * Hue is the same in both models, so HSL input is just this followed
+ * by rgbw_hsv_to_rgb().
+ */
+void rgbw_hsl_to_hsv(u16 sat, u16 light, u16 *hsv_sat, u16 *hsv_val)
+{
+    u32 val = light + rgbw_mul16(sat, min_t(u32, light, 0xffff - light));
+
+    *hsv_val = val;
+    /* (val - light) is at most val / 2, so this stays within 16 bits */
+    *hsv_sat = val ? ((val - light) * 0x1fffe + val / 2) / val : 0;
+}
+EXPORT_SYMBOL(rgbw_hsl_to_hsv);
+
+/**
+ * rgbw_rainbow_step - advance the rainbow effect by one frame
+ * @props: the device's color properties
+ * @acts: the device's effect state, acts->rb_* configure the wheel
+ *
+ * The hue is taken from the time elapsed since the effect started, so
+ * the speed is set by acts->rb_period alone and a late frame never
+ * slows the wheel down. acts->bstate holds the wheel sector (0..5) and
+ * is INVALID_COLOR before the first frame. White is kept off. Returns
+ * the delay in ms until the next frame.
+ */
+unsigned int rgbw_rainbow_step(struct rgbw_properties *props, struct rgbw_actions *acts)
+{
+    unsigned int elapsed, period = acts->rb_period ? acts->rb_period : RAINBOW_PERIOD_MS;
+    u16 rgb[3];
+    u16 hue;
+    int cntr;
+
+    if (acts->bstate < 0 || acts->bstate > 5)
+        acts->rb_start = jiffies;
+
+    elapsed = jiffies_to_msecs(jiffies - acts->rb_start);
+    if (elapsed >= period) {
+        /* move the start up to the current turn so elapsed never wraps */
+        acts->rb_start += msecs_to_jiffies(elapsed - elapsed % period);
+        elapsed %= period;
+    }
+    hue = div_u64((u64)elapsed << 16, period);
+
+    rgbw_hsv_to_rgb(hue, acts->rb_sat, acts->rb_val, rgb);
+    for (cntr = COLOR_RED; cntr < COLOR_WHITE; cntr++) {
+        rgbw_set_fine(&props[cntr], rgbw_level16_to_fine(rgb[cntr],
+                      props[cntr].max_brightness));
+    }
+    rgbw_set_fine(&props[COLOR_WHITE], 0);
+    acts->bstate = ((u32)hue * 6) >> 16;
+
+    return RAINBOW_FRAME_PER_MS;
+}
+EXPORT_SYMBOL(rgbw_rainbow_step);
+
+/**
+ * rgbw_fold_duty - build the hard pwm duty table of a device
+ * @levels: optional brightness-levels table, indexed by brightness
+ * @max: max_brightness, @levels and @duty hold @max + 1 entries
+ * @dimmer: master intensity to fold in, 0..RGBW_DIM_FULL
+ * @duty: filled with the share of the pwm period for each brightness
+ *        in Q31, 1 << 31 being the whole period
+ *
+ * Brightness 1 gets one level step and @max the whole period, and the
+ * table is then scaled by @dimmer. Drivers rebuild it when the dimmer
+ * moves so an update, hard or soft pwm, is a lookup only.
+ */
+void rgbw_fold_duty(const unsigned int *levels, unsigned int max,
+        unsigned int dimmer, u32 *duty)
+{
+    unsigned int top = (levels) ? levels[max] : max;
+    u64 step, share;
+    unsigned int cntr;
+
+    if (!top)
+        top = 1;
+    step = div_u64(1ULL << 31, top);
+
+    duty[0] = 0;
+    for (cntr = 1; cntr <= max; cntr++) {
+        share = div_u64((u64)((levels) ? levels[cntr] : cntr) << 31, top);
+        share = min_t(u64, step + share - div_u64(share, top), 1ULL << 31);
+        duty[cntr] = div_u64(share * dimmer + RGBW_DIM_FULL / 2, RGBW_DIM_FULL);
+    }
+}
+EXPORT_SYMBOL(rgbw_fold_duty);
+
+/**
+ * rgbw_duty_cycle - hard pwm duty cycle for a brightness
+ * @brightness: requested brightness, 0 to @max
+ * @frac: 16 bit fraction of a step above @brightness, see rgbw_get_frac()
+ * @max: max_brightness of the color
+ * @duty: duty table built by rgbw_fold_duty()
+ * @period: pwm period in ns
+ *
+ * A fraction interpolates between the duty cycles of @brightness and
+ * the step above it, from 0 ns when @brightness is 0, so the pwm gets
+ * whatever resolution it has in ns rather than just @max steps.
+ *
+ * Returns the duty cycle in ns.
+ */
+unsigned int rgbw_duty_cycle(unsigned int brightness, unsigned int frac, unsigned int max,
+        const u32 *duty, unsigned int period)
+{
+    s64 base = ((u64)duty[brightness] * period) >> 31;
+    s64 next;
+
+    if (!frac || brightness >= max)
+        return base;
+
+    /* descending brightness-levels make next the lower one */
+    next = ((u64)duty[brightness + 1] * period) >> 31;
+    return base + (((next - base) * frac) >> 16);
+}
+EXPORT_SYMBOL(rgbw_duty_cycle);
+
+/**
+ * rgbw_soft_pwm_edge - next edge of a soft pwm channel
+ * @brightness: current brightness of the color
+ * @frac: 16 bit fraction of a step above @brightness, see rgbw_get_frac()
+ * @max: level that holds the pin on for the whole period, normally
+ *       max_brightness of the color
+ * @period: pwm period in ns
+ * @duty: duty table built by rgbw_fold_duty(), the same one the hard
+ *        pwms of the device use
+ * @value: current pin value, updated to the value to drive now
+ * @dither: per channel dither state, zero it to start over
+ *
+ * The fraction is dithered over pwm periods: every period adds @frac to
+ * an error accumulator and runs one step brighter whenever it carries,
+ * so over 65536 periods the average on time is that of @brightness plus
+ * @frac / 65536 of the way to the next step. Bit 16 of @dither remembers
+ * the carry for the falling edge of the same period. The step to @max is
+ * not dithered, a full period on has no falling edge.
+ *
+ * Returns the time in ns until the following edge, or 0 when the
+ * channel is fully on or off and no further edge is needed.
+ */
+u64 rgbw_soft_pwm_edge(unsigned int brightness, unsigned int frac, unsigned int max,
+        unsigned int period, const u32 *duty, int *value, u32 *dither)
+{
+    u64 on_time;
+
+    if (brightness >= max) {
+        *value = 1;
+        return 0;
+    }
+    if (brightness == 0 && frac == 0) {
+        *value = 0;
+        return 0;
+    }
+
+    *value = 1 - *value;
+    if (*value) {
+        /* rising edge, a new period */
+        *dither = (*dither & 0xffff) + ((brightness + 1 < max) ? frac : 0);
+    }
+    on_time = ((u64)duty[brightness + (*dither >> 16)] * period) >> 31;
+    if (!on_time) {
+        /* dithered down to off for this whole period */
+        *value = 0;
+        return period;
+    }
+    if (on_time >= period) {
+        /* brightness-levels reaching that of max early, on for the whole period */
+        *value = 1;
+        return period;
+    }
+    return (*value) ? on_time : (period - on_time);
+}
+EXPORT_SYMBOL(rgbw_soft_pwm_edge);
+
+/**
+ * rgbw_power_draw - supply current of one frame
+ * @out: 16.16 levels about to be driven
+ * @max: max_brightness per color
+ * @current_ua: draw of each color fully on in uA, at most RGBW_MAX_CURRENT_UA
+ * @dimmer: master dimmer the driver applies after @out, 0..RGBW_DIM_FULL
+ *
+ * The current is taken as linear in the level, which errs on the safe
+ * side for brightness-levels curves below the diagonal.
+ *
+ * Returns the draw in uA.
+ */
+unsigned long rgbw_power_draw(const u32 out[MAX_COLORS], const int max[MAX_COLORS],
+        const unsigned int current_ua[MAX_COLORS], unsigned int dimmer)
+{
+    u64 draw = 0;
+    int cntr;
+
+    for (cntr = COLOR_RED; cntr < MAX_COLORS; cntr++) {
+        if (current_ua[cntr] && max[cntr] > 0)
+            draw += div_u64((u64)out[cntr] * current_ua[cntr], max[cntr]) >> 16;
+    }
+    return div_u64(draw * dimmer, RGBW_DIM_FULL);
+}
+EXPORT_SYMBOL(rgbw_power_draw);
+
+/**
+ * rgbw_power_scale - proportional scale keeping a draw within budget
+ * @draw_ua: requested draw
+ * @budget_ua: budget, 0 for none
+ *
+ * Returns the Q16 scale for every color, RGBW_POWER_ONE when within budget.
+ */
+u32 rgbw_power_scale(unsigned long draw_ua, unsigned int budget_ua)
+{
+    if (!budget_ua || draw_ua <= budget_ua)
+        return RGBW_POWER_ONE;
+    return div64_u64((u64)budget_ua << 16, draw_ua);
+}
+EXPORT_SYMBOL(rgbw_power_scale);
+
+/**
+ * rgbw_levels_count - size of an interpolated brightness-levels table
+ * @npoints: number of control points
+ * @steps: levels from one control point to the next, 0 or 1 for none
+ */
+unsigned int rgbw_levels_count(unsigned int npoints, unsigned int steps)
+{
+    if (npoints < 2 || steps < 2)
+        return npoints;
+    return (npoints - 1) * steps + 1;
+}
+EXPORT_SYMBOL(rgbw_levels_count);
+
+/**
+ * rgbw_interpolate_levels - expand sparse brightness-levels
+ * @points: control points, in either direction
+ * @npoints: number of control points
+ * @steps: levels from one control point to the next, 0 or 1 for none
+ * @table: filled with rgbw_levels_count(@npoints, @steps) entries
+ *
+ * Each pair of control points is joined linearly, the same way pwm_bl
+ * handles num-interpolated-steps, and the table ends on the last point.
+ */
+void rgbw_interpolate_levels(const u32 *points, unsigned int npoints,
+        unsigned int steps, unsigned int *table)
+{
+    unsigned int point, step;
+    s64 delta;
+
+    if (rgbw_levels_count(npoints, steps) == npoints) {
+        memcpy(table, points, npoints * sizeof(*table));
+        return;
+    }
+
+    for (point = 0; point < npoints - 1; point++) {
+        delta = (s64)points[point + 1] - points[point];
+        for (step = 0; step < steps; step++) {
+            table[point * steps + step] = points[point] + div_s64(delta * step, steps);
+        }
+    }
+    table[(npoints - 1) * steps] = points[npoints - 1];
+}
+EXPORT_SYMBOL(rgbw_interpolate_levels);
+
+/**
+ * rgbw_correct - white extraction and color correction of one frame
+ * @corr: the device's output stage
+ * @in: requested levels, 16.16 fixed point brightness per color
+ * @max: max_brightness per color
+ * @out: filled with the corrected levels, in the same format
+ *
+ * With white extraction the common part of red, green and blue moves
+ * to white first; the matrix then maps the four levels to the four
+ * emitters. Results are clamped to 0 - max.
+ */
+void rgbw_correct(const struct rgbw_correction *corr, const u32 in[MAX_COLORS],
+        const int max[MAX_COLORS], u32 out[MAX_COLORS])
+{
+    s64 level[MAX_COLORS];
+    s64 acc, white;
+    int i, j;
+
+    for (i = COLOR_RED; i < MAX_COLORS; i++) {
+        level[i] = in[i];
+    }
+
+    if (corr->white_extract) {
+        white = min(level[COLOR_RED], min(level[COLOR_GREEN], level[COLOR_BLUE]));
+        level[COLOR_RED] -= white;
+        level[COLOR_GREEN] -= white;
+        level[COLOR_BLUE] -= white;
+        level[COLOR_WHITE] += white;
+    }
+
+    for (i = COLOR_RED; i < MAX_COLORS; i++) {
+        if (corr->identity) {
+            acc = level[i];
+        }
+        else {
+            acc = 0;
+            for (j = COLOR_RED; j < MAX_COLORS; j++) {
+                acc += (s64)corr->matrix[i][j] * level[j];
+            }
+            acc >>= 16;
+        }
+        out[i] = clamp_t(s64, acc, 0, (s64)max[i] << 16);
+    }
+}
+EXPORT_SYMBOL(rgbw_correct);
+
+/* Breathing curve of the pulse table at phase 0..0xffff, interpolated */
+static u16 rgbw_pulse_wave(u32 phase)
+{
+    u32 pos = phase * (ARRAY_SIZE(pulse_val_table) - 1);
+    unsigned int idx = pos >> 16;
+    u32 a = pulse_val_table[idx];
+    u32 b = pulse_val_table[idx + 1];
+    u32 frac = pos & 0xffff;
+
+    return ((a << 16) + (b - a) * frac) / 255 * 0xffff >> 16;
+}
+
+/**
+ * rgbw_layer_eval - levels of one layer at a point in time
+ * @layer: the layer, its start is moved up to the current cycle
+ * @now: time of the frame in jiffies
+ * @val: filled with the full scale 16 bit level of each color
+ *
+ * Pulse follows the same breathing curve as the pulse effect, blink is
+ * on for the first half of the cycle and heartbeat gives two flashes in
+ * the first 300 ms of each second, stretched to the period. Rainbow
+ * turns the hue once per cycle and keeps white off.
+ */
+void rgbw_layer_eval(struct rgbw_layer *layer, unsigned long now, u16 val[MAX_COLORS])
+{
+    unsigned int elapsed, period = layer->period ? layer->period : 1;
+    u32 phase = 0;
+    u16 rgb[3];
+    u16 wave;
+    int cntr;
+
+    if (layer->effect != RGBW_LAYER_SOLID) {
+        elapsed = jiffies_to_msecs(now - layer->start);
+        if (elapsed >= period) {
+            /* same as the rainbow, elapsed never wraps */
+            layer->start += msecs_to_jiffies(elapsed - elapsed % period);
+            elapsed %= period;
+        }
+        phase = div_u64((u64)elapsed << 16, period);
+    }
+
+    switch (layer->effect) {
+        case RGBW_LAYER_PULSE:
+            wave = rgbw_pulse_wave(phase);
+            break;
+        case RGBW_LAYER_BLINK:
+            wave = (phase < 0x8000) ? 0xffff : 0;
+            break;
+        case RGBW_LAYER_HEARTBEAT:
+            /* 100 ms on, off, on, then 700 ms off like the effect */
+            wave = ((phase * 10 >> 16) == 0 || (phase * 10 >> 16) == 2) ? 0xffff : 0;
+            break;
+        case RGBW_LAYER_RAINBOW:
+            rgbw_hsv_to_rgb(phase, 0xffff, 0xffff, rgb);
+            for (cntr = COLOR_RED; cntr < COLOR_WHITE; cntr++) {
+                val[cntr] = rgbw_mul16(rgb[cntr], layer->levels[cntr]);
+            }
+            val[COLOR_WHITE] = 0;
+            return;
+        default:
+            wave = 0xffff;
+            break;
+    }
+
+    for (cntr = COLOR_RED; cntr < MAX_COLORS; cntr++) {
+        val[cntr] = rgbw_mul16(wave, layer->levels[cntr]);
+    }
+}
+EXPORT_SYMBOL(rgbw_layer_eval);
+
+/**
+ * rgbw_compose - blend effect layers over the requested levels
+ * @layers: the layers, bottom first, RGBW_LAYER_OFF ones are skipped
+ * @nlayers: number of layers
+ * @now: time of the frame in jiffies
+ * @max: max_brightness per color
+ * @io: 16.16 levels, the requested ones in and the composed ones out
+ *
+ * Each layer is blended per color in its mask over the result of the
+ * layers below it. Add clamps to max, multiply scales by the layer's
+ * level as a fraction of full scale.
+ */
+void rgbw_compose(struct rgbw_layer *layers, unsigned int nlayers, unsigned long now,
+    const int max[MAX_COLORS], u32 io[MAX_COLORS])
+{
+    struct rgbw_layer *layer;
+    u16 val[MAX_COLORS];
+    u32 level, full;
+    unsigned int idx;
+    int cntr;
+
+    for (idx = 0; idx < nlayers; idx++) {
+        layer = &layers[idx];
+        if (layer->effect == RGBW_LAYER_OFF)
+            continue;
+        rgbw_layer_eval(layer, now, val);
+
+        for (cntr = COLOR_RED; cntr < MAX_COLORS; cntr++) {
+            if (!(layer->mask & (1 << cntr)))
+                continue;
+            full = (u32)max[cntr] << 16;
+            level = rgbw_level16_to_fine(val[cntr], max[cntr]);
+
+            switch (layer->blend) {
+                case RGBW_BLEND_ADD:
+                    io[cntr] = min_t(u64, (u64)io[cntr] + level, full);
+                    break;
+                case RGBW_BLEND_MULTIPLY:
+                    io[cntr] = div_u64((u64)io[cntr] * val[cntr] + 0x7fff, 0xffff);
+                    break;
+                case RGBW_BLEND_MAX:
+                    io[cntr] = max(io[cntr], level);
+                    break;
+                default:
+                    io[cntr] = level;
+                    break;
+            }
+        }
+    }
+}
+EXPORT_SYMBOL(rgbw_compose);
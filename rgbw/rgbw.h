@@ -22,11 +22,39 @@
 #include <linux/kernel.h>
 #include <linux/module.h> 
 #include <linux/device.h>    
+#include <linux/cdev.h>
+#include <linux/workqueue.h>
+#include <linux/srcu.h>
+#include <linux/version.h>
+#include "rgbw_uapi.h"
+/* pwm_apply_might_sleep(), class_create(name) and one argument __assign_str() */
+#if LINUX_VERSION_CODE < KERNEL_VERSION(6, 10, 0)
+#error "the rgbw driver needs Linux 6.10 or newer"
+#endif
+#if IS_REACHABLE(CONFIG_LEDS_CLASS)
+#include <linux/leds.h>
+#endif
+#if IS_REACHABLE(CONFIG_LEDS_CLASS_MULTICOLOR)
+#define RGBW_LED_MULTICOLOR     1
+#include <linux/led-class-multicolor.h>
+#else
+#define RGBW_LED_MULTICOLOR     0
+#endif
 
 /* Notes on locking:
  *
- * rgbw_device->ops_lock is an internal backlight lock protecting the
- * ops pointer and no code outside the core should need to touch it.
+ * rgbw_device->ops is RCU managed: readers look it up with rgbw_get_ops()
+ * inside rgbw_ops_read_lock(), writers hold ops_lock, and unregistering
+ * waits out the readers before it returns. That only covers the calls
+ * the class makes: a driver's effect timers and soft pwm reach its
+ * update path without going through ops, so the driver has to stop
+ * them itself before calling rgbw_device_unregister().
+ *
+ * rgbw_device->ops_lock is internal to the core and serialises changes
+ * made in several steps: starting and stopping effects, fades, scenes
+ * and the set_period()/set_dimmer() hooks. The color stores hold it too,
+ * so an effect can not start between their check and their write. No
+ * code outside the core should need to touch it.
  *
  * Access to update_status() is serialised by the update_lock mutex since
  * most drivers seem to need this and historically get it wrong.
@@ -41,6 +69,16 @@
 /* Types */
 #define PULSE_VALUE_PER_MS 50
 #define BLINK_STATE_PER_MS 750
+#define TRANSITION_STEP_PER_MS 20
+/* LED class writes are coalesced to at most one update per frame */
+#define LED_FRAME_PER_MS 20
+#define RAINBOW_FRAME_PER_MS 20
+/* master dimmer, see rgbw_ops.set_dimmer */
+#define RGBW_DIM_FULL 0xffff
+/* dim groups shared across devices, group 0 is none */
+#define RGBW_DIM_GROUPS 16
+/* one turn of the old one step per tick rainbow on an 8 bit channel */
+#define RAINBOW_PERIOD_MS (6 * 255 * PULSE_VALUE_PER_MS)
 
 enum rgbw_colors {
     COLOR_RED = 0,
@@ -68,13 +106,51 @@ enum timer_type {
 
 struct rgbw_device;
 
+#if IS_REACHABLE(CONFIG_LEDS_CLASS)
+/* One color of a strip as an LED class device, see rgbw_register_leds() */
+struct rgbw_led {
+    struct led_classdev cdev;
+    struct rgbw_device *rgbw_dev;
+    int color;
+    /* share of each channel it drives, 255 is all of it, under led_lock */
+    u8 weight[MAX_COLORS];
+    char name[32];
+};
+#endif
+
 struct rgbw_ops {
     unsigned int options;
 
 #define RGBW_CORE_SUSPENDRESUME   (1 << 0)
 
+    /* 
+     * Optional, called once from rgbw_device_register() before the
+     * device's sysfs and /dev nodes show up, to set up whatever
+     * update_status() and the driver's effect timers use. Failing it
+     * fails the registration.
+     */
+    int (*init)(struct rgbw_device *);
     /* Notify the RGBW driver some property has changed */
     int (*update_status)(struct rgbw_device *);
+    /* 
+     * Optional, change the pwm period of one color in ns. Called with
+     * ops_lock held and followed by update_status; the driver applies
+     * it at the color's next period boundary.
+     */
+    int (*set_period)(struct rgbw_device *, int color, unsigned int period);
+    /* 
+     * Optional, tell whether set_period() would take this period for
+     * color, without applying it. Lets a write to several colors be
+     * refused before any of them changes. Called with ops_lock held.
+     */
+    int (*check_period)(struct rgbw_device *, int color, unsigned int period);
+    /* 
+     * Optional, master intensity 0..RGBW_DIM_FULL applied after effects
+     * and color correction. Called with ops_lock held and followed by
+     * update_status; the driver folds it into its level tables here so
+     * that updates themselves never pay for it.
+     */
+    int (*set_dimmer)(struct rgbw_device *, unsigned int level);
 };
 
 struct rgbw_actions {
@@ -85,11 +161,36 @@ struct rgbw_actions {
     /* previous state to restore after function stops */
     unsigned int rgbw_values[MAX_COLORS];
     unsigned int state;
+    /* effect flags parked here while the device is suspended */
+    unsigned int saved_state;
+    /* rainbow: start of the current turn in jiffies and its length in ms */
+    unsigned long rb_start;
+    unsigned int rb_period;
+    /* rainbow saturation and value, 0..0xffff */
+    u16 rb_sat;
+    u16 rb_val;
 
 #define RGBW_PULSE_ON           (1 << 0)
 #define RGBW_BLINK_ON           (1 << 1)
 #define RGBW_HB_ON              (1 << 2)
 #define RGBW_RB_ON              (1 << 3)
+#define RGBW_EFFECTS_MASK       (RGBW_PULSE_ON | RGBW_BLINK_ON | \
+                                 RGBW_HB_ON | RGBW_RB_ON)
+};
+
+/* A pending or running RGBW_IOC_SET fade, stepped from a work item */
+struct rgbw_transition {
+    /* colors being changed, 0 when idle */
+    unsigned int mask;
+    /* 16.16 fixed point brightness, see rgbw_set_fine() */
+    u32 from[MAX_COLORS];
+    u32 to[MAX_COLORS];
+    /* set once the apply time is reached and the fade has begun */
+    bool started;
+    unsigned long start;
+    /* length of the fade in jiffies */
+    unsigned long duration;
+    struct delayed_work work;
 };
 
 /* This structure defines all the properties of a backlight */
@@ -104,12 +205,195 @@ struct rgbw_properties {
     enum rgbw_colors color;
     /* RGBW type */
     enum rgbw_type type;
+    /* pwm period in ns, 0 if the driver does not report one */
+    unsigned int period;
     /* Flags used to signal drivers of state changes */
     /* Upper 4 bits are reserved for driver internal use */
     unsigned int state;
 
 #define RGBW_CORE_SUSPENDED     (1 << 0)    /* rgbw is suspended */
 
+    /* 
+     * Brightness in 16.16 fixed point as last set by rgbw_set_fine().
+     * Only valid while its integer part still equals brightness, so
+     * any other path writing brightness drops the fraction.
+     */
+    u32 fine;
+};
+
+static inline void rgbw_set_fine(struct rgbw_properties *prop, u32 fine)
+{
+    prop->fine = fine;
+    prop->brightness = fine >> 16;
+}
+
+static inline u32 rgbw_get_fine(const struct rgbw_properties *prop)
+{
+    u32 fine = READ_ONCE(prop->fine);
+
+    return ((fine >> 16) == prop->brightness) ? fine : (u32)prop->brightness << 16;
+}
+
+/* The 16 bit fraction of a step above brightness the driver should dither */
+static inline unsigned int rgbw_get_frac(const struct rgbw_properties *prop)
+{
+    return rgbw_get_fine(prop) & 0xffff;
+}
+
+/* Scale a full scale 16 bit level to 16.16 brightness on a 0..max channel */
+static inline u32 rgbw_level16_to_fine(u16 level, unsigned int max)
+{
+    return div_u64(((u64)level * max) << 16, 0xffff);
+}
+
+/* Counters reported by the "stats" attribute, never reset */
+struct rgbw_stats {
+    /* calls to ops->update_status made by the class */
+    atomic_long_t updates;
+    /* pwm and gpio writes reported by the driver */
+    atomic_long_t hw_writes;
+};
+
+#define RGBW_MATRIX_ONE         (1 << 16)   /* 1.0 in the Q16 correction matrix */
+#define RGBW_MATRIX_MAX         (4 << 16)   /* largest coefficient, keeps the math in s64 */
+
+/*
+ * Output stage between the requested levels and the driver, see
+ * rgbw_set_correction(). While it is not active the driver reads props
+ * directly and the stage costs nothing.
+ */
+struct rgbw_correction {
+    spinlock_t lock;
+    bool active;
+    /* move min(R,G,B) into the white channel first */
+    bool white_extract;
+    bool identity;
+    /* out[i] = sum(matrix[i][j] * in[j]) >> 16 */
+    s32 matrix[MAX_COLORS][MAX_COLORS];
+};
+
+/* Q16 scale of the power limiter, RGBW_POWER_ONE leaves the output alone */
+#define RGBW_POWER_ONE          (1 << 16)
+/* largest per color current accepted, keeps the draw math in 64 bits */
+#define RGBW_MAX_CURRENT_UA     100000000
+/* supplies shared by several devices, group 0 is none */
+#define RGBW_SUPPLY_GROUPS      16
+
+/* Power budget of a device, set with rgbw_set_power_limit() */
+struct rgbw_power {
+    /* some color draws current and there is a budget to keep */
+    bool enabled;
+    /* draw of each color fully on, in uA */
+    unsigned int current_ua[MAX_COLORS];
+    /* device budget in uA, 0 for none */
+    unsigned int budget_ua;
+    /* supply group, its budget is shared by every device in it */
+    unsigned int group;
+    /* requested draw of the last frame, already counted in the group */
+    unsigned long draw_ua;
+    /* Q16 scale applied to the last frame */
+    u32 scale;
+};
+
+#define RGBW_MAX_COOLING_STATES 16
+
+struct thermal_cooling_device;
+
+/* Thermal derating, see rgbw_register_cooling() */
+struct rgbw_thermal {
+    struct thermal_cooling_device *cdev;
+    unsigned int nstates;
+    unsigned long state;
+    /* Q16 output ceiling of each cooling state, state 0 first */
+    u32 scale[RGBW_MAX_COOLING_STATES];
+    /* scale[state], RGBW_POWER_ONE while not derated */
+    u32 cur_scale;
+};
+
+/* layers of the effect compositor, see rgbw_set_layer() */
+#define RGBW_LAYERS             8
+#define COMPOSE_FRAME_PER_MS    20
+
+enum rgbw_layer_effect {
+    RGBW_LAYER_OFF = 0,
+    RGBW_LAYER_SOLID,
+    RGBW_LAYER_PULSE,
+    RGBW_LAYER_BLINK,
+    RGBW_LAYER_HEARTBEAT,
+    RGBW_LAYER_RAINBOW,
+    RGBW_LAYER_MAX,
+};
+
+/* How a layer is combined with the result of the layers below it */
+enum rgbw_blend {
+    RGBW_BLEND_REPLACE = 0,
+    RGBW_BLEND_ADD,
+    RGBW_BLEND_MULTIPLY,
+    RGBW_BLEND_MAX,
+    RGBW_BLEND_INVALID,
+};
+
+/* One effect layer, its waveform is taken from the time since start */
+struct rgbw_layer {
+    enum rgbw_layer_effect effect;
+    enum rgbw_blend blend;
+    /* RGBW_CH_* the layer touches, the others pass through */
+    unsigned int mask;
+    /* full scale 16 bit color the waveform is scaled to */
+    u16 levels[MAX_COLORS];
+    /* one cycle of the waveform in ms, unused by solid layers */
+    unsigned int period;
+    unsigned long start;
+};
+
+/*
+ * Layers blended in order over the requested levels as the first step
+ * of the output stage, so any number of them costs one pass per frame.
+ * Guarded by corr.lock.
+ */
+struct rgbw_compositor {
+    /* some layer is on */
+    bool active;
+    /* some layer moves, work then runs the output every frame */
+    bool animated;
+    struct rgbw_layer layers[RGBW_LAYERS];
+    struct delayed_work work;
+};
+
+/* preset slots of each device, see the "scene" attribute */
+#define RGBW_SCENES             8
+
+/* A stored preset, recalled as a whole by one write */
+struct rgbw_scene {
+    bool valid;
+    /* 16.16 levels, also what an effect blinks or restores to */
+    u32 levels[MAX_COLORS];
+    /* one of RGBW_*_ON or 0, and the parameters it runs with */
+    unsigned int effect;
+    int pcolor;
+    unsigned int rb_period;
+    u16 rb_sat;
+    u16 rb_val;
+    /* fade from the current levels, scenes without an effect only */
+    unsigned int transition_ms;
+};
+
+#define RGBW_LAT_BUCKETS        20      /* log2 us buckets, the last one is open ended */
+
+/*
+ * Write to light latency, see the "latency" attribute. The class stamps
+ * every channel when an update is requested and the driver records the
+ * delay once the new level reaches the pwm or the gpio pin.
+ */
+struct rgbw_latency {
+    bool enabled;
+    /* taken from the soft pwm hrtimer as well */
+    spinlock_t lock;
+    /* request time in ns per color, 0 once applied */
+    u64 stamp[MAX_COLORS];
+    unsigned long buckets[RGBW_LAT_BUCKETS];
+    unsigned long samples;
+    u64 max_ns;
 };
 
 struct rgbw_device {
@@ -120,33 +404,204 @@ struct rgbw_device {
     
     struct rgbw_actions acts;
     
+    /* deferred and faded updates requested through the char device */
+    struct rgbw_transition trans;
+    
     /* Serialise access to update_status method */
     struct mutex update_lock;
 
-    /* This protects the 'ops' field. If 'ops' is NULL, the driver that
-       registered this device has been unloaded, and if class_get_devdata()
-       points to something in the body of that driver, it is also invalid. */
+    /* Serialises multi step state changes, see the notes on locking */
     struct mutex ops_lock;
-    const struct rgbw_ops *ops;
+    /* If 'ops' is NULL, the driver that registered this device has been
+       unloaded, and if class_get_devdata() points to something in the
+       body of that driver, it is also invalid. Read under ops_srcu. */
+    const struct rgbw_ops __rcu *ops;
+    struct srcu_struct ops_srcu;
 
     struct device dev;
+    /* /dev node taking the RGBW_IOC_* ioctls */
+    struct cdev cdev;
 
     int use_count;
+
+    /* State change counter reported by the binary "state" attribute */
+    atomic_t seq;
+    /* sysfs node of "state", notified on every change for poll() */
+    struct kernfs_node *state_kn;
+    /* levels of the last netlink multicast, for its channel mask */
+    u32 nl_levels[MAX_COLORS];
+
+    struct rgbw_stats stats;
+    struct rgbw_latency lat;
+
+    struct rgbw_correction corr;
+    struct rgbw_compositor comp;
+    /* power limiter and thermal derating, run in the output stage under corr.lock */
+    struct rgbw_power power;
+    struct rgbw_thermal thermal;
+    /* corrected 16.16 levels the driver drives while corr.active */
+    u32 out[MAX_COLORS];
+
+    /* master intensity 0..RGBW_DIM_FULL, scaled by that of dim_group */
+    unsigned int dimmer;
+    unsigned int dim_group;
+    /* the resulting level last handed to ops->set_dimmer */
+    unsigned int dim_level;
+
+    /* preset slots and the one last recalled, -1 for none, under ops_lock */
+    struct rgbw_scene scenes[RGBW_SCENES];
+    int scene;
+
+#if IS_REACHABLE(CONFIG_LEDS_CLASS)
+    /* LED class view of each color, see rgbw_register_leds() */
+    struct rgbw_led led[MAX_COLORS];
+    /* LED writes wait here for the next frame, under led_lock */
+    spinlock_t led_lock;
+    unsigned int led_dirty;
+    u32 led_level[MAX_COLORS];
+    /* jiffies of the last frame that applied them */
+    unsigned long led_last;
+    struct delayed_work led_work;
+#endif
+#if RGBW_LED_MULTICOLOR
+    /* and of the whole strip, its multi_intensity being the color */
+    struct led_classdev_mc mc;
+    struct mc_subled subled[MAX_COLORS];
+    char led_name[32];
+#endif
 };
 
+/* 16.16 level the driver should drive for color, see rgbw_update_output() */
+static inline u32 rgbw_get_output(const struct rgbw_device *rgbw_dev, int color)
+{
+    if (READ_ONCE(rgbw_dev->corr.active))
+        return READ_ONCE(rgbw_dev->out[color]);
+    return rgbw_get_fine(&rgbw_dev->props[color]);
+}
+
 
 /* Global public functions */
 
+extern void __rgbw_latency_stamp(struct rgbw_device *rgbw_dev);
+extern void __rgbw_latency_record(struct rgbw_device *rgbw_dev, int color);
+
+static inline void rgbw_latency_stamp(struct rgbw_device *rgbw_dev)
+{
+    if (unlikely(READ_ONCE(rgbw_dev->lat.enabled)))
+        __rgbw_latency_stamp(rgbw_dev);
+}
+
+/* Drivers call this once a new level of color is live on the hardware */
+static inline void rgbw_latency_record(struct rgbw_device *rgbw_dev, int color)
+{
+    if (unlikely(READ_ONCE(rgbw_dev->lat.enabled)))
+        __rgbw_latency_record(rgbw_dev, color);
+}
+
+static inline int rgbw_ops_read_lock(struct rgbw_device *rgbw_dev)
+{
+    return srcu_read_lock(&rgbw_dev->ops_srcu);
+}
+
+static inline void rgbw_ops_read_unlock(struct rgbw_device *rgbw_dev, int idx)
+{
+    srcu_read_unlock(&rgbw_dev->ops_srcu, idx);
+}
+
+/* The driver's ops, NULL once it is gone. Inside rgbw_ops_read_lock() or under ops_lock */
+static inline const struct rgbw_ops *rgbw_get_ops(struct rgbw_device *rgbw_dev)
+{
+    return srcu_dereference_check(rgbw_dev->ops, &rgbw_dev->ops_srcu,
+                                  lockdep_is_held(&rgbw_dev->ops_lock));
+}
+
+/* Does nothing once the driver is gone, callers need no lock to use it */
 static inline void rgbw_update_status(struct rgbw_device *rgbw_dev)
 {
-    mutex_lock(&rgbw_dev->update_lock);
-    if (rgbw_dev->ops && rgbw_dev->ops->update_status)
-        rgbw_dev->ops->update_status(rgbw_dev);
-    mutex_unlock(&rgbw_dev->update_lock);
+    const struct rgbw_ops *ops;
+    int idx;
+
+    idx = rgbw_ops_read_lock(rgbw_dev);
+    ops = rgbw_get_ops(rgbw_dev);
+    if (ops && ops->update_status) {
+        mutex_lock(&rgbw_dev->update_lock);
+        atomic_long_inc(&rgbw_dev->stats.updates);
+        rgbw_latency_stamp(rgbw_dev);
+        ops->update_status(rgbw_dev);
+        mutex_unlock(&rgbw_dev->update_lock);
+    }
+    rgbw_ops_read_unlock(rgbw_dev, idx);
 }
 
+/* Drivers call this for every write that reaches the hardware */
+static inline void rgbw_count_hw_write(struct rgbw_device *rgbw_dev)
+{
+    atomic_long_inc(&rgbw_dev->stats.hw_writes);
+}
+
+/* brightness can not exceed the integer part of rgbw_properties.fine */
+#define RGBW_MAX_LEVELS         65536
+
+/*
+ * A brightness-levels table shared by every device built from the same
+ * control points, see rgbw_levels_get(). The table is read only.
+ */
+struct rgbw_levels {
+    struct list_head list;
+    struct kref ref;
+    /* the control points and steps it was expanded from */
+    const u32 *points;
+    unsigned int npoints;
+    unsigned int steps;
+    /* max_brightness + 1 entries */
+    unsigned int count;
+    unsigned int table[];
+};
+
+extern struct rgbw_levels *rgbw_levels_get(const u32 *points, unsigned int npoints,
+    unsigned int steps);
+extern void rgbw_levels_put(struct rgbw_levels *levels);
+
 extern const char *const color_names[];
 
+extern void rgbw_notify_state(struct rgbw_device *rgbw_dev);
+extern int rgbw_set_correction(struct rgbw_device *rgbw_dev,
+    const s32 matrix[MAX_COLORS][MAX_COLORS], bool white_extract);
+extern void rgbw_update_output(struct rgbw_device *rgbw_dev);
+extern int rgbw_set_power_limit(struct rgbw_device *rgbw_dev,
+    const unsigned int current_ua[MAX_COLORS], unsigned int budget_ua, unsigned int group);
+extern int rgbw_set_layer(struct rgbw_device *rgbw_dev, unsigned int index,
+    const struct rgbw_layer *layer);
+extern int rgbw_register_cooling(struct rgbw_device *rgbw_dev, struct device_node *np,
+    const u32 *levels, unsigned int nlevels);
+extern int rgbw_register_leds(struct rgbw_device *rgbw_dev);
+
+/* Hardware independent helpers, see leds-rgbw-lib.c */
+extern int rgbw_parse_html(const char *buf, size_t count, unsigned int levels[MAX_COLORS]);
+extern unsigned int rgbw_pulse_step(struct rgbw_properties *props, struct rgbw_actions *acts);
+extern unsigned int rgbw_blink_step(struct rgbw_properties *props, struct rgbw_actions *acts);
+extern unsigned int rgbw_heartbeat_step(struct rgbw_properties *props, struct rgbw_actions *acts);
+extern unsigned int rgbw_rainbow_step(struct rgbw_properties *props, struct rgbw_actions *acts);
+extern void rgbw_hsv_to_rgb(u16 hue, u16 sat, u16 val, u16 rgb[3]);
+extern void rgbw_hsl_to_hsv(u16 sat, u16 light, u16 *hsv_sat, u16 *hsv_val);
+extern unsigned long rgbw_power_draw(const u32 out[MAX_COLORS], const int max[MAX_COLORS],
+    const unsigned int current_ua[MAX_COLORS], unsigned int dimmer);
+extern u32 rgbw_power_scale(unsigned long draw_ua, unsigned int budget_ua);
+extern void rgbw_fold_duty(const unsigned int *levels, unsigned int max,
+    unsigned int dimmer, u32 *duty);
+extern unsigned int rgbw_duty_cycle(unsigned int brightness, unsigned int frac, unsigned int max,
+    const u32 *duty, unsigned int period);
+extern u64 rgbw_soft_pwm_edge(unsigned int brightness, unsigned int frac, unsigned int max,
+    unsigned int period, const u32 *duty, int *value, u32 *dither);
+extern void rgbw_layer_eval(struct rgbw_layer *layer, unsigned long now, u16 val[MAX_COLORS]);
+extern void rgbw_compose(struct rgbw_layer *layers, unsigned int nlayers, unsigned long now,
+    const int max[MAX_COLORS], u32 io[MAX_COLORS]);
+extern void rgbw_correct(const struct rgbw_correction *corr, const u32 in[MAX_COLORS],
+    const int max[MAX_COLORS], u32 out[MAX_COLORS]);
+extern unsigned int rgbw_levels_count(unsigned int npoints, unsigned int steps);
+extern void rgbw_interpolate_levels(const u32 *points, unsigned int npoints,
+    unsigned int steps, unsigned int *table);
+
 extern struct rgbw_device *rgbw_device_register(const char *name,
     struct device *dev, void *devdata, const struct rgbw_ops *ops,
     struct rgbw_properties props[MAX_COLORS], struct rgbw_actions *acts);
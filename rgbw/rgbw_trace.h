@@ -0,0 +1,128 @@
+/*
+ * RGB+W LED hardware operation trace events
+ *
+ * Copyleft 2016 Tudor Design Systems, LLC.
+ *
+ * Author: Cody Tudor <cody.tudor@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * One event per write to the hardware, so the exact sequence and timing
+ * of pwm and gpio operations can be captured with ftrace:
+ *   echo 1 > /sys/kernel/debug/tracing/events/rgbw/enable
+ *
+ */
+#undef TRACE_SYSTEM
+#define TRACE_SYSTEM rgbw
+
+#if !defined(__RGBW_TRACE_H_INCLUDED) || defined(TRACE_HEADER_MULTI_READ)
+#define __RGBW_TRACE_H_INCLUDED
+
+#include <linux/tracepoint.h>
+#include <linux/device.h>
+
+TRACE_EVENT(rgbw_pwm_config,
+
+    TP_PROTO(struct device *dev, int color, int duty_ns, int period_ns),
+
+    TP_ARGS(dev, color, duty_ns, period_ns),
+
+    TP_STRUCT__entry(
+        __string(name, dev_name(dev))
+        __field(int, color)
+        __field(int, duty_ns)
+        __field(int, period_ns)
+    ),
+
+    TP_fast_assign(
+        __assign_str(name);
+        __entry->color = color;
+        __entry->duty_ns = duty_ns;
+        __entry->period_ns = period_ns;
+    ),
+
+    TP_printk("%s color=%d duty=%d period=%d", __get_str(name),
+              __entry->color, __entry->duty_ns, __entry->period_ns)
+);
+
+DECLARE_EVENT_CLASS(rgbw_pin,
+
+    TP_PROTO(struct device *dev, int color, int value),
+
+    TP_ARGS(dev, color, value),
+
+    TP_STRUCT__entry(
+        __string(name, dev_name(dev))
+        __field(int, color)
+        __field(int, value)
+    ),
+
+    TP_fast_assign(
+        __assign_str(name);
+        __entry->color = color;
+        __entry->value = value;
+    ),
+
+    TP_printk("%s color=%d value=%d", __get_str(name),
+              __entry->color, __entry->value)
+);
+
+/* hard pwm enabled (1) or disabled (0) */
+DEFINE_EVENT(rgbw_pin, rgbw_pwm_enable,
+    TP_PROTO(struct device *dev, int color, int value),
+    TP_ARGS(dev, color, value)
+);
+
+/* soft pwm gpio driven to value */
+DEFINE_EVENT(rgbw_pin, rgbw_gpio_set,
+    TP_PROTO(struct device *dev, int color, int value),
+    TP_ARGS(dev, color, value)
+);
+
+/* soft pwm governor moved a color to period_ns after a window of edges */
+TRACE_EVENT(rgbw_soft_governor,
+
+    TP_PROTO(struct device *dev, int color, unsigned int period_ns,
+             unsigned int edges, unsigned int late, unsigned long busy_ns),
+
+    TP_ARGS(dev, color, period_ns, edges, late, busy_ns),
+
+    TP_STRUCT__entry(
+        __string(name, dev_name(dev))
+        __field(int, color)
+        __field(unsigned int, period_ns)
+        __field(unsigned int, edges)
+        __field(unsigned int, late)
+        __field(unsigned long, busy_ns)
+    ),
+
+    TP_fast_assign(
+        __assign_str(name);
+        __entry->color = color;
+        __entry->period_ns = period_ns;
+        __entry->edges = edges;
+        __entry->late = late;
+        __entry->busy_ns = busy_ns;
+    ),
+
+    TP_printk("%s color=%d period=%u edges=%u late=%u busy=%luns", __get_str(name),
+              __entry->color, __entry->period_ns, __entry->edges,
+              __entry->late, __entry->busy_ns)
+);
+
+#endif  /* __RGBW_TRACE_H_INCLUDED */
+
+/* This part must be outside protection */
+#undef TRACE_INCLUDE_PATH
+#define TRACE_INCLUDE_PATH .
+#undef TRACE_INCLUDE_FILE
+#define TRACE_INCLUDE_FILE rgbw_trace
+#include <trace/define_trace.h>
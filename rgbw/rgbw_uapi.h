@@ -0,0 +1,127 @@
+/*
+ * RGB+W LED userspace interface
+ *
+ * Copyleft 2016 Tudor Design Systems, LLC.
+ *
+ * Author: Cody Tudor <cody.tudor@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * Fixed layout structures shared between the rgbw class and userspace.
+ * This header must stay includable from userspace, so only use
+ * <linux/types.h> and <linux/ioctl.h> here.
+ *
+ */
+#ifndef __RGBW_UAPI_H_INCLUDED
+#define __RGBW_UAPI_H_INCLUDED
+
+#include <linux/types.h>
+#include <linux/ioctl.h>
+
+#define RGBW_UAPI_COLORS        4       /* [R,G,B,W] order everywhere */
+
+/* Effect bits reported in rgbw_state.effect, same as the class' RGBW_*_ON */
+#define RGBW_EFFECT_PULSE       (1 << 0)
+#define RGBW_EFFECT_BLINK       (1 << 1)
+#define RGBW_EFFECT_HEARTBEAT   (1 << 2)
+#define RGBW_EFFECT_RAINBOW     (1 << 3)
+
+/* Channel types reported in rgbw_state.types */
+#define RGBW_STATE_TYPE_NONE    0
+#define RGBW_STATE_TYPE_PWM     1       /* hard pwm */
+#define RGBW_STATE_TYPE_GPIO    2       /* soft pwm */
+
+#define RGBW_STATE_VERSION      1
+
+/*
+ * Layout of /sys/class/rgbw/<dev>/state. The whole struct is returned
+ * by a single pread() at offset 0 and the file can be poll()ed for
+ * POLLPRI; it is signalled every time seq changes.
+ */
+struct rgbw_state {
+    __u32 version;                      /* RGBW_STATE_VERSION */
+    __u32 seq;                          /* bumped on every state change */
+    __u32 levels[RGBW_UAPI_COLORS];     /* current brightness per color */
+    __u32 max_levels[RGBW_UAPI_COLORS]; /* max_brightness per color */
+    __u8  types[RGBW_UAPI_COLORS];      /* RGBW_STATE_TYPE_* per color */
+    __u32 effect;                       /* RGBW_EFFECT_* bits */
+    __u32 pcolor;                       /* color being pulsed, 255 if none */
+    __u32 phase;                        /* effect step: pulse index or blink/heartbeat/rainbow state */
+    __u32 reserved[2];
+};
+
+/* Channel bits for rgbw_set.mask */
+#define RGBW_CH_RED             (1 << 0)
+#define RGBW_CH_GREEN           (1 << 1)
+#define RGBW_CH_BLUE            (1 << 2)
+#define RGBW_CH_WHITE           (1 << 3)
+#define RGBW_CH_ALL             (RGBW_CH_RED | RGBW_CH_GREEN | \
+                                 RGBW_CH_BLUE | RGBW_CH_WHITE)
+
+/* rgbw_set.flags */
+#define RGBW_SET_RAW            (1 << 0)    /* levels are 0..max_levels, not 0..0xffff */
+
+/*
+ * Atomic multi channel update for RGBW_IOC_SET. Only the channels in
+ * mask are touched. Levels are full scale 16 bit and are scaled to the
+ * device's max_levels unless RGBW_SET_RAW is given. The update starts
+ * at apply_at_ns (CLOCK_MONOTONIC, 0 for now) and fades linearly from
+ * the current levels over transition_ms (0 for a step change).
+ */
+struct rgbw_set {
+    __u32 mask;                         /* RGBW_CH_* */
+    __u32 flags;                        /* RGBW_SET_* */
+    __u16 levels[RGBW_UAPI_COLORS];
+    __u32 transition_ms;
+    __u32 reserved;                     /* must be zero */
+    __u64 apply_at_ns;
+};
+
+#define RGBW_IOC_MAGIC          0xB7
+#define RGBW_IOC_SET            _IOW(RGBW_IOC_MAGIC, 0x01, struct rgbw_set)
+#define RGBW_IOC_GET_STATE      _IOR(RGBW_IOC_MAGIC, 0x02, struct rgbw_state)
+
+/*
+ * Generic netlink family. Every state change of every device is sent
+ * to the RGBW_GENL_MCGRP_STATE multicast group as a RGBW_CMD_STATE
+ * message, and RGBW_CMD_GET with RGBW_ATTR_DEVICE is answered with the
+ * same message for that one device.
+ *
+ * RGBW_ATTR_DEVICE is always the first attribute, so its value sits at
+ * NLMSG_HDRLEN + GENL_HDRLEN + NLA_HDRLEN in every message and a
+ * subscriber only interested in some devices can drop the rest with a
+ * socket filter before they are ever queued.
+ */
+#define RGBW_GENL_NAME          "rgbw"
+#define RGBW_GENL_VERSION       1
+#define RGBW_GENL_MCGRP_STATE   "state"
+
+enum rgbw_genl_cmd {
+    RGBW_CMD_UNSPEC,
+    RGBW_CMD_STATE,                     /* multicast, or the reply to RGBW_CMD_GET */
+    RGBW_CMD_GET,
+    __RGBW_CMD_MAX,
+};
+#define RGBW_CMD_MAX            (__RGBW_CMD_MAX - 1)
+
+enum rgbw_genl_attr {
+    RGBW_ATTR_UNSPEC,
+    RGBW_ATTR_DEVICE,                   /* u32, minor of the device's /dev node */
+    RGBW_ATTR_SEQ,                      /* u32, rgbw_state.seq after the change */
+    RGBW_ATTR_MASK,                     /* u32, RGBW_CH_* changed since the last message */
+    RGBW_ATTR_LEVELS,                   /* __u32[RGBW_UAPI_COLORS], brightness per color */
+    RGBW_ATTR_EFFECT,                   /* u32, RGBW_EFFECT_* bits */
+    RGBW_ATTR_NAME,                     /* string, in RGBW_CMD_GET replies only */
+    __RGBW_ATTR_MAX,
+};
+#define RGBW_ATTR_MAX           (__RGBW_ATTR_MAX - 1)
+
+#endif  /* __RGBW_UAPI_H_INCLUDED */
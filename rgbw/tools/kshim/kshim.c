@@ -0,0 +1,26 @@
+/*
+ * Userspace stand-ins for the kernel APIs used by the rgbw class
+ *
+ * Copyleft 2016 Tudor Design Systems, LLC.
+ *
+ * Author: Cody Tudor <cody.tudor@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ */
+
+#include "kshim.h"
+
+#define KSHIM_MAX_GPIOS 64
+
+unsigned long jiffies;
+unsigned long kshim_hw_writes;
+int kshim_gpio_value[KSHIM_MAX_GPIOS];
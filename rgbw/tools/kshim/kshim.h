@@ -0,0 +1,292 @@
+/*
+ * Userspace stand-ins for the kernel APIs used by the rgbw class
+ *
+ * Copyleft 2016 Tudor Design Systems, LLC.
+ *
+ * Author: Cody Tudor <cody.tudor@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * Just enough of <linux/...> for rgbw.h and leds-rgbw-lib.c to build as
+ * an ordinary userspace object. Timers never fire on their own; they
+ * only record what the code asked for. The pwm and gpio calls count
+ * the hardware writes so benchmarks can model a backend.
+ *
+ */
+#ifndef __RGBW_KSHIM_H_INCLUDED
+#define __RGBW_KSHIM_H_INCLUDED
+
+#include <stddef.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <pthread.h>
+#include <linux/types.h>
+
+typedef __u8  u8;
+typedef __u16 u16;
+typedef __u32 u32;
+typedef __u64 u64;
+typedef __s32 s32;
+typedef __s64 s64;
+
+#define EXPORT_SYMBOL(sym)
+#define IS_REACHABLE(option) 0   /* no LED class here */
+#define KERNEL_VERSION(a, b, c) (((a) << 16) + ((b) << 8) + (c))
+#define LINUX_VERSION_CODE      KERNEL_VERSION(6, 12, 0)
+#define likely(x)       __builtin_expect(!!(x), 1)
+#define unlikely(x)     __builtin_expect(!!(x), 0)
+#define ARRAY_SIZE(arr) (sizeof(arr) / sizeof((arr)[0]))
+#define container_of(ptr, type, member) \
+    ((type *)((char *)(ptr) - offsetof(type, member)))
+#define DIV_ROUND_CLOSEST(x, d) (((x) + ((d) / 2)) / (d))
+#define READ_ONCE(x)    (*(volatile __typeof__(x) *)&(x))
+#define min(a, b)       ((a) < (b) ? (a) : (b))
+#define max(a, b)       ((a) > (b) ? (a) : (b))
+#define min_t(type, a, b) min((type)(a), (type)(b))
+#define clamp_t(type, val, lo, hi) \
+    min((type)max((type)(val), (type)(lo)), (type)(hi))
+
+static inline u64 div_u64(u64 dividend, u32 divisor)
+{
+    return dividend / divisor;
+}
+
+static inline u64 div64_u64(u64 dividend, u64 divisor)
+{
+    return dividend / divisor;
+}
+
+static inline s64 div_s64(s64 dividend, s32 divisor)
+{
+    return dividend / divisor;
+}
+
+static inline int hex_to_bin(char ch)
+{
+    if ((ch >= '0') && (ch <= '9'))
+        return ch - '0';
+    ch |= 0x20;
+    if ((ch >= 'a') && (ch <= 'f'))
+        return ch - 'a' + 10;
+    return -1;
+}
+
+/* mutex */
+struct mutex {
+    pthread_mutex_t lock;
+};
+
+static inline void mutex_init(struct mutex *lock)
+{
+    pthread_mutex_init(&lock->lock, NULL);
+}
+
+static inline void mutex_lock(struct mutex *lock)
+{
+    pthread_mutex_lock(&lock->lock);
+}
+
+static inline void mutex_unlock(struct mutex *lock)
+{
+    pthread_mutex_unlock(&lock->lock);
+}
+
+/* srcu, there is no unregister to wait for here */
+#define __rcu
+#define lockdep_is_held(lock)   1
+#define srcu_dereference_check(p, ssp, c) (p)
+
+struct srcu_struct {
+    int unused;
+};
+
+static inline int srcu_read_lock(struct srcu_struct *ssp)
+{
+    return 0;
+}
+
+static inline void srcu_read_unlock(struct srcu_struct *ssp, int idx)
+{
+}
+
+/* list_head and kref, only embedded in structs here */
+struct list_head {
+    struct list_head *next, *prev;
+};
+
+struct kref {
+    int refcount;
+};
+
+/* spinlock, only embedded in structs here */
+typedef struct {
+    int locked;
+} spinlock_t;
+
+/* atomics */
+typedef struct {
+    int counter;
+} atomic_t;
+
+typedef struct {
+    long counter;
+} atomic_long_t;
+
+static inline void atomic_long_inc(atomic_long_t *v)
+{
+    __atomic_add_fetch(&v->counter, 1, __ATOMIC_RELAXED);
+}
+
+static inline long atomic_long_read(const atomic_long_t *v)
+{
+    return __atomic_load_n(&v->counter, __ATOMIC_RELAXED);
+}
+
+/* time */
+typedef s64 ktime_t;
+
+extern unsigned long jiffies;
+
+static inline unsigned long msecs_to_jiffies(unsigned int ms)
+{
+    return ms;      /* HZ=1000 */
+}
+
+static inline unsigned int jiffies_to_msecs(unsigned long j)
+{
+    return j;
+}
+
+static inline ktime_t ns_to_ktime(u64 ns)
+{
+    return ns;
+}
+
+/* timer_list, armed but never run */
+struct timer_list {
+    void (*function)(unsigned long);
+    unsigned long data;
+    unsigned long expires;
+    bool pending;
+};
+
+static inline void setup_timer(struct timer_list *timer,
+        void (*function)(unsigned long), unsigned long data)
+{
+    timer->function = function;
+    timer->data = data;
+    timer->pending = false;
+}
+
+static inline int mod_timer(struct timer_list *timer, unsigned long expires)
+{
+    int was_pending = timer->pending;
+
+    timer->expires = expires;
+    timer->pending = true;
+    return was_pending;
+}
+
+static inline int del_timer_sync(struct timer_list *timer)
+{
+    int was_pending = timer->pending;
+
+    timer->pending = false;
+    return was_pending;
+}
+
+/* hrtimer, armed but never run */
+enum hrtimer_restart {
+    HRTIMER_NORESTART,
+    HRTIMER_RESTART,
+};
+
+struct hrtimer {
+    enum hrtimer_restart (*function)(struct hrtimer *);
+    ktime_t expires;
+    bool active;
+};
+
+static inline void hrtimer_start(struct hrtimer *timer, ktime_t tim, int mode)
+{
+    timer->expires = tim;
+    timer->active = true;
+}
+
+static inline int hrtimer_cancel(struct hrtimer *timer)
+{
+    int was_active = timer->active;
+
+    timer->active = false;
+    return was_active;
+}
+
+/* pwm and gpio, counted */
+struct pwm_device {
+    int duty_ns;
+    int period_ns;
+    bool enabled;
+};
+
+extern unsigned long kshim_hw_writes;
+
+static inline int pwm_config(struct pwm_device *pwm, int duty_ns, int period_ns)
+{
+    pwm->duty_ns = duty_ns;
+    pwm->period_ns = period_ns;
+    kshim_hw_writes++;
+    return 0;
+}
+
+static inline int pwm_enable(struct pwm_device *pwm)
+{
+    pwm->enabled = true;
+    kshim_hw_writes++;
+    return 0;
+}
+
+static inline void pwm_disable(struct pwm_device *pwm)
+{
+    pwm->enabled = false;
+    kshim_hw_writes++;
+}
+
+extern int kshim_gpio_value[];
+
+static inline void __gpio_set_value(unsigned int gpio, int value)
+{
+    kshim_gpio_value[gpio] = value;
+    kshim_hw_writes++;
+}
+
+/* device model, only what rgbw.h dereferences */
+struct kernfs_node;
+struct device_node;
+
+struct device {
+    void *driver_data;
+};
+
+static inline void *dev_get_drvdata(const struct device *dev)
+{
+    return dev->driver_data;
+}
+
+struct cdev {
+    int unused;
+};
+
+struct delayed_work {
+    struct timer_list timer;
+};
+
+#endif  /* __RGBW_KSHIM_H_INCLUDED */
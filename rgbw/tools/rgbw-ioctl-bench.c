@@ -0,0 +1,140 @@
+/*
+ * RGB+W LED update cost benchmark
+ *
+ * Copyleft 2016 Tudor Design Systems, LLC.
+ *
+ * Author: Cody Tudor <cody.tudor@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * Compares the per update cost of the "#RRGGBBWW" text path through
+ * /sys/class/rgbw/<dev>/RGBW_values against one RGBW_IOC_SET ioctl on
+ * /dev/<dev>. Both paths write the same sequence of colors.
+ *
+ * usage: rgbw-ioctl-bench <dev> [iterations]
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+
+#include "rgbw_uapi.h"
+
+#define DEFAULT_ITERATIONS 10000
+
+static unsigned long long now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (unsigned long long)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static int bench_sysfs(const char *dev, unsigned long iterations, double *ns_per_update)
+{
+    char path[256];
+    char color[16];
+    unsigned long long start;
+    unsigned long cntr;
+    int len;
+    int fd;
+
+    snprintf(path, sizeof(path), "/sys/class/rgbw/%s/RGBW_values", dev);
+    fd = open(path, O_WRONLY);
+    if (fd < 0) {
+        fprintf(stderr, "%s: %s\n", path, strerror(errno));
+        return -1;
+    }
+
+    start = now_ns();
+    for (cntr = 0; cntr < iterations; cntr++) {
+        len = snprintf(color, sizeof(color), "#%02x%02x%02x%02x\n",
+                       (unsigned int)(cntr & 0xff), (unsigned int)((cntr >> 1) & 0xff),
+                       (unsigned int)((cntr >> 2) & 0xff), (unsigned int)((cntr >> 3) & 0xff));
+        if (pwrite(fd, color, len, 0) != len) {
+            fprintf(stderr, "%s: %s\n", path, strerror(errno));
+            close(fd);
+            return -1;
+        }
+    }
+    *ns_per_update = (double)(now_ns() - start) / iterations;
+
+    close(fd);
+    return 0;
+}
+
+static int bench_ioctl(const char *dev, unsigned long iterations, double *ns_per_update)
+{
+    char path[256];
+    struct rgbw_set set;
+    unsigned long long start;
+    unsigned long cntr;
+    int fd;
+
+    snprintf(path, sizeof(path), "/dev/%s", dev);
+    fd = open(path, O_RDWR);
+    if (fd < 0) {
+        fprintf(stderr, "%s: %s\n", path, strerror(errno));
+        return -1;
+    }
+
+    memset(&set, 0, sizeof(set));
+    set.mask = RGBW_CH_ALL;
+
+    start = now_ns();
+    for (cntr = 0; cntr < iterations; cntr++) {
+        /* same colors as the text path, scaled up to 16 bit */
+        set.levels[0] = (cntr & 0xff) * 0x101;
+        set.levels[1] = ((cntr >> 1) & 0xff) * 0x101;
+        set.levels[2] = ((cntr >> 2) & 0xff) * 0x101;
+        set.levels[3] = ((cntr >> 3) & 0xff) * 0x101;
+        if (ioctl(fd, RGBW_IOC_SET, &set) < 0) {
+            fprintf(stderr, "%s: RGBW_IOC_SET: %s\n", path, strerror(errno));
+            close(fd);
+            return -1;
+        }
+    }
+    *ns_per_update = (double)(now_ns() - start) / iterations;
+
+    close(fd);
+    return 0;
+}
+
+int main(int argc, char **argv)
+{
+    unsigned long iterations = DEFAULT_ITERATIONS;
+    double sysfs_ns, ioctl_ns;
+
+    if (argc < 2 || argc > 3) {
+        fprintf(stderr, "usage: %s <dev> [iterations]\n", argv[0]);
+        return 2;
+    }
+    if (argc == 3)
+        iterations = strtoul(argv[2], NULL, 0);
+    if (!iterations)
+        iterations = DEFAULT_ITERATIONS;
+
+    if (bench_sysfs(argv[1], iterations, &sysfs_ns) || bench_ioctl(argv[1], iterations, &ioctl_ns))
+        return 1;
+
+    printf("%-22s %12s\n", "path", "ns/update");
+    printf("%-22s %12.0f\n", "sysfs RGBW_values", sysfs_ns);
+    printf("%-22s %12.0f\n", "ioctl RGBW_IOC_SET", ioctl_ns);
+    printf("%-22s %12.2fx\n", "speedup", sysfs_ns / ioctl_ns);
+
+    return 0;
+}
@@ -0,0 +1,270 @@
+/*
+ * RGB+W LED class library benchmarks
+ *
+ * Copyleft 2016 Tudor Design Systems, LLC.
+ *
+ * Author: Cody Tudor <cody.tudor@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * Runs leds-rgbw-lib.c in userspace on top of tools/kshim and reports
+ * ns per operation for the text parser, a four color hard pwm update,
+ * every effect tick and a soft pwm edge. Hardware writes go to the shim
+ * so the numbers are the software cost of each path only.
+ *
+ * usage: rgbw-lib-bench [iterations]
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "rgbw.h"
+
+#define DEFAULT_ITERATIONS  1000000
+#define BENCH_MAX           255
+#define BENCH_PERIOD        10000000
+
+const char *const color_names[] = {
+    [COLOR_RED]     = "red",
+    [COLOR_GREEN]   = "green",
+    [COLOR_BLUE]    = "blue",
+    [COLOR_WHITE]   = "white",
+};
+
+static struct rgbw_properties props[MAX_COLORS];
+static struct rgbw_actions acts;
+static struct pwm_device pwm[MAX_COLORS];
+static unsigned int levels[BENCH_MAX + 1];
+static u32 duty[BENCH_MAX + 1];
+static volatile unsigned long sink;
+
+static unsigned long long now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (unsigned long long)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void reset_device(void)
+{
+    int cntr;
+
+    memset(props, 0, sizeof(props));
+    memset(&acts, 0, sizeof(acts));
+    for (cntr = COLOR_RED; cntr < MAX_COLORS; cntr++) {
+        props[cntr].max_brightness = BENCH_MAX;
+        props[cntr].type = RGBW_PWM;
+        props[cntr].brightness = 0x40 * cntr;
+        acts.rgbw_values[cntr] = 0x40 * cntr;
+    }
+    acts.pcolor = COLOR_RED;
+    acts.bstate = INVALID_COLOR;
+    acts.rb_period = RAINBOW_PERIOD_MS;
+    acts.rb_sat = 0xffff;
+    acts.rb_val = 0xffff;
+}
+
+static void bench_parse_rgbw(unsigned long i)
+{
+    static const char color[] = "#1a2b3c4d\n";
+    unsigned int lvl[MAX_COLORS];
+
+    sink += rgbw_parse_html(color, sizeof(color) - 1, lvl) + lvl[i & 3];
+}
+
+static void bench_parse_rgb(unsigned long i)
+{
+    static const char color[] = "#1a2b3c\n";
+    unsigned int lvl[MAX_COLORS];
+
+    sink += rgbw_parse_html(color, sizeof(color) - 1, lvl) + lvl[i % 3];
+}
+
+/* what the generic driver does for each hard pwm color on an update */
+static void bench_hard_update(unsigned long i)
+{
+    unsigned int duty_cycle;
+    int cntr;
+
+    for (cntr = COLOR_RED; cntr < MAX_COLORS; cntr++) {
+        props[cntr].brightness = (i + cntr) & BENCH_MAX;
+        if (props[cntr].brightness == 0) {
+            pwm_disable(&pwm[cntr]);
+            continue;
+        }
+        duty_cycle = rgbw_duty_cycle(props[cntr].brightness, 0, BENCH_MAX, duty,
+                                     BENCH_PERIOD);
+        pwm_config(&pwm[cntr], duty_cycle, BENCH_PERIOD);
+        pwm_enable(&pwm[cntr]);
+    }
+}
+
+static void bench_pulse(unsigned long i)
+{
+    sink += rgbw_pulse_step(props, &acts);
+}
+
+static void bench_blink(unsigned long i)
+{
+    sink += rgbw_blink_step(props, &acts);
+}
+
+static void bench_heartbeat(unsigned long i)
+{
+    sink += rgbw_heartbeat_step(props, &acts);
+}
+
+static void bench_rainbow(unsigned long i)
+{
+    /* one frame per call, the hue follows the shim's jiffies */
+    jiffies += RAINBOW_FRAME_PER_MS;
+    sink += rgbw_rainbow_step(props, &acts);
+}
+
+static void bench_hsv(unsigned long i)
+{
+    u16 rgb[3];
+
+    rgbw_hsv_to_rgb(i * 97, 0xffff - (i & 0xff), 0xc000, rgb);
+    sink += rgb[i % 3];
+}
+
+/* one soft pwm hrtimer expiry: compute the edge and drive the pin */
+static void bench_soft_edge(unsigned long i)
+{
+    static int value;
+    static u32 dither;
+    u64 next;
+
+    next = rgbw_soft_pwm_edge(1 + (i & 0x7f), 0, BENCH_MAX, BENCH_PERIOD,
+                              duty, &value, &dither);
+    __gpio_set_value(0, value);
+    sink += next;
+}
+
+/* same with a fraction to dither, as set through RGBW_IOC_SET */
+static void bench_soft_edge_dither(unsigned long i)
+{
+    static int value;
+    static u32 dither;
+    u64 next;
+
+    next = rgbw_soft_pwm_edge(1 + (i & 0x7f), 0x5a5a, BENCH_MAX, BENCH_PERIOD,
+                              duty, &value, &dither);
+    __gpio_set_value(0, value);
+    sink += next;
+}
+
+/* the power limiter's share of a frame: one draw and one scale */
+static void bench_power(unsigned long i)
+{
+    static const unsigned int current_ua[MAX_COLORS] = { 20000, 20000, 20000, 40000 };
+    static const int max[MAX_COLORS] = { BENCH_MAX, BENCH_MAX, BENCH_MAX, BENCH_MAX };
+    u32 out[MAX_COLORS] = { (i & 0xff) << 16, (i & 0x7f) << 16, (i & 0x3f) << 16, (i & 0xff) << 15 };
+    unsigned long draw;
+
+    draw = rgbw_power_draw(out, max, current_ua, RGBW_DIM_FULL);
+    sink += rgbw_power_scale(draw, 50000);
+}
+
+/* one compositor frame over four stacked layers */
+static void bench_compose(unsigned long i)
+{
+    static struct rgbw_layer layers[4] = {
+        { RGBW_LAYER_RAINBOW,   RGBW_BLEND_REPLACE,  RGBW_CH_ALL,   { 0xffff, 0xffff, 0xffff, 0 }, 6000 },
+        { RGBW_LAYER_PULSE,     RGBW_BLEND_MULTIPLY, RGBW_CH_RED | RGBW_CH_GREEN | RGBW_CH_BLUE,
+                                                                    { 0xffff, 0xffff, 0xffff, 0 }, 4000 },
+        { RGBW_LAYER_BLINK,     RGBW_BLEND_ADD,      RGBW_CH_WHITE, { 0, 0, 0, 0x8000 }, 1000 },
+        { RGBW_LAYER_HEARTBEAT, RGBW_BLEND_MAX,      RGBW_CH_RED,   { 0xffff, 0, 0, 0 }, 1000 },
+    };
+    static const int max[MAX_COLORS] = { BENCH_MAX, BENCH_MAX, BENCH_MAX, BENCH_MAX };
+    u32 io[MAX_COLORS] = { 0x400000, 0x800000, 0xc00000, 0x100000 };
+
+    jiffies += COMPOSE_FRAME_PER_MS;
+    rgbw_compose(layers, ARRAY_SIZE(layers), jiffies, max, io);
+    sink += io[i & 3];
+}
+
+/* what a dimmer write costs: one table rebuild */
+static void bench_fold_duty(unsigned long i)
+{
+    rgbw_fold_duty(levels, BENCH_MAX, i & RGBW_DIM_FULL, duty);
+    sink += duty[i & BENCH_MAX];
+}
+
+/* probe time expansion of a 17 point, 4097 level curve */
+static void bench_interpolate(unsigned long i)
+{
+    static const u32 points[] = {
+        0, 1, 4, 9, 16, 25, 36, 49, 64, 81, 100, 121, 144, 169, 196, 225, 256,
+    };
+    static unsigned int table[4097];
+
+    rgbw_interpolate_levels(points, ARRAY_SIZE(points), 256, table);
+    sink += table[i & 4095];
+}
+
+static const struct {
+    const char *name;
+    void (*fn)(unsigned long i);
+} benches[] = {
+    { "parse #RRGGBBWW",    bench_parse_rgbw },
+    { "parse #RRGGBB",      bench_parse_rgb },
+    { "hard pwm update x4", bench_hard_update },
+    { "pulse tick",         bench_pulse },
+    { "blink tick",         bench_blink },
+    { "heartbeat tick",     bench_heartbeat },
+    { "rainbow frame",      bench_rainbow },
+    { "hsv to rgb",         bench_hsv },
+    { "soft pwm edge",      bench_soft_edge },
+    { "soft pwm edge dither", bench_soft_edge_dither },
+    { "power limit",        bench_power },
+    { "compose 4 layers",   bench_compose },
+    { "fold dimmer 256 lvls", bench_fold_duty },
+    { "interpolate 4097 lvls", bench_interpolate },
+};
+
+int main(int argc, char **argv)
+{
+    unsigned long iterations = DEFAULT_ITERATIONS;
+    unsigned long long start, elapsed;
+    unsigned long i, writes;
+    size_t bench;
+
+    if (argc > 1)
+        iterations = strtoul(argv[1], NULL, 0);
+    if (!iterations)
+        iterations = DEFAULT_ITERATIONS;
+
+    for (i = 0; i <= BENCH_MAX; i++) {
+        levels[i] = i;
+    }
+    rgbw_fold_duty(levels, BENCH_MAX, RGBW_DIM_FULL, duty);
+
+    printf("%-22s %10s %12s\n", "operation", "ns/op", "hw writes/op");
+    for (bench = 0; bench < ARRAY_SIZE(benches); bench++) {
+        reset_device();
+        writes = kshim_hw_writes;
+        start = now_ns();
+        for (i = 0; i < iterations; i++) {
+            benches[bench].fn(i);
+        }
+        elapsed = now_ns() - start;
+        printf("%-22s %10.2f %12.2f\n", benches[bench].name,
+               (double)elapsed / iterations,
+               (double)(kshim_hw_writes - writes) / iterations);
+    }
+
+    return 0;
+}
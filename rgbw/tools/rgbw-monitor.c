@@ -0,0 +1,316 @@
+/*
+ * RGB+W LED netlink state monitor
+ *
+ * Copyleft 2016 Tudor Design Systems, LLC.
+ *
+ * Author: Cody Tudor <cody.tudor@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * Follows the rgbw class' "state" multicast group and prints one line
+ * per state change. With -d only the given device minors are printed;
+ * the rest are dropped by a socket filter on RGBW_ATTR_DEVICE so they
+ * never reach the socket queue. With -g the current state of each -d
+ * device is read once with RGBW_CMD_GET instead.
+ *
+ * usage: rgbw-monitor [-g] [-d minor]...
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include <linux/netlink.h>
+#include <linux/genetlink.h>
+#include <linux/filter.h>
+
+#include "rgbw_uapi.h"
+
+#define MAX_FILTER_DEVICES  32
+#define BUF_SIZE            8192
+
+#define GENL_DATA(nlh)      ((char *)NLMSG_DATA(nlh) + GENL_HDRLEN)
+#define NLA_DATA(nla)       ((char *)(nla) + NLA_HDRLEN)
+
+static const char *const effect_names[] = {
+    "pulse", "blink", "heartbeat", "rainbow",
+};
+
+static int nl_send(int fd, __u16 type, __u8 cmd, __u16 attr, const void *data, int len)
+{
+    struct {
+        struct nlmsghdr nlh;
+        struct genlmsghdr genl;
+        char attrs[64];
+    } req;
+    struct nlattr *nla = (struct nlattr *)req.attrs;
+    struct sockaddr_nl addr = { .nl_family = AF_NETLINK };
+
+    memset(&req, 0, sizeof(req));
+    nla->nla_type = attr;
+    nla->nla_len = NLA_HDRLEN + len;
+    memcpy(NLA_DATA(nla), data, len);
+
+    req.nlh.nlmsg_len = NLMSG_LENGTH(GENL_HDRLEN + NLA_ALIGN(nla->nla_len));
+    req.nlh.nlmsg_type = type;
+    req.nlh.nlmsg_flags = NLM_F_REQUEST;
+    req.genl.cmd = cmd;
+    req.genl.version = 1;
+
+    if (sendto(fd, &req, req.nlh.nlmsg_len, 0, (struct sockaddr *)&addr, sizeof(addr)) < 0)
+        return -errno;
+    return 0;
+}
+
+/* Walk the attributes of one genetlink message, calling fn for each */
+static void nl_attrs(struct nlmsghdr *nlh, void (*fn)(struct nlattr *, void *), void *arg)
+{
+    struct nlattr *nla = (struct nlattr *)GENL_DATA(nlh);
+    int len = nlh->nlmsg_len - NLMSG_LENGTH(GENL_HDRLEN);
+
+    while (len >= NLA_HDRLEN && nla->nla_len >= NLA_HDRLEN && nla->nla_len <= len) {
+        fn(nla, arg);
+        len -= NLA_ALIGN(nla->nla_len);
+        nla = (struct nlattr *)((char *)nla + NLA_ALIGN(nla->nla_len));
+    }
+}
+
+struct family {
+    __u16 id;
+    __u32 group;
+};
+
+static void family_mcgrp(struct nlattr *grp, struct family *fam)
+{
+    struct nlattr *nla = (struct nlattr *)NLA_DATA(grp);
+    int len = grp->nla_len - NLA_HDRLEN;
+    __u32 id = 0;
+    int match = 0;
+
+    while (len >= NLA_HDRLEN && nla->nla_len >= NLA_HDRLEN && nla->nla_len <= len) {
+        if (nla->nla_type == CTRL_ATTR_MCAST_GRP_ID)
+            id = *(__u32 *)NLA_DATA(nla);
+        else if (nla->nla_type == CTRL_ATTR_MCAST_GRP_NAME)
+            match = !strcmp(NLA_DATA(nla), RGBW_GENL_MCGRP_STATE);
+        len -= NLA_ALIGN(nla->nla_len);
+        nla = (struct nlattr *)((char *)nla + NLA_ALIGN(nla->nla_len));
+    }
+    if (match)
+        fam->group = id;
+}
+
+static void family_attr(struct nlattr *nla, void *arg)
+{
+    struct family *fam = arg;
+    struct nlattr *grp;
+    int len;
+
+    if ((nla->nla_type & NLA_TYPE_MASK) == CTRL_ATTR_FAMILY_ID) {
+        fam->id = *(__u16 *)NLA_DATA(nla);
+    }
+    else if ((nla->nla_type & NLA_TYPE_MASK) == CTRL_ATTR_MCAST_GROUPS) {
+        grp = (struct nlattr *)NLA_DATA(nla);
+        len = nla->nla_len - NLA_HDRLEN;
+        while (len >= NLA_HDRLEN && grp->nla_len >= NLA_HDRLEN && grp->nla_len <= len) {
+            family_mcgrp(grp, fam);
+            len -= NLA_ALIGN(grp->nla_len);
+            grp = (struct nlattr *)((char *)grp + NLA_ALIGN(grp->nla_len));
+        }
+    }
+}
+
+static int resolve_family(int fd, struct family *fam)
+{
+    char buf[BUF_SIZE];
+    struct nlmsghdr *nlh = (struct nlmsghdr *)buf;
+    int len;
+
+    if (nl_send(fd, GENL_ID_CTRL, CTRL_CMD_GETFAMILY, CTRL_ATTR_FAMILY_NAME,
+                RGBW_GENL_NAME, sizeof(RGBW_GENL_NAME)) < 0)
+        return -1;
+
+    len = recv(fd, buf, sizeof(buf), 0);
+    if (len < 0 || !NLMSG_OK(nlh, len) || nlh->nlmsg_type == NLMSG_ERROR)
+        return -1;
+
+    nl_attrs(nlh, family_attr, fam);
+    return fam->id ? 0 : -1;
+}
+
+struct state {
+    __u32 device, seq, mask, effect;
+    __u32 levels[RGBW_UAPI_COLORS];
+    const char *name;
+};
+
+static void state_attr(struct nlattr *nla, void *arg)
+{
+    struct state *st = arg;
+    __u32 *val = (__u32 *)NLA_DATA(nla);
+
+    switch (nla->nla_type) {
+        case RGBW_ATTR_DEVICE:  st->device = *val; break;
+        case RGBW_ATTR_SEQ:     st->seq = *val; break;
+        case RGBW_ATTR_MASK:    st->mask = *val; break;
+        case RGBW_ATTR_EFFECT:  st->effect = *val; break;
+        case RGBW_ATTR_LEVELS:
+            memcpy(st->levels, val, sizeof(st->levels));
+            break;
+        case RGBW_ATTR_NAME:
+            st->name = (const char *)val;
+            break;
+    }
+}
+
+static void print_state(struct nlmsghdr *nlh)
+{
+    struct state st = { 0 };
+    int cntr;
+
+    nl_attrs(nlh, state_attr, &st);
+
+    printf("dev %u", st.device);
+    if (st.name)
+        printf(" (%s)", st.name);
+    printf(" seq %u mask %x levels %u %u %u %u effect ", st.seq, st.mask,
+           st.levels[0], st.levels[1], st.levels[2], st.levels[3]);
+    if (!st.effect)
+        printf("none");
+    for (cntr = 0; cntr < 4; cntr++) {
+        if (st.effect & (1 << cntr))
+            printf("%s", effect_names[cntr]);
+    }
+    printf("\n");
+    fflush(stdout);
+}
+
+/* Accept only messages whose RGBW_ATTR_DEVICE is one of devices */
+static int attach_filter(int fd, const __u32 *devices, int ndevices)
+{
+    struct sock_filter code[2 + MAX_FILTER_DEVICES];
+    struct sock_fprog prog = { .filter = code };
+    int cntr;
+
+    /* the filter loads in network order, the attribute is host order */
+    code[0] = (struct sock_filter)BPF_STMT(BPF_LD | BPF_W | BPF_ABS,
+                                           NLMSG_HDRLEN + GENL_HDRLEN + NLA_HDRLEN);
+    for (cntr = 0; cntr < ndevices; cntr++) {
+        code[1 + cntr] = (struct sock_filter)BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K,
+                                                      ntohl(devices[cntr]), ndevices - cntr, 0);
+    }
+    code[1 + ndevices] = (struct sock_filter)BPF_STMT(BPF_RET | BPF_K, 0);
+    code[2 + ndevices] = (struct sock_filter)BPF_STMT(BPF_RET | BPF_K, 0xffff);
+    prog.len = 3 + ndevices;
+
+    return setsockopt(fd, SOL_SOCKET, SO_ATTACH_FILTER, &prog, sizeof(prog));
+}
+
+static void usage(void)
+{
+    fprintf(stderr, "usage: rgbw-monitor [-g] [-d minor]...\n");
+    exit(1);
+}
+
+int main(int argc, char **argv)
+{
+    struct sockaddr_nl addr = { .nl_family = AF_NETLINK };
+    struct family fam = { 0 };
+    __u32 devices[MAX_FILTER_DEVICES];
+    int ndevices = 0, get = 0;
+    char buf[BUF_SIZE];
+    struct nlmsghdr *nlh;
+    int fd, opt, len, cntr;
+
+    while ((opt = getopt(argc, argv, "gd:")) != -1) {
+        switch (opt) {
+            case 'g':
+                get = 1;
+                break;
+            case 'd':
+                if (ndevices == MAX_FILTER_DEVICES - 1)
+                    usage();
+                devices[ndevices++] = strtoul(optarg, NULL, 0);
+                break;
+            default:
+                usage();
+        }
+    }
+    if (get && !ndevices)
+        usage();
+
+    fd = socket(AF_NETLINK, SOCK_RAW, NETLINK_GENERIC);
+    if (fd < 0 || bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+        perror("netlink");
+        return 1;
+    }
+    if (resolve_family(fd, &fam) < 0) {
+        fprintf(stderr, "no \"%s\" netlink family, is the rgbw class loaded?\n", RGBW_GENL_NAME);
+        return 1;
+    }
+
+    if (get) {
+        for (cntr = 0; cntr < ndevices; cntr++) {
+            if (nl_send(fd, fam.id, RGBW_CMD_GET, RGBW_ATTR_DEVICE,
+                        &devices[cntr], sizeof(devices[cntr])) < 0) {
+                perror("send");
+                return 1;
+            }
+            len = recv(fd, buf, sizeof(buf), 0);
+            nlh = (struct nlmsghdr *)buf;
+            if (len < 0 || !NLMSG_OK(nlh, len)) {
+                perror("recv");
+                return 1;
+            }
+            if (nlh->nlmsg_type == NLMSG_ERROR) {
+                fprintf(stderr, "dev %u: %s\n", devices[cntr],
+                        strerror(-((struct nlmsgerr *)NLMSG_DATA(nlh))->error));
+                continue;
+            }
+            print_state(nlh);
+        }
+        return 0;
+    }
+
+    if (!fam.group) {
+        fprintf(stderr, "no \"%s\" multicast group\n", RGBW_GENL_MCGRP_STATE);
+        return 1;
+    }
+    if (ndevices && attach_filter(fd, devices, ndevices) < 0) {
+        perror("SO_ATTACH_FILTER");
+        return 1;
+    }
+    if (setsockopt(fd, SOL_NETLINK, NETLINK_ADD_MEMBERSHIP, &fam.group, sizeof(fam.group)) < 0) {
+        perror("NETLINK_ADD_MEMBERSHIP");
+        return 1;
+    }
+
+    for (;;) {
+        len = recv(fd, buf, sizeof(buf), 0);
+        if (len < 0) {
+            if (errno == ENOBUFS) {
+                fprintf(stderr, "overrun, some changes were lost\n");
+                continue;
+            }
+            perror("recv");
+            return 1;
+        }
+        for (nlh = (struct nlmsghdr *)buf; NLMSG_OK(nlh, len); nlh = NLMSG_NEXT(nlh, len)) {
+            if (nlh->nlmsg_type == fam.id)
+                print_state(nlh);
+        }
+    }
+
+    return 0;
+}
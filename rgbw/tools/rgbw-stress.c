@@ -0,0 +1,481 @@
+/*
+ * RGB+W LED multithreaded stress and throughput benchmark
+ *
+ * Copyleft 2016 Tudor Design Systems, LLC.
+ *
+ * Author: Cody Tudor <cody.tudor@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * Hammers one or more rgbw devices from N threads for a fixed time.
+ * Thread n drives device n % M, so with more threads than devices
+ * several threads contend on the same device's locks. Every write is
+ * timed; at the end the tool prints the write throughput, the
+ * p50/p99/p999/max write latency and, from each device's "stats"
+ * attribute, how many update_status calls and hardware writes the
+ * driver made over the run.
+ *
+ * Modes:
+ *   values   "#RRGGBBWW" to RGBW_values
+ *   single   0..max to red/green/blue/white_value in turn
+ *   ioctl    RGBW_IOC_SET on /dev/<dev>
+ *   effects  rainbow on/off; stopping an effect sleeps in the class
+ *   mixed    values and single interleaved, one rainbow toggle every
+ *            EFFECT_EVERY writes (default)
+ *
+ * A write or ioctl that fails is counted under "errors" and left out
+ * of the latencies; the run goes on. Only running out of memory for
+ * the latency samples stops a thread.
+ *
+ * usage: rgbw-stress [-t threads] [-s seconds] [-m mode] <dev> [dev...]
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/ioctl.h>
+
+#include "rgbw_uapi.h"
+
+#define DEFAULT_THREADS     4
+#define DEFAULT_SECONDS     5
+#define EFFECT_EVERY        256
+#define SAMPLES_CHUNK       65536
+
+enum stress_mode {
+    MODE_VALUES,
+    MODE_SINGLE,
+    MODE_IOCTL,
+    MODE_EFFECTS,
+    MODE_MIXED,
+};
+
+static const char *const mode_names[] = {
+    [MODE_VALUES] = "values",
+    [MODE_SINGLE] = "single",
+    [MODE_IOCTL] = "ioctl",
+    [MODE_EFFECTS] = "effects",
+    [MODE_MIXED] = "mixed",
+};
+
+static const char *const single_attrs[RGBW_UAPI_COLORS] = {
+    "red_value", "green_value", "blue_value", "white_value",
+};
+
+struct stress_thread {
+    pthread_t thread;
+    int id;
+    const char *dev;
+    enum stress_mode mode;
+    /* open before the clock starts so only writes are timed */
+    int values_fd;
+    int single_fd[RGBW_UAPI_COLORS];
+    int rainbow_fd;
+    int cdev_fd;
+    /* write latencies in ns, saturated at 4s */
+    unsigned int *samples;
+    unsigned long nr_samples;
+    unsigned long max_samples;
+    unsigned long errors;
+    int fatal;
+};
+
+struct dev_stats {
+    unsigned long updates;
+    unsigned long hw_writes;
+    int valid;
+};
+
+static volatile int stop;
+
+static unsigned long long now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (unsigned long long)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static int open_attr(const char *dev, const char *attr, int flags)
+{
+    char path[256];
+    int fd;
+
+    if (!strcmp(attr, "/dev"))
+        snprintf(path, sizeof(path), "/dev/%s", dev);
+    else
+        snprintf(path, sizeof(path), "/sys/class/rgbw/%s/%s", dev, attr);
+    fd = open(path, flags);
+    if (fd < 0)
+        fprintf(stderr, "%s: %s\n", path, strerror(errno));
+    return fd;
+}
+
+static int read_stats(const char *dev, struct dev_stats *stats)
+{
+    char buf[256];
+    char *line;
+    ssize_t len;
+    int fd;
+
+    memset(stats, 0, sizeof(*stats));
+    fd = open_attr(dev, "stats", O_RDONLY);
+    if (fd < 0)
+        return -1;
+    len = pread(fd, buf, sizeof(buf) - 1, 0);
+    close(fd);
+    if (len <= 0)
+        return -1;
+    buf[len] = '\0';
+
+    for (line = strtok(buf, "\n"); line; line = strtok(NULL, "\n")) {
+        sscanf(line, "updates %lu", &stats->updates);
+        sscanf(line, "hw_writes %lu", &stats->hw_writes);
+    }
+    stats->valid = 1;
+    return 0;
+}
+
+static int record(struct stress_thread *st, unsigned long long ns)
+{
+    if (st->nr_samples == st->max_samples) {
+        unsigned int *samples;
+
+        samples = realloc(st->samples, (st->max_samples + SAMPLES_CHUNK) * sizeof(*samples));
+        if (!samples)
+            return -1;
+        st->samples = samples;
+        st->max_samples += SAMPLES_CHUNK;
+    }
+    st->samples[st->nr_samples++] = (ns > 4000000000ULL) ? 4000000000U : (unsigned int)ns;
+    return 0;
+}
+
+/* Timed pwrite, a failed write counts as an error but not its latency */
+static int timed_write(struct stress_thread *st, int fd, const char *buf, int len)
+{
+    unsigned long long start = now_ns();
+
+    if (pwrite(fd, buf, len, 0) != len) {
+        st->errors++;
+        return 0;
+    }
+    return record(st, now_ns() - start);
+}
+
+static int do_values(struct stress_thread *st, unsigned long cntr)
+{
+    char color[16];
+    int len;
+
+    len = snprintf(color, sizeof(color), "#%02x%02x%02x%02x\n",
+                   (unsigned int)(cntr & 0xff), (unsigned int)((cntr >> 1) & 0xff),
+                   (unsigned int)((cntr >> 2) & 0xff), (unsigned int)((cntr >> 3) & 0xff));
+    return timed_write(st, st->values_fd, color, len);
+}
+
+static int do_single(struct stress_thread *st, unsigned long cntr)
+{
+    char level[8];
+    int len;
+
+    len = snprintf(level, sizeof(level), "%u\n", (unsigned int)((cntr >> 2) & 0xff));
+    return timed_write(st, st->single_fd[cntr % RGBW_UAPI_COLORS], level, len);
+}
+
+static int do_ioctl(struct stress_thread *st, unsigned long cntr)
+{
+    struct rgbw_set set;
+    unsigned long long start;
+    int color;
+
+    memset(&set, 0, sizeof(set));
+    set.mask = RGBW_CH_ALL;
+    for (color = 0; color < RGBW_UAPI_COLORS; color++)
+        set.levels[color] = ((cntr >> color) & 0xff) * 0x101;
+
+    start = now_ns();
+    if (ioctl(st->cdev_fd, RGBW_IOC_SET, &set) < 0) {
+        st->errors++;
+        return 0;
+    }
+    return record(st, now_ns() - start);
+}
+
+static int do_effect(struct stress_thread *st, unsigned long cntr)
+{
+    return timed_write(st, st->rainbow_fd, (cntr & 1) ? "0\n" : "1\n", 2);
+}
+
+static void *stress_thread_fn(void *arg)
+{
+    struct stress_thread *st = arg;
+    unsigned long cntr;
+    int ret = 0;
+
+    /* spread the threads sharing a device over different colors */
+    for (cntr = st->id * 7; !stop && !ret; cntr++) {
+        switch (st->mode) {
+            case MODE_VALUES:
+                ret = do_values(st, cntr);
+                break;
+            case MODE_SINGLE:
+                ret = do_single(st, cntr);
+                break;
+            case MODE_IOCTL:
+                ret = do_ioctl(st, cntr);
+                break;
+            case MODE_EFFECTS:
+                ret = do_effect(st, cntr);
+                break;
+            case MODE_MIXED:
+                if ((cntr % EFFECT_EVERY) == 0 || (cntr % EFFECT_EVERY) == 1)
+                    ret = do_effect(st, cntr);
+                else if (cntr & 1)
+                    ret = do_values(st, cntr);
+                else
+                    ret = do_single(st, cntr);
+                break;
+        }
+    }
+    if (ret)
+        st->fatal = ENOMEM;
+    return NULL;
+}
+
+static int open_thread_files(struct stress_thread *st)
+{
+    int color;
+
+    if (st->mode == MODE_VALUES || st->mode == MODE_MIXED) {
+        st->values_fd = open_attr(st->dev, "RGBW_values", O_WRONLY);
+        if (st->values_fd < 0)
+            return -1;
+    }
+    if (st->mode == MODE_SINGLE || st->mode == MODE_MIXED) {
+        for (color = 0; color < RGBW_UAPI_COLORS; color++) {
+            st->single_fd[color] = open_attr(st->dev, single_attrs[color], O_WRONLY);
+            if (st->single_fd[color] < 0)
+                return -1;
+        }
+    }
+    if (st->mode == MODE_EFFECTS || st->mode == MODE_MIXED) {
+        st->rainbow_fd = open_attr(st->dev, "rainbow", O_WRONLY);
+        if (st->rainbow_fd < 0)
+            return -1;
+    }
+    if (st->mode == MODE_IOCTL) {
+        st->cdev_fd = open_attr(st->dev, "/dev", O_RDWR);
+        if (st->cdev_fd < 0)
+            return -1;
+    }
+    return 0;
+}
+
+static void close_thread_files(struct stress_thread *st)
+{
+    int color;
+
+    if (st->values_fd >= 0)
+        close(st->values_fd);
+    for (color = 0; color < RGBW_UAPI_COLORS; color++) {
+        if (st->single_fd[color] >= 0)
+            close(st->single_fd[color]);
+    }
+    if (st->rainbow_fd >= 0)
+        close(st->rainbow_fd);
+    if (st->cdev_fd >= 0)
+        close(st->cdev_fd);
+}
+
+static int cmp_uint(const void *a, const void *b)
+{
+    unsigned int x = *(const unsigned int *)a;
+    unsigned int y = *(const unsigned int *)b;
+
+    return (x > y) - (x < y);
+}
+
+static double percentile_us(const unsigned int *sorted, unsigned long n, double p)
+{
+    unsigned long idx;
+
+    if (!n)
+        return 0;
+    idx = (unsigned long)(p * (n - 1) + 0.5);
+    return sorted[idx] / 1000.0;
+}
+
+static void usage(const char *prog)
+{
+    fprintf(stderr, "usage: %s [-t threads] [-s seconds] [-m values|single|ioctl|effects|mixed] <dev> [dev...]\n",
+            prog);
+}
+
+int main(int argc, char **argv)
+{
+    enum stress_mode mode = MODE_MIXED;
+    unsigned int nr_threads = DEFAULT_THREADS;
+    unsigned int seconds = DEFAULT_SECONDS;
+    struct stress_thread *threads;
+    struct dev_stats *before, *after;
+    unsigned long long start, elapsed;
+    unsigned long total = 0, errors = 0, pos;
+    unsigned int *all;
+    const char **devs;
+    int nr_devs;
+    unsigned int cntr;
+    int opt, ret = 0;
+
+    while ((opt = getopt(argc, argv, "t:s:m:")) != -1) {
+        switch (opt) {
+            case 't':
+                nr_threads = strtoul(optarg, NULL, 0);
+                break;
+            case 's':
+                seconds = strtoul(optarg, NULL, 0);
+                break;
+            case 'm':
+                for (cntr = 0; cntr <= MODE_MIXED; cntr++) {
+                    if (!strcmp(optarg, mode_names[cntr]))
+                        break;
+                }
+                if (cntr > MODE_MIXED) {
+                    usage(argv[0]);
+                    return 2;
+                }
+                mode = cntr;
+                break;
+            default:
+                usage(argv[0]);
+                return 2;
+        }
+    }
+    if (optind >= argc || !nr_threads || !seconds) {
+        usage(argv[0]);
+        return 2;
+    }
+    devs = (const char **)&argv[optind];
+    nr_devs = argc - optind;
+
+    threads = calloc(nr_threads, sizeof(*threads));
+    before = calloc(nr_devs, sizeof(*before));
+    after = calloc(nr_devs, sizeof(*after));
+    if (!threads || !before || !after) {
+        fprintf(stderr, "out of memory\n");
+        return 1;
+    }
+
+    for (cntr = 0; cntr < nr_threads; cntr++) {
+        struct stress_thread *st = &threads[cntr];
+        int color;
+
+        st->id = cntr;
+        st->dev = devs[cntr % nr_devs];
+        st->mode = mode;
+        st->values_fd = st->rainbow_fd = st->cdev_fd = -1;
+        for (color = 0; color < RGBW_UAPI_COLORS; color++)
+            st->single_fd[color] = -1;
+    }
+    for (cntr = 0; cntr < nr_threads; cntr++) {
+        if (open_thread_files(&threads[cntr])) {
+            ret = 1;
+            goto out;
+        }
+    }
+
+    for (cntr = 0; cntr < (unsigned int)nr_devs; cntr++)
+        read_stats(devs[cntr], &before[cntr]);
+
+    start = now_ns();
+    for (cntr = 0; cntr < nr_threads; cntr++) {
+        if (pthread_create(&threads[cntr].thread, NULL, stress_thread_fn, &threads[cntr])) {
+            fprintf(stderr, "pthread_create failed\n");
+            stop = 1;
+            nr_threads = cntr;
+            ret = 1;
+            break;
+        }
+    }
+    if (!ret)
+        sleep(seconds);
+    stop = 1;
+    for (cntr = 0; cntr < nr_threads; cntr++)
+        pthread_join(threads[cntr].thread, NULL);
+    elapsed = now_ns() - start;
+
+    for (cntr = 0; cntr < (unsigned int)nr_devs; cntr++)
+        read_stats(devs[cntr], &after[cntr]);
+
+    for (cntr = 0; cntr < nr_threads; cntr++) {
+        if (threads[cntr].fatal) {
+            fprintf(stderr, "thread %u: %s\n", cntr, strerror(threads[cntr].fatal));
+            ret = 1;
+        }
+        total += threads[cntr].nr_samples;
+        errors += threads[cntr].errors;
+    }
+
+    all = malloc((total ? total : 1) * sizeof(*all));
+    if (!all) {
+        fprintf(stderr, "out of memory\n");
+        ret = 1;
+        goto out;
+    }
+    for (cntr = 0, pos = 0; cntr < nr_threads; cntr++) {
+        memcpy(&all[pos], threads[cntr].samples, threads[cntr].nr_samples * sizeof(*all));
+        pos += threads[cntr].nr_samples;
+    }
+    qsort(all, total, sizeof(*all), cmp_uint);
+
+    printf("mode %s, %u threads, %d devices, %.2f s\n",
+           mode_names[mode], nr_threads, nr_devs, elapsed / 1e9);
+    printf("%-14s %14lu\n", "writes", total);
+    printf("%-14s %14lu\n", "errors", errors);
+    printf("%-14s %14.0f\n", "writes/s", total / (elapsed / 1e9));
+    printf("%-14s %14.1f\n", "p50 us", percentile_us(all, total, 0.50));
+    printf("%-14s %14.1f\n", "p99 us", percentile_us(all, total, 0.99));
+    printf("%-14s %14.1f\n", "p999 us", percentile_us(all, total, 0.999));
+    printf("%-14s %14.1f\n", "max us", total ? all[total - 1] / 1000.0 : 0);
+
+    printf("\n%-16s %12s %12s %12s\n", "device", "updates/s", "hw writes/s", "hw/update");
+    for (cntr = 0; cntr < (unsigned int)nr_devs; cntr++) {
+        unsigned long updates, hw_writes;
+
+        if (!before[cntr].valid || !after[cntr].valid) {
+            printf("%-16s %12s %12s %12s\n", devs[cntr], "n/a", "n/a", "n/a");
+            continue;
+        }
+        /* unsigned differences survive a counter wrap */
+        updates = after[cntr].updates - before[cntr].updates;
+        hw_writes = after[cntr].hw_writes - before[cntr].hw_writes;
+        printf("%-16s %12.0f %12.0f %12.2f\n", devs[cntr],
+               updates / (elapsed / 1e9), hw_writes / (elapsed / 1e9),
+               updates ? (double)hw_writes / updates : 0);
+    }
+    free(all);
+
+out:
+    for (cntr = 0; cntr < nr_threads; cntr++) {
+        close_thread_files(&threads[cntr]);
+        free(threads[cntr].samples);
+    }
+    free(threads);
+    free(before);
+    free(after);
+    return ret;
+}